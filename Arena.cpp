@@ -0,0 +1,63 @@
+#include "Arena.h"
+#include <new>
+#include <sys/mman.h>
+
+Arena::Arena() : chunks(nullptr), cursor(nullptr), limit(nullptr), reserved(0) {
+    for (int i = 0; i < CLASSES; i++) freeLists[i] = nullptr;
+}
+
+Arena::~Arena() {
+    reset();
+}
+
+void* Arena::allocate(int size) {
+    if (size > MAX_SMALL) return ::operator new(size);
+    int cls = (size + ALIGN - 1) / ALIGN - 1;
+    if (cls < 0) cls = 0;
+
+    FreeObject* reused = freeLists[cls];
+    if (reused) {
+        freeLists[cls] = reused->next;
+        return reused;
+    }
+
+    int rounded = (cls + 1) * ALIGN;
+    if (limit - cursor < rounded) {
+        void* mem = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) throw std::bad_alloc();
+        Chunk* chunk = (Chunk*)mem;
+        chunk->next = chunks;
+        chunks = chunk;
+        // The header takes the first slot so objects stay aligned
+        cursor = (char*)mem + ALIGN;
+        limit = (char*)mem + CHUNK_SIZE;
+        reserved += CHUNK_SIZE;
+    }
+    void* p = cursor;
+    cursor += rounded;
+    return p;
+}
+
+void Arena::release(void* p, int size) {
+    if (!p) return;
+    if (size > MAX_SMALL) {
+        ::operator delete(p);
+        return;
+    }
+    int cls = (size + ALIGN - 1) / ALIGN - 1;
+    if (cls < 0) cls = 0;
+    FreeObject* object = (FreeObject*)p;
+    object->next = freeLists[cls];
+    freeLists[cls] = object;
+}
+
+void Arena::reset() {
+    while (chunks) {
+        Chunk* next = chunks->next;
+        munmap(chunks, CHUNK_SIZE);
+        chunks = next;
+    }
+    cursor = limit = nullptr;
+    for (int i = 0; i < CLASSES; i++) freeLists[i] = nullptr;
+    reserved = 0;
+}
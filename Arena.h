@@ -0,0 +1,48 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+// Allocator for the small fixed-size objects one document creates in bulk;
+// only piece table nodes use it. Objects are carved out of 64 KB chunks
+// mapped straight from the OS; freed objects go on a free list per size
+// class and are reused. Destroying or resetting the arena unmaps every
+// chunk at once, so clearing or closing a piece table hands its nodes back
+// without walking the tree. Requests over MAX_SMALL bytes go to the
+// global heap. Not thread-safe.
+class Arena {
+private:
+    static const int CHUNK_SIZE = 64 * 1024;
+    static const int ALIGN = 16;
+    static const int MAX_SMALL = 256;
+    static const int CLASSES = MAX_SMALL / ALIGN;
+
+    struct Chunk {
+        Chunk* next;
+    };
+    struct FreeObject {
+        FreeObject* next;
+    };
+
+    Chunk* chunks;
+    char* cursor;            // bump pointer into the newest chunk
+    char* limit;
+    FreeObject* freeLists[CLASSES];
+    long long reserved;
+
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+
+public:
+    Arena();
+    ~Arena();
+
+    void* allocate(int size);
+    // size must match the allocate() call
+    void release(void* p, int size);
+    // Frees every object at once
+    void reset();
+
+    // Bytes mapped for chunks
+    long long bytesReserved() const { return reserved; }
+};
+
+#endif
@@ -0,0 +1,1101 @@
+// Headless benchmark: drives Document and the text backends without FLTK.
+//
+//   ./texteditor-bench [--backend=gap|piece|all] [--max-file-mb=N]
+//                      [--trace=FILE] [--stats=FILE] [--quick]
+//
+// Each scenario runs in a forked child so the reported peak RSS belongs to
+// that scenario alone. --stats turns on the editor's instrumentation and
+// appends each scenario's histograms to FILE. Trace files hold one command per line:
+//   i <text>   type text (\n and \\ escapes)     k   backspace
+//   d          delete forward                    u   undo
+//   g <pos>    move cursor to offset             r   redo
+//   p <bytes>  paste that many synthetic bytes   <>^v  arrow keys
+//   b          break the undo group (cursor jump, mode switch)
+
+#include "Document.h"
+#include "Stack.h"
+#include "EditorState.h"
+#include "RegexSearch.h"
+#include "CppLexer.h"
+#include "Journal.h"
+#include "UndoFile.h"
+#include "Metrics.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <utility>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// --- Timing & Reporting ---
+static double nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static long peakRssMb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024;
+}
+
+// Resident set right now, unlike the peak above
+static long currentRssMb() {
+    long pages = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(f);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024) / 1024;
+}
+
+// Per-operation latencies in microseconds
+class LatencyLog {
+private:
+    double* samples;
+    int count;
+    int capacity;
+
+    static int compare(const void* a, const void* b) {
+        double x = *(const double*)a, y = *(const double*)b;
+        return x < y ? -1 : (x > y ? 1 : 0);
+    }
+
+public:
+    LatencyLog() : samples(new double[1024]), count(0), capacity(1024) {}
+    ~LatencyLog() { delete[] samples; }
+
+    void add(double us) {
+        if (count == capacity) {
+            double* grown = new double[capacity * 2];
+            memcpy(grown, samples, count * sizeof(double));
+            delete[] samples;
+            samples = grown;
+            capacity *= 2;
+        }
+        samples[count++] = us;
+    }
+
+    int size() const { return count; }
+
+    void report(const char* backend, const char* scenario, double totalUs, double bytes = 0) {
+        qsort(samples, count, sizeof(double), compare);
+        double p50 = count ? samples[count / 2] : 0;
+        double p99 = count ? samples[(int)(count * 0.99)] : 0;
+        double mx = count ? samples[count - 1] : 0;
+        printf("%-6s %-20s %9d ops %10.1f ms %12.0f ops/s  p50 %8.2f  p99 %9.2f  max %10.2f us",
+               backend, scenario, count, totalUs / 1000, count / (totalUs / 1e6), p50, p99, mx);
+        if (bytes > 0) printf("  %8.1f MB/s", bytes / (1024.0 * 1024.0) / (totalUs / 1e6));
+        printf("  rss %5ld MB\n", peakRssMb());
+        fflush(stdout);
+    }
+};
+
+// --- Synthetic Content ---
+static unsigned rngState = 12345;
+static unsigned nextRandom() {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+// Log-like text: lines of 20-100 printable characters
+static char* makeText(int len) {
+    char* text = new char[len + 1];
+    int lineLeft = 20 + nextRandom() % 80;
+    for (int i = 0; i < len; i++) {
+        if (--lineLeft == 0) {
+            text[i] = '\n';
+            lineLeft = 20 + nextRandom() % 80;
+        } else {
+            text[i] = 'a' + nextRandom() % 26;
+        }
+    }
+    text[len] = '\0';
+    return text;
+}
+
+static void loadSynthetic(Document& doc, int len) {
+    char* text = makeText(len);
+    doc.getBuffer()->loadFromString(text);
+    delete[] text;
+}
+
+// --- Scenarios ---
+static void benchTyping(const char* backend, int n) {
+    Document doc(backend);
+    LatencyLog log;
+    double start = nowUs();
+    for (int i = 0; i < n; i++) {
+        char c = (i % 72 == 71) ? '\n' : 'a' + i % 26;
+        double t = nowUs();
+        doc.typeText(&c, 1, true);
+        log.add(nowUs() - t);
+    }
+    log.report(backend, "typing-burst", nowUs() - start);
+}
+
+// Heap allocations on the keystroke path once warmed up: typing, deleting
+// both ways and moving the cursor, with a jump every 16 keys. Here the
+// undo ring still grows towards its budget and the text outgrows its
+// spare room now and then; make check holds the same keys to zero.
+static void benchKeyAllocs(const char* backend, int docLen, int n) {
+    Document doc(backend);
+    loadSynthetic(doc, docLen);
+    doc.getWrap()->reset(doc.getBuffer()->lineCount());
+    doc.getWrap()->setWidth(80);
+    long long allocating = 0, total = 0;
+    LatencyLog log;
+    double start = nowUs();
+    for (int i = 0; i < 2 * n; i++) {
+        bool measured = i >= n;
+        long long before = Metrics::allocations();
+        double t = nowUs();
+        if (i % 16 == 0) doc.setCursor(nextRandom() % (doc.getBuffer()->getLength() + 1));
+        switch (nextRandom() % 8) {
+            case 0: doc.backspace(); break;
+            case 1: doc.deleteForward(); break;
+            case 2: doc.moveLeft(false); break;
+            case 3: doc.moveDown(false); break;
+            case 4: doc.typeText("\n", 1, true); break;
+            default: doc.typeText("x", 1, true); break;
+        }
+        if (!measured) continue;
+        long long count = Metrics::allocations() - before;
+        log.add(nowUs() - t);
+        total += count;
+        if (count > 0) allocating++;
+    }
+    log.report(backend, "key-allocs", nowUs() - start);
+    printf("%-6s %-20s %9lld allocations, %lld of %d keys allocated\n", backend, "key-allocs", total, allocating, n);
+    if (allocating * 100 > n) printf("key-allocs: FAIL, over 1%% of keys allocated\n");
+    fflush(stdout);
+}
+
+static void benchRandomEdits(const char* backend, int docLen, int n) {
+    Document doc(backend);
+    loadSynthetic(doc, docLen);
+    LatencyLog log;
+    double start = nowUs();
+    for (int i = 0; i < n; i++) {
+        int pos = nextRandom() % (doc.getBuffer()->getLength() + 1);
+        double t = nowUs();
+        doc.setCursor(pos);
+        if (i % 3 == 2) doc.backspace();
+        else doc.typeText("x", 1, true);
+        log.add(nowUs() - t);
+    }
+    log.report(backend, "random-edits", nowUs() - start);
+}
+
+static void benchPaste(const char* backend, int docLen, int pasteLen, int n) {
+    Document doc(backend);
+    loadSynthetic(doc, docLen);
+    char* clip = makeText(pasteLen);
+    LatencyLog log;
+    double start = nowUs();
+    for (int i = 0; i < n; i++) {
+        double t = nowUs();
+        doc.setCursor(doc.getBuffer()->getLength() / 2);
+        doc.typeText(clip, pasteLen, false);
+        log.add(nowUs() - t);
+    }
+    log.report(backend, "large-paste", nowUs() - start, (double)pasteLen * n);
+    delete[] clip;
+}
+
+static void benchUndoStorm(const char* backend, int n) {
+    Document doc(backend);
+    for (int i = 0; i < n; i++) {
+        if (i % 8 == 0) doc.setCursor(nextRandom() % (doc.getBuffer()->getLength() + 1));
+        char c = 'a' + i % 26;
+        doc.typeText(&c, 1, true);
+    }
+
+    LatencyLog undoLog, redoLog;
+    double start = nowUs();
+    while (true) {
+        double t = nowUs();
+        if (!doc.undo()) break;
+        undoLog.add(nowUs() - t);
+    }
+    undoLog.report(backend, "undo-storm", nowUs() - start);
+
+    start = nowUs();
+    while (true) {
+        double t = nowUs();
+        if (!doc.redo()) break;
+        redoLog.add(nowUs() - t);
+    }
+    redoLog.report(backend, "redo-storm", nowUs() - start);
+}
+
+// A long session under a small undo budget: history memory must level off
+// at the budget while typing and pasting stay fast
+static void benchUndoBudget(const char* backend, int n) {
+    Document doc(backend);
+    doc.setHistoryBudget(8 << 20);
+    char* paste = makeText(64 << 10);
+    LatencyLog log;
+    long long peak = 0;
+    double start = nowUs();
+    for (int i = 0; i < n; i++) {
+        double t = nowUs();
+        if (i % 1000 == 999) {
+            doc.setCursor(nextRandom() % (doc.getBuffer()->getLength() + 1));
+            doc.typeText(paste, 64 << 10, false);
+        } else {
+            if (i % 8 == 0) doc.setCursor(nextRandom() % (doc.getBuffer()->getLength() + 1));
+            char c = 'a' + i % 26;
+            doc.typeText(&c, 1, true);
+        }
+        log.add(nowUs() - t);
+        if (doc.getHistoryBytes() > peak) peak = doc.getHistoryBytes();
+    }
+    log.report(backend, "undo-budget", nowUs() - start);
+    printf("%-6s %-20s peak %.1f MB, budget %.1f MB, %d undo records kept\n", backend, "undo-budget-mem",
+           peak / 1048576.0, doc.getHistoryBudget() / 1048576.0, doc.undoDepth());
+    fflush(stdout);
+    delete[] paste;
+}
+
+// Undo history saved with the file: what saving it costs, that reopening
+// costs the same with or without it, and undo latency across sessions
+static void benchUndoPersist(const char* backend, int sizeMb, int n) {
+    char path[256], undoPath[300];
+    char asidePath[sizeof(undoPath) + 6];   // room for ".aside"
+    sprintf(path, "/tmp/texteditor-bench-%d.txt", (int)getpid());
+    UndoFile::pathFor(path, undoPath, sizeof(undoPath));
+    snprintf(asidePath, sizeof(asidePath), "%s.aside", undoPath);
+    FILE* f = fopen(path, "wb");
+    if (!f) return;
+    char* block = makeText(1 << 20);
+    for (int i = 0; i < sizeMb; i++) fwrite(block, 1, 1 << 20, f);
+    fclose(f);
+    delete[] block;
+
+    {
+        Document doc(backend);
+        doc.loadFromFile(path);
+        for (int i = 0; i < n; i++) {
+            if (i % 8 == 0) doc.setCursor(nextRandom() % (doc.getBuffer()->getLength() + 1));
+            char c = 'a' + i % 26;
+            doc.typeText(&c, 1, true);
+        }
+        LatencyLog saveLog;
+        double start = nowUs();
+        doc.saveToFile(path);
+        saveLog.add(nowUs() - start);
+        saveLog.report(backend, "undo-persist-save", nowUs() - start);
+    }
+
+    // Open with the history file moved aside, then with it in place
+    LatencyLog plainLog, openLog, undoLog;
+    rename(undoPath, asidePath);
+    double start = nowUs();
+    {
+        Document doc(backend);
+        doc.loadFromFile(path);
+        plainLog.add(nowUs() - start);
+    }
+    plainLog.report(backend, "open-no-history", nowUs() - start);
+    rename(asidePath, undoPath);
+
+    Document doc(backend);
+    start = nowUs();
+    doc.loadFromFile(path);
+    openLog.add(nowUs() - start);
+    openLog.report(backend, "open-with-history", nowUs() - start);
+
+    start = nowUs();
+    while (true) {
+        double t = nowUs();
+        if (!doc.undo()) break;
+        undoLog.add(nowUs() - t);
+    }
+    undoLog.report(backend, "undo-persist-undo", nowUs() - start);
+    if (undoLog.size() != n / 8) printf("undo-persist: %d of %d records undone\n", undoLog.size(), n / 8);
+
+    unlink(undoPath);
+    unlink(path);
+}
+
+static void benchSearch(const char* backend, int docLen, int n) {
+    Document doc(backend);
+    loadSynthetic(doc, docLen);
+    // Fragment the piece table / move the gap into the middle
+    for (int i = 0; i < 1000; i++) {
+        doc.setCursor(nextRandom() % (doc.getBuffer()->getLength() + 1));
+        doc.typeText("abc", 3, false);
+    }
+    double bytes = doc.getBuffer()->getLength();
+
+    LatencyLog nextLog;
+    bool wrapped;
+    doc.setSearchPattern("abc", 3);
+    doc.setCursor(0);
+    double start = nowUs();
+    for (int i = 0; i < n; i++) {
+        double t = nowUs();
+        doc.findNext(true, wrapped);
+        nextLog.add(nowUs() - t);
+    }
+    nextLog.report(backend, "find-next", nowUs() - start);
+
+    // A needle that never matches scans the whole document
+    LatencyLog missLog;
+    doc.setSearchPattern("xyzzy-plugh", 11);
+    start = nowUs();
+    for (int i = 0; i < 5; i++) {
+        double t = nowUs();
+        doc.findNext(true, wrapped);
+        missLog.add(nowUs() - t);
+    }
+    missLog.report(backend, "find-miss", nowUs() - start, bytes * 5);
+
+    LatencyLog replaceLog;
+    doc.setSearchPattern("abc", 3);
+    start = nowUs();
+    double t = nowUs();
+    doc.replaceAll("ABCD", 4);
+    replaceLog.add(nowUs() - t);
+    replaceLog.report(backend, "replace-all", nowUs() - start, bytes);
+}
+
+// Regex scan on the worker thread, then typing on this thread while it
+// runs again. Typing while the worker still copies the text makes it give
+// up (the editor restarts it once typing pauses), so the scan is timed on
+// its own.
+static void benchRegex(const char* backend, int docLen, int n) {
+    Document doc(backend);
+    loadSynthetic(doc, docLen);
+    double bytes = doc.getBuffer()->getLength();
+
+    RegexSearch regex(nullptr, nullptr);
+    LatencyLog scanLog, typeLog;
+    double start = nowUs();
+    regex.start("q[a-f]+z", doc.getBuffer(), doc.getTextLock());
+    while (regex.isRunning()) usleep(100);
+    scanLog.add(nowUs() - start);
+    scanLog.report(backend, "regex-scan", nowUs() - start, bytes);
+
+    start = nowUs();
+    regex.restart(doc.getBuffer(), doc.getTextLock());
+    for (int i = 0; i < n && regex.isRunning(); i++) {
+        double t = nowUs();
+        doc.typeText("x", 1, true);
+        typeLog.add(nowUs() - t);
+    }
+    while (regex.isRunning()) usleep(100);
+    typeLog.report(backend, "regex-type", typeLog.size() ? nowUs() - start : 1);
+}
+
+// Simulates the view: re-lex through a 40-line window after each edit and
+// fetch its tokens, as TextEditor::draw does
+static void drawWindow(Document& doc, int first) {
+    Highlighter* highlighter = doc.getHighlighter();
+    TextBuffer* buffer = doc.getBuffer();
+    highlighter->ensureValid(buffer, first + 40);
+    int from, to, count;
+    highlighter->takeRestyledLines(from, to);
+    for (int line = first; line < first + 40; line++) highlighter->tokensFor(buffer, line, count);
+}
+
+static void benchHighlight(const char* backend, int lines, int n) {
+    static const char* const source[] = {
+        "#include <stdio.h>\n", "/* block comment\n", "   spanning lines */\n",
+        "static int counter = 0x1f; // trailing comment\n", "int main(int argc, char** argv) {\n",
+        "    const char* s = \"text with // inside\";\n", "    return argc > 1 ? 42 : 0;\n", "}\n",
+    };
+    int count = sizeof(source) / sizeof(source[0]);
+    int total = 0;
+    for (int i = 0; i < lines; i++) total += strlen(source[i % count]);
+    char* text = new char[total + 1];
+    char* p = text;
+    for (int i = 0; i < lines; i++) p += sprintf(p, "%s", source[i % count]);
+
+    Document doc(backend);
+    doc.getBuffer()->loadFromString(text);
+    delete[] text;
+    Highlighter* highlighter = doc.getHighlighter();
+    highlighter->setLexer(new CppLexer(), doc.getBuffer()->lineCount());
+
+    // First paint in the middle lexes everything above it once
+    LatencyLog openLog;
+    int first = lines / 2;
+    double start = nowUs();
+    drawWindow(doc, first);
+    openLog.add(nowUs() - start);
+    openLog.report(backend, "highlight-open", nowUs() - start);
+
+    // Typing inside the window, plus opening and closing a block comment
+    LatencyLog editLog;
+    long long lexedBefore = highlighter->getLinesLexed();
+    start = nowUs();
+    for (int i = 0; i < n; i++) {
+        TextBuffer* buffer = doc.getBuffer();
+        int line = first + 5 + nextRandom() % 30;
+        double t = nowUs();
+        doc.setCursor(buffer->offsetOfLine(line));
+        if (i % 50 == 0) doc.typeText("/*", 2, false);
+        else if (i % 50 == 1) doc.undo();
+        else doc.typeText("x", 1, true);
+        drawWindow(doc, first);
+        editLog.add(nowUs() - t);
+    }
+    editLog.report(backend, "highlight-edit", nowUs() - start);
+    printf("%-6s %-20s %9.1f lines lexed per edit\n", backend, "highlight-relex",
+           (double)(highlighter->getLinesLexed() - lexedBefore) / n);
+    fflush(stdout);
+}
+
+// Column lookups a repaint makes over a 40-line window: where drawing
+// stops at the right edge and the column of the line end
+static void columnWindow(Document& doc, int first) {
+    ColumnIndex* columns = doc.getColumns();
+    TextBuffer* buffer = doc.getBuffer();
+    for (int line = first; line < first + 40; line++) {
+        columns->offsetAt(buffer, line, 120);
+        columns->columnOf(buffer, line, buffer->lineEnd(line));
+    }
+}
+
+// Typing, moving up and down and repainting on pure ASCII text and on text
+// where every line holds multibyte characters; the ASCII run should skip
+// decoding entirely
+static void benchColumns(const char* backend, int lines, int n) {
+    static const char* const ascii = "    value = lookup(table, key) + offset; // plain\n";
+    static const char* const utf8 = "    значение = поиск(表, ключ) + 偏移; // ü ø é\n";
+    for (int pass = 0; pass < 2; pass++) {
+        const char* line = pass == 0 ? ascii : utf8;
+        int lineLen = strlen(line);
+        char* text = new char[lineLen * lines + 1];
+        for (int i = 0; i < lines; i++) memcpy(text + i * lineLen, line, lineLen);
+        text[lineLen * lines] = '\0';
+        Document doc(backend);
+        doc.getBuffer()->loadFromString(text);
+        delete[] text;
+
+        LatencyLog log;
+        int first = lines / 2;
+        const char* typed = pass == 0 ? "e" : "\xc3\xa9";
+        double start = nowUs();
+        for (int i = 0; i < n; i++) {
+            TextBuffer* buffer = doc.getBuffer();
+            int target = first + 5 + nextRandom() % 30;
+            double t = nowUs();
+            doc.setCursor(buffer->offsetOfLine(target) + 20);
+            doc.moveRight(false);
+            doc.typeText(typed, strlen(typed), true);
+            doc.moveDown(false);
+            doc.moveUp(false);
+            columnWindow(doc, first);
+            log.add(nowUs() - t);
+        }
+        log.report(backend, pass == 0 ? "columns-ascii" : "columns-utf8", nowUs() - start);
+    }
+}
+
+// Row lookups a repaint makes with soft wrap on: lay out a 40-row window
+// from its top, then check the cursor is inside it as updateScroll does
+static void wrapWindow(Document& doc, int firstLine) {
+    WrapLayout* wrap = doc.getWrap();
+    TextBuffer* buffer = doc.getBuffer();
+    int line = firstLine, row = 0;
+    for (int r = 0; r < 40; r++) wrap->advance(buffer, line, row, 1);
+    int cursorLine = buffer->lineOfOffset(doc.getCursor());
+    int cursorRow = wrap->rowOfColumn(buffer, cursorLine, doc.getColumns()->columnOf(buffer, doc.getCursor()));
+    wrap->rowsBetween(buffer, firstLine, 0, cursorLine, cursorRow, 40);
+}
+
+// Editing with soft wrap on over lines of 20-400 characters, and changing
+// the wrap width as a resize or zoom would; a new width should only
+// re-divide cached column counts
+static void benchWrap(const char* backend, int lines, int n) {
+    char* text = new char[lines * 401 + 1];
+    char* p = text;
+    for (int i = 0; i < lines; i++) {
+        int len = 20 + nextRandom() % 380;
+        for (int k = 0; k < len; k++) *p++ = k % 9 == 8 ? ' ' : 'a' + nextRandom() % 26;
+        *p++ = '\n';
+    }
+    *p = '\0';
+    Document doc(backend);
+    doc.getBuffer()->loadFromString(text);
+    delete[] text;
+    doc.getWrap()->reset(doc.getBuffer()->lineCount());
+    doc.getWrap()->setWidth(100);
+
+    LatencyLog editLog;
+    int first = lines / 2;
+    double start = nowUs();
+    for (int i = 0; i < n; i++) {
+        TextBuffer* buffer = doc.getBuffer();
+        int line = first + 5 + nextRandom() % 20;
+        double t = nowUs();
+        doc.setCursor(buffer->offsetOfLine(line) + 150);
+        doc.typeText("x", 1, true);
+        doc.moveDown(false);
+        doc.moveUp(false);
+        wrapWindow(doc, first);
+        editLog.add(nowUs() - t);
+    }
+    editLog.report(backend, "wrap-edit", nowUs() - start);
+
+    LatencyLog resizeLog;
+    start = nowUs();
+    for (int i = 0; i < n / 10; i++) {
+        double t = nowUs();
+        doc.getWrap()->setWidth(60 + i % 80);
+        wrapWindow(doc, first);
+        resizeLog.add(nowUs() - t);
+    }
+    resizeLog.report(backend, "wrap-resize", nowUs() - start);
+}
+
+// Typing at a column of cursors, one every 20 lines, applied as one
+// batched edit per key; then the same keys typed at each spot in turn,
+// which moves the gap once per cursor
+static void benchCarets(const char* backend, int docLen, int cursors, int n) {
+    Document doc(backend);
+    loadSynthetic(doc, docLen);
+    TextBuffer* buffer = doc.getBuffer();
+    int first = buffer->lineCount() / 4;
+    doc.setCursor(buffer->offsetOfLine(first) + 10);
+    for (int k = 1; k < cursors; k++) doc.addCaret(buffer->offsetOfLine(first + k * 20) + 10);
+
+    LatencyLog batchLog;
+    double start = nowUs();
+    for (int i = 0; i < n; i++) {
+        char c = 'a' + i % 26;
+        double t = nowUs();
+        if (i % 40 == 39) doc.backspace();
+        else doc.typeText(&c, 1, true);
+        batchLog.add(nowUs() - t);
+    }
+    batchLog.report(backend, "carets-batched", nowUs() - start);
+
+    doc.clearCarets();
+    int* spots = new int[cursors];
+    for (int k = 0; k < cursors; k++) spots[k] = buffer->offsetOfLine(first + k * 20) + 10;
+    LatencyLog loopLog;
+    start = nowUs();
+    for (int i = 0; i < n / 10; i++) {
+        char c = 'a' + i % 26;
+        double t = nowUs();
+        // Last spot first, so earlier spots stay put until the round ends
+        for (int k = cursors - 1; k >= 0; k--) {
+            doc.setCursor(spots[k]);
+            doc.typeText(&c, 1, false);
+        }
+        loopLog.add(nowUs() - t);
+        for (int k = 0; k < cursors; k++) spots[k] += k + 1;
+    }
+    loopLog.report(backend, "carets-looped", nowUs() - start);
+    delete[] spots;
+}
+
+// Typing into a large file with the crash-recovery journal on, then
+// replaying that journal as a restarted editor would
+static void benchJournal(const char* backend, int sizeMb, int n) {
+    char path[256], journalPath[300];
+    sprintf(path, "/tmp/texteditor-bench-%d.txt", (int)getpid());
+    FILE* f = fopen(path, "wb");
+    if (!f) return;
+    char* block = makeText(1 << 20);
+    for (int i = 0; i < sizeMb; i++) fwrite(block, 1, 1 << 20, f);
+    fclose(f);
+    delete[] block;
+
+    LatencyLog typeLog;
+    {
+        Document doc(backend);
+        doc.loadFromFile(path);
+        doc.setJournaling(true);
+        double start = nowUs();
+        for (int i = 0; i < n; i++) {
+            if (i % 64 == 0) doc.setCursor(nextRandom() % (doc.getBuffer()->getLength() + 1));
+            char c = (i % 72 == 71) ? '\n' : 'a' + i % 26;
+            double t = nowUs();
+            doc.typeText(&c, 1, true);
+            typeLog.add(nowUs() - t);
+        }
+        typeLog.report(backend, "journal-typing", nowUs() - start);
+    }   // leaves the journal behind, as a crash would
+
+    LatencyLog recoverLog;
+    Document doc(backend);
+    double start = nowUs();
+    doc.loadFromFile(path);
+    doc.setJournaling(true);
+    recoverLog.add(nowUs() - start);
+    recoverLog.report(backend, "journal-recover", nowUs() - start);
+    if (doc.getRecoveredEdits() != n) printf("journal-recover: replayed %d of %d edits\n", doc.getRecoveredEdits(), n);
+
+    Journal::pathFor(path, journalPath, sizeof(journalPath));
+    doc.setJournaling(false);
+    unlink(journalPath);
+    unlink(path);
+}
+
+// A file opened in paged mode: opening, turning through every page, and
+// saving after edits on a few pages
+static void benchPaged(const char* backend, int sizeMb) {
+    char path[256];
+    sprintf(path, "/tmp/texteditor-bench-%d.txt", (int)getpid());
+    FILE* f = fopen(path, "wb");
+    if (!f) return;
+    char* block = makeText(1 << 20);
+    for (int i = 0; i < sizeMb; i++) fwrite(block, 1, 1 << 20, f);
+    fclose(f);
+    delete[] block;
+
+    Document doc(backend);
+    doc.setPagedThreshold(1 << 20);
+    LatencyLog openLog, pageLog, saveLog;
+    double start = nowUs();
+    doc.loadFromFile(path);
+    openLog.add(nowUs() - start);
+    openLog.report(backend, "paged-open", nowUs() - start);
+
+    start = nowUs();
+    while (true) {
+        if (doc.getPage() % 3 == 0) doc.typeText("edit\n", 5, false);
+        double t = nowUs();
+        if (!doc.turnPage(1)) break;
+        pageLog.add(nowUs() - t);
+    }
+    pageLog.report(backend, "paged-turn", nowUs() - start);
+
+    start = nowUs();
+    doc.saveToFile(path);
+    saveLog.add(nowUs() - start);
+    saveLog.report(backend, "paged-save", nowUs() - start);
+    unlink(path);
+}
+
+// Another process changing an open file: appending a line at a time as a
+// log does, then rewriting a few lines and saving by rename as an editor does
+static void benchReload(const char* backend, int sizeMb, int n) {
+    char path[256], tempPath[300];
+    sprintf(path, "/tmp/texteditor-bench-%d.txt", (int)getpid());
+    sprintf(tempPath, "%s.new", path);
+    int len = sizeMb << 20;
+    char* text = makeText(len);
+    FILE* f = fopen(path, "wb");
+    if (!f) return;
+    fwrite(text, 1, len, f);
+    fclose(f);
+
+    Document doc(backend);
+    doc.loadFromFile(path);
+    doc.setCursor(doc.getBuffer()->getLength());
+    LatencyLog appendLog;
+    double start = nowUs();
+    for (int i = 0; i < n; i++) {
+        f = fopen(path, "ab");
+        fprintf(f, "%08d appended line\n", i);
+        fclose(f);
+        double t = nowUs();
+        doc.reloadFromDisk();
+        appendLog.add(nowUs() - t);
+    }
+    appendLog.report(backend, "reload-append", nowUs() - start);
+    if (doc.getBuffer()->getLength() != len + n * 23) printf("reload-append: length %d\n", doc.getBuffer()->getLength());
+
+    // Each rewrite changes a handful of bytes spread over the file
+    f = fopen(path, "rb");
+    len = doc.getBuffer()->getLength();
+    delete[] text;
+    text = new char[len];
+    if (fread(text, 1, len, f) != (size_t)len) len = 0;
+    fclose(f);
+    LatencyLog rewriteLog;
+    start = nowUs();
+    for (int i = 0; i < n / 10 + 1; i++) {
+        for (int k = 0; k < 8; k++) {
+            int at = nextRandom() % len;
+            if (text[at] != '\n') text[at] = 'a' + i % 26;
+        }
+        f = fopen(tempPath, "wb");
+        fwrite(text, 1, len, f);
+        fclose(f);
+        rename(tempPath, path);
+        double t = nowUs();
+        doc.reloadFromDisk();
+        rewriteLog.add(nowUs() - t);
+    }
+    rewriteLog.report(backend, "reload-rewrite", nowUs() - start);
+    delete[] text;
+    unlink(path);
+}
+
+// Gutter marks while typing in a large file: the per-keystroke cost of
+// moving the marks along and reading the visible rows' marks, and the
+// diff run after every pause of 16 keystrokes, split into the part on
+// the caller's thread and the wait for the worker
+static void benchChangeMarks(const char* backend, int sizeMb, int n) {
+    char path[256];
+    sprintf(path, "/tmp/texteditor-bench-%d.txt", (int)getpid());
+    int len = sizeMb << 20;
+    char* text = makeText(len);
+    FILE* f = fopen(path, "wb");
+    if (!f) return;
+    fwrite(text, 1, len, f);
+    fclose(f);
+    delete[] text;
+
+    Document doc(backend);
+    double start = nowUs();
+    doc.loadFromFile(path);
+    ChangeTracker* changes = doc.getChanges();
+    int from, to;
+    changes->wait();
+    changes->collect(doc.getBuffer(), from, to);
+    LatencyLog readLog;
+    readLog.add(nowUs() - start);
+    readLog.report(backend, "marks-read", nowUs() - start, len);
+
+    TextBuffer* buffer = doc.getBuffer();
+    LatencyLog typeLog, updateLog, diffLog;
+    start = nowUs();
+    for (int i = 0; i < n; i++) {
+        if (i % 16 == 0) doc.setCursor(nextRandom() % (buffer->getLength() + 1));
+        double t = nowUs();
+        doc.typeText(i % 40 == 39 ? "\n" : "x", 1, true);
+        int line = buffer->lineOfOffset(doc.getCursor());
+        int marks = 0;
+        for (int r = 0; r < 50; r++) marks |= changes->markOf(line - 25 + r);
+        typeLog.add(nowUs() - t);
+        if (marks == 0) printf("marks-type: no mark at an edit\n");
+
+        if (i % 16 == 15) {
+            t = nowUs();
+            changes->update(buffer);
+            updateLog.add(nowUs() - t);
+            changes->wait();
+            changes->collect(buffer, from, to);
+            diffLog.add(nowUs() - t);
+        }
+    }
+    double total = nowUs() - start;
+    typeLog.report(backend, "marks-type", total);
+    updateLog.report(backend, "marks-update", total);
+    diffLog.report(backend, "marks-diff", total);
+    unlink(path);
+}
+
+// Vim motions over C-like source: % and i( from the bracket index, first
+// use building it and matching the outermost pair walking all of it, then
+// typing (the index follows each edit) mixed with % and i( at random
+// spots, w through the text, and G/gg jumps
+static void benchMotions(const char* backend, int lines, int n) {
+    static const char* const source[] = {
+        "int lookup(const char* key, int len) {\n", "    if (len > 0 && key[0] == '#') {\n",
+        "        return table[hash(key, len) % size];\n", "    }\n", "    return -1; // (none)\n", "}\n",
+    };
+    int count = sizeof(source) / sizeof(source[0]);
+    lines -= lines % count;
+    int total = 4;
+    for (int i = 0; i < lines; i++) total += strlen(source[i % count]);
+    char* text = new char[total + 1];
+    char* p = text + sprintf(text, "{\n");
+    for (int i = 0; i < lines; i++) p += sprintf(p, "%s", source[i % count]);
+    sprintf(p, "}\n");
+
+    Document doc(backend);
+    doc.getBuffer()->loadFromString(text);
+    delete[] text;
+    doc.getWrap()->reset(doc.getBuffer()->lineCount());
+    TextBuffer* buffer = doc.getBuffer();
+
+    LatencyLog indexLog, outerLog;
+    double start = nowUs();
+    doc.setCursor(0);
+    doc.matchBracket();
+    indexLog.add(nowUs() - start);
+    indexLog.report(backend, "motion-index", nowUs() - start, buffer->getLength());
+    double t = nowUs();
+    doc.setCursor(0);
+    doc.matchBracket();
+    outerLog.add(nowUs() - t);
+    outerLog.report(backend, "motion-outer", nowUs() - t);
+    if (doc.getCursor() != buffer->getLength() - 2) printf("motion-outer: wrong match at %d\n", doc.getCursor());
+
+    LatencyLog typeLog, matchLog, objectLog;
+    int line = 1;
+    start = nowUs();
+    for (int i = 0; i < n; i++) {
+        // A new spot every 16 keys, typing on there in between
+        if (i % 16 == 0) line = 1 + nextRandom() % (buffer->lineCount() - 2);
+        doc.setCursor(buffer->offsetOfLine(line) + 4);
+        t = nowUs();
+        doc.typeText(i % 8 == 0 ? "()" : "x", i % 8 == 0 ? 2 : 1, true);
+        typeLog.add(nowUs() - t);
+
+        t = nowUs();
+        doc.setCursor(buffer->offsetOfLine(line));
+        doc.matchBracket();
+        matchLog.add(nowUs() - t);
+
+        t = nowUs();
+        doc.setCursor(buffer->offsetOfLine(line) + 12);
+        doc.selectInnerBrackets('(');
+        doc.clearSelection();
+        objectLog.add(nowUs() - t);
+    }
+    double elapsed = nowUs() - start;
+    typeLog.report(backend, "motion-type", elapsed);
+    matchLog.report(backend, "motion-match", elapsed);
+    objectLog.report(backend, "motion-inner", elapsed);
+
+    LatencyLog wordLog, gotoLog;
+    doc.setCursor(0);
+    start = nowUs();
+    for (int i = 0; i < n; i++) {
+        t = nowUs();
+        doc.moveWordStart(false);
+        wordLog.add(nowUs() - t);
+    }
+    wordLog.report(backend, "motion-word", nowUs() - start);
+    start = nowUs();
+    for (int i = 0; i < n; i++) {
+        t = nowUs();
+        doc.gotoLine(i % 2 == 0 ? buffer->lineCount() - 1 : 0);
+        gotoLog.add(nowUs() - t);
+    }
+    gotoLog.report(backend, "motion-goto", nowUs() - start);
+}
+
+// Many open buffers, each with its own edits and undo history, then
+// closing them one by one; closing should hand memory straight back
+static void benchBuffers(const char* backend, int count, int sizeMb, int edits) {
+    char path[256];
+    sprintf(path, "/tmp/texteditor-bench-%d.txt", (int)getpid());
+    FILE* f = fopen(path, "wb");
+    if (!f) return;
+    char* block = makeText(1 << 20);
+    for (int i = 0; i < sizeMb; i++) fwrite(block, 1, 1 << 20, f);
+    fclose(f);
+    delete[] block;
+
+    Document** docs = new Document*[count];
+    LatencyLog openLog;
+    double start = nowUs();
+    for (int k = 0; k < count; k++) {
+        double t = nowUs();
+        docs[k] = new Document(backend);
+        docs[k]->loadFromFile(path);
+        openLog.add(nowUs() - t);
+        for (int i = 0; i < edits; i++) {
+            if (i % 16 == 0) docs[k]->setCursor(nextRandom() % (docs[k]->getBuffer()->getLength() + 1));
+            char c = 'a' + i % 26;
+            docs[k]->typeText(&c, 1, i % 16 != 0);
+        }
+    }
+    openLog.report(backend, "buffers-open", nowUs() - start);
+    long openRss = currentRssMb();
+
+    LatencyLog closeLog;
+    start = nowUs();
+    for (int k = 0; k < count; k++) {
+        double t = nowUs();
+        delete docs[k];
+        closeLog.add(nowUs() - t);
+    }
+    closeLog.report(backend, "buffers-close", nowUs() - start);
+    printf("%-6s %-20s %d open: %ld MB resident, all closed: %ld MB\n",
+           backend, "buffers-rss", count, openRss, currentRssMb());
+    fflush(stdout);
+    delete[] docs;
+    unlink(path);
+}
+
+static void benchStack(int n) {
+    Stack<EditorState> stack;
+    LatencyLog log;
+    char payload[16] = "0123456789abcde";
+    double start = nowUs();
+    for (int i = 0; i < n; i++) {
+        double t = nowUs();
+        EditorState state(i, payload, 4, payload, 8, i, -1, -1);
+        stack.push(std::move(state));
+        log.add(nowUs() - t);
+    }
+    for (int i = 0; i < n; i++) {
+        double t = nowUs();
+        EditorState state = stack.pop();
+        log.add(nowUs() - t);
+    }
+    log.report("-", "stack-push-pop", nowUs() - start);
+}
+
+static void benchFileIO(const char* backend, int sizeMb) {
+    char path[256], outPath[256];
+    sprintf(path, "/tmp/texteditor-bench-%d.txt", (int)getpid());
+    sprintf(outPath, "/tmp/texteditor-bench-%d.out", (int)getpid());
+
+    // Write the input in 1 MB blocks so generating it stays cheap
+    FILE* f = fopen(path, "wb");
+    if (!f) return;
+    char* block = makeText(1 << 20);
+    for (int i = 0; i < sizeMb; i++) fwrite(block, 1, 1 << 20, f);
+    fclose(f);
+    delete[] block;
+
+    double bytes = (double)sizeMb * (1 << 20);
+    char name[32];
+    Document doc(backend);
+
+    LatencyLog openLog;
+    double t = nowUs();
+    bool ok = doc.loadFromFile(path);
+    double elapsed = nowUs() - t;
+    openLog.add(elapsed);
+    sprintf(name, "open-%dMB", sizeMb);
+    if (ok) openLog.report(backend, name, elapsed, bytes);
+
+    LatencyLog saveLog;
+    t = nowUs();
+    ok = ok && doc.saveToFile(outPath);
+    elapsed = nowUs() - t;
+    saveLog.add(elapsed);
+    sprintf(name, "save-%dMB", sizeMb);
+    if (ok) saveLog.report(backend, name, elapsed, bytes);
+
+    unlink(path);
+    unlink(outPath);
+}
+
+// --- Trace Replay ---
+static void replayTrace(const char* backend, const char* tracePath) {
+    FILE* f = fopen(tracePath, "r");
+    if (!f) {
+        fprintf(stderr, "cannot open trace %s\n", tracePath);
+        return;
+    }
+    Document doc(backend);
+    LatencyLog log;
+    char line[4096];
+    char text[4096];
+    double start = nowUs();
+    while (fgets(line, sizeof(line), f)) {
+        int len = strlen(line);
+        if (len > 0 && line[len - 1] == '\n') line[--len] = '\0';
+        if (len == 0) continue;
+
+        // Decode the argument before timing the operation
+        int textLen = 0;
+        if (line[0] == 'i') {
+            for (int i = 2; i < len; i++) {
+                if (line[i] == '\\' && i + 1 < len) {
+                    i++;
+                    text[textLen++] = line[i] == 'n' ? '\n' : line[i];
+                } else {
+                    text[textLen++] = line[i];
+                }
+            }
+        }
+        char* paste = nullptr;
+        if (line[0] == 'p') {
+            textLen = atoi(line + 2);
+            paste = makeText(textLen);
+        }
+
+        double t = nowUs();
+        switch (line[0]) {
+            case 'i': doc.typeText(text, textLen, true); break;
+            case 'k': doc.backspace(); break;
+            case 'd': doc.deleteForward(); break;
+            case 'g': doc.setCursor(atoi(line + 2)); break;
+            case 'p': doc.typeText(paste, textLen, false); break;
+            case 'u': doc.undo(); break;
+            case 'r': doc.redo(); break;
+            case 'b': doc.breakUndoGroup(); break;
+            case '<': doc.moveLeft(false); break;
+            case '>': doc.moveRight(false); break;
+            case '^': doc.moveUp(false); break;
+            case 'v': doc.moveDown(false); break;
+            default: continue;
+        }
+        log.add(nowUs() - t);
+        delete[] paste;
+    }
+    fclose(f);
+    log.report(backend, "trace-replay", nowUs() - start);
+}
+
+// Runs one scenario in a child process so peak RSS is per scenario
+static const char* statsPath = nullptr;
+
+#define RUN_ISOLATED(call)                                          \
+    do {                                                            \
+        fflush(stdout);                                             \
+        pid_t pid = fork();                                         \
+        if (pid == 0) {                                             \
+            Metrics::enabled = statsPath != nullptr;                \
+            call;                                                   \
+            if (statsPath) Metrics::dump(statsPath, #call, true);   \
+            _exit(0);                                               \
+        }                                                           \
+        if (pid > 0) waitpid(pid, nullptr, 0);                      \
+    } while (0)
+
+int main(int argc, char** argv) {
+    const char* backendArg = "all";
+    const char* tracePath = nullptr;
+    int maxFileMb = 64;
+    bool quick = false;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--backend=", 10) == 0) backendArg = argv[i] + 10;
+        else if (strncmp(argv[i], "--max-file-mb=", 14) == 0) maxFileMb = atoi(argv[i] + 14);
+        else if (strncmp(argv[i], "--trace=", 8) == 0) tracePath = argv[i] + 8;
+        else if (strncmp(argv[i], "--stats=", 8) == 0) statsPath = argv[i] + 8;
+        else if (strcmp(argv[i], "--quick") == 0) quick = true;
+        else {
+            fprintf(stderr, "usage: %s [--backend=gap|piece|all] [--max-file-mb=N] [--trace=FILE] [--stats=FILE] [--quick]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const char* backends[2] = { "gap", "piece" };
+    int scale = quick ? 10 : 1;
+
+    RUN_ISOLATED(benchStack(200000 / scale));
+    for (int b = 0; b < 2; b++) {
+        const char* backend = backends[b];
+        if (strcmp(backendArg, "all") != 0 && strcmp(backendArg, backend) != 0) continue;
+
+        if (tracePath) {
+            RUN_ISOLATED(replayTrace(backend, tracePath));
+            continue;
+        }
+        RUN_ISOLATED(benchTyping(backend, 200000 / scale));
+        RUN_ISOLATED(benchKeyAllocs(backend, (8 << 20) / scale, 200000 / scale));
+        RUN_ISOLATED(benchRandomEdits(backend, (8 << 20) / scale, 20000 / scale));
+        RUN_ISOLATED(benchPaste(backend, 1 << 20, (10 << 20) / scale, 5));
+        RUN_ISOLATED(benchUndoStorm(backend, 50000 / scale));
+        RUN_ISOLATED(benchUndoBudget(backend, 400000 / scale));
+        RUN_ISOLATED(benchUndoPersist(backend, 32 / scale + 1, 80000 / scale));
+        RUN_ISOLATED(benchSearch(backend, (8 << 20) / scale, 10000 / scale));
+        RUN_ISOLATED(benchRegex(backend, (64 << 20) / scale, 100000));
+        RUN_ISOLATED(benchHighlight(backend, 1000000 / scale, 20000 / scale));
+        RUN_ISOLATED(benchColumns(backend, 200000 / scale, 20000 / scale));
+        RUN_ISOLATED(benchWrap(backend, 200000 / scale, 20000 / scale));
+        RUN_ISOLATED(benchCarets(backend, (8 << 20) / scale, 100, 20000 / scale));
+        RUN_ISOLATED(benchJournal(backend, 64 / scale + 1, 20000 / scale));
+        RUN_ISOLATED(benchReload(backend, 16 / scale + 1, 2000 / scale));
+        RUN_ISOLATED(benchChangeMarks(backend, 16 / scale + 1, 20000 / scale));
+        RUN_ISOLATED(benchMotions(backend, 1000000 / scale, 20000 / scale));
+        RUN_ISOLATED(benchPaged(backend, 64 / scale + 8));
+        RUN_ISOLATED(benchBuffers(backend, 32, 16 / scale + 1, 20000 / scale));
+        for (int mb = 1; mb <= maxFileMb; mb *= 4) {
+            RUN_ISOLATED(benchFileIO(backend, mb));
+        }
+    }
+    return 0;
+}
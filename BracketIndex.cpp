@@ -0,0 +1,352 @@
+#include "BracketIndex.h"
+#include "TextBuffer.h"
+#include <cstring>
+
+// +1 for an opening bracket of kind, -1 for a closing one, 0 otherwise
+static int weight(char c, int kind) {
+    static const char pairs[] = "()[]{}";
+    return c == pairs[2 * kind] ? 1 : c == pairs[2 * kind + 1] ? -1 : 0;
+}
+
+static int kindOf(char c) {
+    return c == '(' || c == ')' ? 0 : c == '[' || c == ']' ? 1 : 2;
+}
+
+BracketIndex::BracketIndex() {
+    blockCapacity = 16;
+    blocks = new Block*[blockCapacity];
+    blockCount = 0;
+    docLength = 0;
+    built = false;
+}
+
+BracketIndex::~BracketIndex() {
+    removeBlocks(0, blockCount);
+    delete[] blocks;
+}
+
+char BracketIndex::partner(char c) {
+    switch (c) {
+        case '(': return ')';
+        case ')': return '(';
+        case '[': return ']';
+        case ']': return '[';
+        case '{': return '}';
+        case '}': return '{';
+        default: return 0;
+    }
+}
+
+void BracketIndex::summarize(Block* block) {
+    for (int k = 0; k < KINDS; k++) {
+        int total = 0, low = 0;
+        for (int i = 0; i < block->count; i++) {
+            total += weight(block->kinds[i], k);
+            if (total < low) low = total;
+        }
+        block->net[k] = (short)total;
+        block->low[k] = (short)low;
+    }
+}
+
+void BracketIndex::insertBlock(int at, Block* block) {
+    if (blockCount == blockCapacity) {
+        Block** grown = new Block*[blockCapacity * 2];
+        memcpy(grown, blocks, blockCount * sizeof(Block*));
+        delete[] blocks;
+        blocks = grown;
+        blockCapacity *= 2;
+    }
+    memmove(blocks + at + 1, blocks + at, (blockCount - at) * sizeof(Block*));
+    blocks[at] = block;
+    blockCount++;
+}
+
+void BracketIndex::removeBlocks(int from, int to) {
+    if (from >= to) return;
+    for (int b = from; b < to; b++) delete blocks[b];
+    memmove(blocks + from, blocks + to, (blockCount - to) * sizeof(Block*));
+    blockCount -= to - from;
+}
+
+BracketIndex::Ref BracketIndex::firstFrom(int pos) const {
+    // First block whose last entry is at or after pos
+    int lo = 0, hi = blockCount;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const Block* block = blocks[mid];
+        if (block->base + block->offsets[block->count - 1] < pos) lo = mid + 1;
+        else hi = mid;
+    }
+    Ref r = { lo, 0 };
+    if (lo == blockCount) return r;
+    const Block* block = blocks[lo];
+    int first = 0, last = block->count;
+    while (first < last) {
+        int mid = first + (last - first) / 2;
+        if (block->base + block->offsets[mid] < pos) first = mid + 1;
+        else last = mid;
+    }
+    r.slot = first;
+    return r;
+}
+
+bool BracketIndex::next(Ref& r) const {
+    if (++r.slot < blocks[r.block]->count) return true;
+    r.block++;
+    r.slot = 0;
+    return r.block < blockCount;
+}
+
+// From past the last entry too, which steps to the last one
+bool BracketIndex::prev(Ref& r) const {
+    if (r.block < blockCount && r.slot > 0) {
+        r.slot--;
+        return true;
+    }
+    if (r.block == 0) return false;
+    r.block--;
+    r.slot = blocks[r.block]->count - 1;
+    return true;
+}
+
+// Inserts an entry before at, which then refers to the entry after it
+void BracketIndex::insertEntry(Ref& at, int offset, char c) {
+    if (blockCount == 0) {
+        Block* block = new Block;
+        block->base = 0;
+        block->count = 0;
+        insertBlock(0, block);
+    }
+    if (at.block == blockCount) {
+        at.block = blockCount - 1;
+        at.slot = blocks[at.block]->count;
+    }
+    Block* block = blocks[at.block];
+    if (block->count == BLOCK_MAX) {
+        // Split in half; the upper half keeps the same base
+        Block* upper = new Block;
+        int half = BLOCK_MAX / 2;
+        upper->base = block->base;
+        upper->count = BLOCK_MAX - half;
+        memcpy(upper->offsets, block->offsets + half, upper->count * sizeof(int));
+        memcpy(upper->kinds, block->kinds + half, upper->count);
+        block->count = half;
+        insertBlock(at.block + 1, upper);
+        summarize(block);
+        summarize(upper);
+        if (at.slot > half) {
+            at.block++;
+            at.slot -= half;
+            block = upper;
+        }
+    }
+    int tail = block->count - at.slot;
+    memmove(block->offsets + at.slot + 1, block->offsets + at.slot, tail * sizeof(int));
+    memmove(block->kinds + at.slot + 1, block->kinds + at.slot, tail);
+    block->offsets[at.slot] = offset - block->base;
+    block->kinds[at.slot] = c;
+    block->count++;
+    at.slot++;
+    summarize(block);
+}
+
+// Drops the entries in [from, to)
+void BracketIndex::removeRange(int from, int to) {
+    Ref first = firstFrom(from);
+    Ref last = firstFrom(to);
+    if (!valid(first) || (first.block == last.block && first.slot == last.slot)) return;
+    if (first.block == last.block) {
+        Block* block = blocks[first.block];
+        int tail = block->count - last.slot;
+        memmove(block->offsets + first.slot, block->offsets + last.slot, tail * sizeof(int));
+        memmove(block->kinds + first.slot, block->kinds + last.slot, tail);
+        block->count -= last.slot - first.slot;
+        summarize(block);
+        if (block->count == 0) removeBlocks(first.block, first.block + 1);
+        return;
+    }
+    // The first block keeps its head and the last its tail; whole blocks
+    // between them go
+    Block* head = blocks[first.block];
+    head->count = first.slot;
+    summarize(head);
+    if (valid(last)) {
+        Block* tailBlock = blocks[last.block];
+        int tail = tailBlock->count - last.slot;
+        memmove(tailBlock->offsets, tailBlock->offsets + last.slot, tail * sizeof(int));
+        memmove(tailBlock->kinds, tailBlock->kinds + last.slot, tail);
+        tailBlock->count = tail;
+        summarize(tailBlock);
+    }
+    removeBlocks(first.block + 1, last.block);
+    if (head->count == 0) removeBlocks(first.block, first.block + 1);
+}
+
+// Moves the entries at or after pos by delta: those in pos's block one by
+// one, later blocks by their base
+void BracketIndex::shiftFrom(int pos, int delta) {
+    if (delta == 0) return;
+    Ref r = firstFrom(pos);
+    if (!valid(r)) return;
+    int b = r.block;
+    if (r.slot > 0) {
+        Block* block = blocks[b];
+        for (int i = r.slot; i < block->count; i++) block->offsets[i] += delta;
+        b++;
+    }
+    for (; b < blockCount; b++) blocks[b]->base += delta;
+}
+
+// Adds the brackets among buffer bytes [pos, pos + len), none of which are
+// in the index yet
+void BracketIndex::scan(const TextBuffer* buffer, int pos, int len) {
+    Ref at = firstFrom(pos);
+    int end = pos + len;
+    while (pos < end) {
+        const char* data;
+        int n = buffer->chunkAt(pos, &data);
+        if (n <= 0) break;
+        if (n > end - pos) n = end - pos;
+        for (int i = 0; i < n; i++) {
+            char c = data[i];
+            if (c != '(' && c != ')' && c != '[' && c != ']' && c != '{' && c != '}') continue;
+            insertEntry(at, pos + i, c);
+        }
+        pos += n;
+    }
+}
+
+// Fills blocks to BLOCK_FILL straight from the text, leaving room for
+// brackets typed later before a block has to split
+void BracketIndex::build(const TextBuffer* buffer) {
+    removeBlocks(0, blockCount);
+    docLength = buffer->getLength();
+    Block* block = nullptr;
+    int pos = 0;
+    while (pos < docLength) {
+        const char* data;
+        int n = buffer->chunkAt(pos, &data);
+        if (n <= 0) break;
+        for (int i = 0; i < n; i++) {
+            char c = data[i];
+            if (c != '(' && c != ')' && c != '[' && c != ']' && c != '{' && c != '}') continue;
+            if (!block || block->count == BLOCK_FILL) {
+                if (block) summarize(block);
+                block = new Block;
+                block->base = 0;
+                block->count = 0;
+                insertBlock(blockCount, block);
+            }
+            block->offsets[block->count] = pos + i;
+            block->kinds[block->count] = c;
+            block->count++;
+        }
+        pos += n;
+    }
+    if (block) summarize(block);
+    built = true;
+}
+
+void BracketIndex::onEdit(const TextBuffer* buffer, int pos, int deletedLen, int insertedLen) {
+    if (!built) return;
+    removeRange(pos, pos + deletedLen);
+    shiftFrom(pos, insertedLen - deletedLen);
+    docLength += insertedLen - deletedLen;
+    scan(buffer, pos, insertedLen);
+}
+
+// Walks from entry from, forward or back, keeping a running total of
+// brackets of kind (closing ones count up going back) and finds the entry
+// where it first drops below zero. Blocks it can't drop below zero in are
+// stepped over whole.
+bool BracketIndex::walk(Ref from, int kind, bool forward, Ref& found) const {
+    int b = from.block, i = from.slot;
+    int total = 0;
+    if (forward) {
+        while (b < blockCount) {
+            const Block* block = blocks[b];
+            if (i == 0 && total + block->low[kind] >= 0) {
+                total += block->net[kind];
+                b++;
+                continue;
+            }
+            for (; i < block->count; i++) {
+                total += weight(block->kinds[i], kind);
+                if (total < 0) {
+                    found.block = b;
+                    found.slot = i;
+                    return true;
+                }
+            }
+            b++;
+            i = 0;
+        }
+    } else {
+        while (b >= 0) {
+            const Block* block = blocks[b];
+            if (i == block->count - 1 && total + block->low[kind] - block->net[kind] >= 0) {
+                total -= block->net[kind];
+                if (--b >= 0) i = blocks[b]->count - 1;
+                continue;
+            }
+            for (; i >= 0; i--) {
+                total -= weight(block->kinds[i], kind);
+                if (total < 0) {
+                    found.block = b;
+                    found.slot = i;
+                    return true;
+                }
+            }
+            if (--b >= 0) i = blocks[b]->count - 1;
+        }
+    }
+    return false;
+}
+
+// The partner of entry r; false when it has none
+bool BracketIndex::partnerOf(Ref r, Ref& found) const {
+    char c = kindAt(r);
+    int kind = kindOf(c);
+    if (weight(c, kind) > 0) return next(r) && walk(r, kind, true, found);
+    return prev(r) && walk(r, kind, false, found);
+}
+
+int BracketIndex::match(const TextBuffer* buffer, int pos) {
+    if (!built || docLength != buffer->getLength()) build(buffer);
+    Ref r = firstFrom(pos);
+    if (!valid(r) || offsetAt(r) != pos) return -1;
+    Ref other;
+    return partnerOf(r, other) ? offsetAt(other) : -1;
+}
+
+int BracketIndex::find(const TextBuffer* buffer, int from, int to) {
+    if (!built || docLength != buffer->getLength()) build(buffer);
+    Ref r = firstFrom(from);
+    if (!valid(r) || offsetAt(r) >= to) return -1;
+    return offsetAt(r);
+}
+
+bool BracketIndex::enclosing(const TextBuffer* buffer, int pos, char open, int& openPos, int& closePos) {
+    if (!built || docLength != buffer->getLength()) build(buffer);
+    char close = partner(open);
+    if (open != '(' && open != '[' && open != '{') return false;
+
+    // A closing bracket at pos closes the pair; otherwise look back for an
+    // opening one that isn't closed before pos
+    Ref r = firstFrom(pos);
+    Ref openRef;
+    bool at = valid(r) && offsetAt(r) == pos;
+    if (at && kindAt(r) == close) {
+        if (!partnerOf(r, openRef)) return false;
+    } else if (at && kindAt(r) == open) {
+        openRef = r;
+    } else {
+        if (!prev(r) || !walk(r, kindOf(open), false, openRef)) return false;
+    }
+    Ref closeRef;
+    if (!partnerOf(openRef, closeRef)) return false;
+    openPos = offsetAt(openRef);
+    closePos = offsetAt(closeRef);
+    return true;
+}
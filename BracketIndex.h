@@ -0,0 +1,89 @@
+#ifndef BRACKETINDEX_H
+#define BRACKETINDEX_H
+
+class TextBuffer;
+
+// Sorted offsets of every ( ) [ ] { } in the text, with which bracket each
+// is, kept in blocks of up to BLOCK_MAX entries. A block stores its
+// entries relative to its own base offset, so an edit rewrites entries in
+// its own block only and shifts every later block by adding to its base.
+// The index is built by one pass over the text the first time it is
+// asked, and forgotten when the text is replaced wholesale. A bracket's
+// partner is found by walking the entries between them counting nesting
+// of its own kind; each block keeps, per kind, its net nesting and the
+// lowest it dips, so the walk steps over every block the pair's nesting
+// can't close in and only reads entries in the first and last ones.
+class BracketIndex {
+private:
+    static const int BLOCK_MAX = 128;
+    static const int BLOCK_FILL = 96;   // entries per block when built
+    enum { PARENS, SQUARE, BRACES, KINDS };
+
+    // Going back, closing brackets count up and the lowest running total
+    // from the end is low - net
+    struct Block {
+        int base;
+        int count;
+        short net[KINDS];   // opening minus closing brackets
+        short low[KINDS];   // lowest running total from the start, or 0
+        int offsets[BLOCK_MAX];   // from base
+        char kinds[BLOCK_MAX];    // the bracket character at each offset
+    };
+
+    // An entry: slot of block; block == blockCount past the last one
+    struct Ref {
+        int block;
+        int slot;
+    };
+
+    Block** blocks;     // in offset order, none empty
+    int blockCount;
+    int blockCapacity;
+    int docLength;
+    bool built;
+
+    BracketIndex(const BracketIndex&);
+    BracketIndex& operator=(const BracketIndex&);
+
+    int offsetAt(Ref r) const { return blocks[r.block]->base + blocks[r.block]->offsets[r.slot]; }
+    char kindAt(Ref r) const { return blocks[r.block]->kinds[r.slot]; }
+    bool valid(Ref r) const { return r.block < blockCount; }
+    Ref firstFrom(int pos) const;   // first entry >= pos
+    bool next(Ref& r) const;
+    bool prev(Ref& r) const;
+    static void summarize(Block* block);
+    void insertBlock(int at, Block* block);
+    void removeBlocks(int from, int to);
+    void insertEntry(Ref& at, int offset, char c);
+    void removeRange(int from, int to);
+    void shiftFrom(int pos, int delta);
+    bool walk(Ref from, int kind, bool forward, Ref& found) const;
+    bool partnerOf(Ref r, Ref& found) const;
+    void scan(const TextBuffer* buffer, int pos, int len);
+    void build(const TextBuffer* buffer);
+
+public:
+    BracketIndex();
+    ~BracketIndex();
+
+    // The text was replaced wholesale; rebuilt on next use
+    void reset() { built = false; }
+    // deletedLen bytes at pos were replaced by insertedLen bytes, already
+    // in buffer
+    void onEdit(const TextBuffer* buffer, int pos, int deletedLen, int insertedLen);
+
+    // The other bracket of the pair the one at pos belongs to; -1 when
+    // pos holds no bracket or it has no partner
+    int match(const TextBuffer* buffer, int pos);
+    // First bracket in [from, to), -1 if none
+    int find(const TextBuffer* buffer, int from, int to);
+    // Innermost pair of open and its closing bracket around pos, a bracket
+    // at pos included; false when there is none
+    bool enclosing(const TextBuffer* buffer, int pos, char open, int& openPos, int& closePos);
+
+    // The closing bracket for an opening one and the other way round; 0
+    // for anything else
+    static char partner(char c);
+};
+
+#endif
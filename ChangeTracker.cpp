@@ -0,0 +1,404 @@
+#include "ChangeTracker.h"
+#include "TextBuffer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+// The saved file is read in blocks of this size
+static const int READ_BLOCK = 1 << 20;
+
+ChangeTracker::ChangeTracker()
+    : notify(nullptr), notifyData(nullptr), enabled(false), saved(nullptr), savedCount(0), savedCapacity(0),
+      savedReady(false), savedPath(nullptr), savedSize(-1), hunks(nullptr), hunkCount(0), hunkCapacity(0), lineTotal(1),
+      dirtyFrom(-1), dirtyTo(-1), edits(0), job(JOB_NONE), current(nullptr), currentCapacity(0), jobFrom(0),
+      jobTo(0), jobSavedFrom(0), jobSavedTo(0), jobHunkFrom(0), jobHunkTo(0), jobEdits(0), cancelled(false),
+      done(false) {
+    // A new document is an empty untitled text
+    setSaved(nullptr, 0, 1);
+}
+
+ChangeTracker::~ChangeTracker() {
+    cancel();
+    delete[] saved;
+    delete[] savedPath;
+    delete[] hunks;
+    delete[] current;
+}
+
+void ChangeTracker::setNotify(NotifyFn fn, void* data) {
+    notify = fn;
+    notifyData = data;
+}
+
+void ChangeTracker::cancel() {
+    if (worker.joinable()) {
+        cancelled = true;
+        worker.join();
+        cancelled = false;
+    }
+    job = JOB_NONE;
+}
+
+void ChangeTracker::wait() {
+    if (worker.joinable()) worker.join();
+}
+
+void ChangeTracker::reserveSaved(int count) {
+    if (count <= savedCapacity) return;
+    int newCapacity = savedCapacity ? savedCapacity * 2 : 1024;
+    if (newCapacity < count) newCapacity = count;
+    unsigned long long* grown = new unsigned long long[newCapacity];
+    if (savedCount > 0) memcpy(grown, saved, savedCount * sizeof(unsigned long long));
+    delete[] saved;
+    saved = grown;
+    savedCapacity = newCapacity;
+}
+
+void ChangeTracker::setSaved(const char* path, long long size, int lines) {
+    cancel();
+    enabled = true;
+    hunkCount = 0;
+    dirtyFrom = dirtyTo = -1;
+    lineTotal = lines;
+    edits++;
+    savedCount = 0;
+    savedReady = false;
+    if (!path) {
+        reserveSaved(1);
+        saved[0] = LineDiff::HASH_SEED;
+        savedCount = 1;
+        savedReady = true;
+        return;
+    }
+    delete[] savedPath;
+    savedPath = new char[strlen(path) + 1];
+    strcpy(savedPath, path);
+    savedSize = size;
+    job = JOB_READ;
+    done = false;
+    worker = std::thread(&ChangeTracker::runRead, this);
+}
+
+void ChangeTracker::setSavedLines(const unsigned long long* hashes, int count) {
+    cancel();
+    enabled = true;
+    hunkCount = 0;
+    dirtyFrom = dirtyTo = -1;
+    lineTotal = count;
+    edits++;
+    savedCount = 0;
+    reserveSaved(count);
+    memcpy(saved, hashes, count * sizeof(unsigned long long));
+    savedCount = count;
+    savedReady = true;
+}
+
+// The last saved line has no newline, so its hash just carries on through
+// the appended text
+void ChangeTracker::appendSaved(const char* text, int len) {
+    if (!enabled) return;
+    wait();
+    int from, to;
+    if (job == JOB_READ) finishJob(from, to);
+    job = JOB_NONE;   // a diff result would be stale anyway
+    if (!savedReady) return;
+
+    int line = savedCount - 1;
+    unsigned long long h = saved[line];
+    const char* end = text + len;
+    while (text < end) {
+        const char* newline = (const char*)memchr(text, '\n', end - text);
+        const char* stop = newline ? newline + 1 : end;
+        h = LineDiff::hash(text, stop - text, h);
+        if (newline) {
+            saved[line++] = h;
+            savedCount = line;
+            reserveSaved(line + 1);
+            h = LineDiff::HASH_SEED;
+        }
+        text = stop;
+    }
+    saved[line] = h;
+    savedCount = line + 1;
+}
+
+void ChangeTracker::disable() {
+    cancel();
+    enabled = false;
+    hunkCount = 0;
+    dirtyFrom = dirtyTo = -1;
+    savedCount = 0;
+    savedReady = false;
+}
+
+void ChangeTracker::onEdit(int firstLine, int lastLine, int lineDelta) {
+    if (!enabled) return;
+    lineTotal += lineDelta;
+    edits++;
+    int lastOld = lastLine - lineDelta;   // last edited line before the edit
+
+    // Hunks below move with the text; those the edit reaches grow to cover
+    // it until they are diffed again
+    for (int i = 0; i < hunkCount; i++) {
+        DiffHunk& hunk = hunks[i];
+        int start = hunk.newStart;
+        int end = start + hunk.newCount;
+        if (hunk.newCount == 0) {
+            if (start > lastOld) hunk.newStart += lineDelta;
+            else if (start > firstLine) hunk.newStart = firstLine;
+        } else if (start > lastOld) {
+            hunk.newStart += lineDelta;
+        } else if (end > firstLine) {
+            hunk.newStart = std::min(start, firstLine);
+            end = end > lastOld ? end + lineDelta : lastLine + 1;
+            hunk.newCount = end - hunk.newStart;
+        }
+    }
+    mergeHunks();
+
+    if (dirtyFrom >= 0) {
+        int from = dirtyFrom > lastOld ? dirtyFrom + lineDelta : dirtyFrom;
+        int to = dirtyTo > lastOld ? dirtyTo + lineDelta : std::min(dirtyTo, lastLine);
+        dirtyFrom = std::min(from, firstLine);
+        dirtyTo = std::max(to, lastLine);
+    } else {
+        dirtyFrom = firstLine;
+        dirtyTo = lastLine;
+    }
+    if (dirtyTo >= lineTotal) dirtyTo = lineTotal - 1;
+}
+
+// Joins hunks that an edit made overlap or touch
+void ChangeTracker::mergeHunks() {
+    int kept = 0;
+    for (int i = 0; i < hunkCount; i++) {
+        if (kept > 0) {
+            DiffHunk& last = hunks[kept - 1];
+            const DiffHunk& next = hunks[i];
+            int lastEnd = last.newStart + last.newCount;
+            if (next.newStart <= lastEnd) {
+                int newEnd = std::max(lastEnd, next.newStart + next.newCount);
+                int oldEnd = std::max(last.oldStart + last.oldCount, next.oldStart + next.oldCount);
+                last.newCount = newEnd - last.newStart;
+                last.oldCount = oldEnd - last.oldStart;
+                continue;
+            }
+        }
+        hunks[kept++] = hunks[i];
+    }
+    hunkCount = kept;
+}
+
+// Replaces no hunks at position at with count new ones
+void ChangeTracker::insertHunks(int at, const DiffHunk* added, int count) {
+    if (hunkCount + count > hunkCapacity) {
+        int newCapacity = hunkCapacity ? hunkCapacity * 2 : 64;
+        if (newCapacity < hunkCount + count) newCapacity = hunkCount + count;
+        DiffHunk* grown = new DiffHunk[newCapacity];
+        if (hunkCount > 0) memcpy(grown, hunks, hunkCount * sizeof(DiffHunk));
+        delete[] hunks;
+        hunks = grown;
+        hunkCapacity = newCapacity;
+    }
+    if (count == 0) return;
+    memmove(hunks + at + count, hunks + at, (hunkCount - at) * sizeof(DiffHunk));
+    memcpy(hunks + at, added, count * sizeof(DiffHunk));
+    hunkCount += count;
+}
+
+// Lines outside the dirty range and the hunks are unchanged, so the ones
+// just around the range line up with known saved lines: counted from the
+// top above it and from the bottom below it
+void ChangeTracker::update(const TextBuffer* buffer) {
+    if (!enabled || job != JOB_NONE || !savedReady || dirtyFrom < 0) return;
+
+    int from = dirtyFrom;
+    int to = std::min(dirtyTo + 1, lineTotal);
+    int lo = 0, hi = hunkCount;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (hunks[mid].newStart + hunks[mid].newCount < from) lo = mid + 1;
+        else hi = mid;
+    }
+    hi = lo;
+    while (hi < hunkCount && hunks[hi].newStart <= to) {
+        from = std::min(from, hunks[hi].newStart);
+        to = std::max(to, hunks[hi].newStart + hunks[hi].newCount);
+        hi++;
+    }
+    int above = 0, below = 0;
+    for (int i = 0; i < lo; i++) above += hunks[i].oldCount - hunks[i].newCount;
+    for (int i = hi; i < hunkCount; i++) below += hunks[i].oldCount - hunks[i].newCount;
+    int savedFrom = from + above;
+    int savedTo = savedCount - (lineTotal - to) - below;
+    if (to > lineTotal || savedFrom < 0 || savedFrom > savedTo || savedTo > savedCount) {
+        // Out of step with the saved text; diff all of it
+        from = savedFrom = 0;
+        to = lineTotal;
+        savedTo = savedCount;
+        lo = 0;
+        hi = hunkCount;
+    }
+
+    if (to - from > currentCapacity) {
+        delete[] current;
+        currentCapacity = (to - from) + (to - from) / 2 + 64;
+        current = new unsigned long long[currentCapacity];
+    }
+    hashLines(buffer, from, to, current);
+    jobFrom = from;
+    jobTo = to;
+    jobSavedFrom = savedFrom;
+    jobSavedTo = savedTo;
+    jobHunkFrom = lo;
+    jobHunkTo = hi;
+    jobEdits = edits;
+    job = JOB_DIFF;
+    done = false;
+    worker = std::thread(&ChangeTracker::runDiff, this);
+}
+
+bool ChangeTracker::collect(const TextBuffer* buffer, int& from, int& to) {
+    from = to = -1;
+    if (job == JOB_NONE || !done) return false;
+    bool changed = finishJob(from, to);
+    update(buffer);
+    return changed;
+}
+
+bool ChangeTracker::finishJob(int& from, int& to) {
+    wait();
+    Job finished = job;
+    job = JOB_NONE;
+    if (finished == JOB_READ) {
+        savedReady = savedCount > 0;
+        if (savedReady) return false;
+        // Unreadable; there is nothing to compare with
+        enabled = false;
+        hunkCount = 0;
+        dirtyFrom = dirtyTo = -1;
+        from = 0;
+        to = 0x7fffffff;
+        return true;
+    }
+    if (finished != JOB_DIFF || jobEdits != edits) return false;
+
+    if (hunkCount > jobHunkTo) memmove(hunks + jobHunkFrom, hunks + jobHunkTo, (hunkCount - jobHunkTo) * sizeof(DiffHunk));
+    hunkCount -= jobHunkTo - jobHunkFrom;
+    int count = diff.getHunkCount();
+    DiffHunk* added = new DiffHunk[count > 0 ? count : 1];
+    for (int i = 0; i < count; i++) {
+        added[i] = diff.getHunk(i);
+        added[i].oldStart += jobSavedFrom;
+        added[i].newStart += jobFrom;
+    }
+    insertHunks(jobHunkFrom, added, count);
+    delete[] added;
+    dirtyFrom = dirtyTo = -1;
+    from = jobFrom;
+    to = jobTo;
+    return true;
+}
+
+void ChangeTracker::runRead() {
+    savedCount = 0;
+    int fd = open(savedPath, O_RDONLY);
+    if (fd >= 0) {
+        char* block = new char[READ_BLOCK];
+        unsigned long long h = LineDiff::HASH_SEED;
+        int count = 0;
+        bool ok = false;
+        long long left = savedSize < 0 ? 0x7fffffffffffffffLL : savedSize;
+        while (!cancelled) {
+            ssize_t n = read(fd, block, (size_t)std::min((long long)READ_BLOCK, left));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                ok = n == 0;
+                break;
+            }
+            left -= n;
+            const char* data = block;
+            const char* end = block + n;
+            while (data < end) {
+                const char* newline = (const char*)memchr(data, '\n', end - data);
+                const char* stop = newline ? newline + 1 : end;
+                h = LineDiff::hash(data, stop - data, h);
+                if (newline) {
+                    reserveSaved(count + 1);
+                    saved[count++] = h;
+                    savedCount = count;
+                    h = LineDiff::HASH_SEED;
+                }
+                data = stop;
+            }
+        }
+        if (ok) {
+            reserveSaved(count + 1);
+            saved[count++] = h;
+            savedCount = count;
+        } else {
+            savedCount = 0;
+        }
+        delete[] block;
+        close(fd);
+    }
+    done = true;
+    if (notify && !cancelled) notify(notifyData);
+}
+
+void ChangeTracker::runDiff() {
+    diff.run(saved + jobSavedFrom, jobSavedTo - jobSavedFrom, current, jobTo - jobFrom);
+    done = true;
+    if (notify) notify(notifyData);
+}
+
+int ChangeTracker::markOf(int line) const {
+    if (!enabled) return 0;
+    int marks = dirtyFrom >= 0 && line >= dirtyFrom && line <= dirtyTo ? MARK_MODIFIED : 0;
+    int lo = 0, hi = hunkCount;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (hunks[mid].newStart + hunks[mid].newCount < line) lo = mid + 1;
+        else hi = mid;
+    }
+    for (int i = lo; i < hunkCount && hunks[i].newStart <= line; i++) {
+        const DiffHunk& hunk = hunks[i];
+        if (hunk.newCount == 0) {
+            if (hunk.newStart == line) marks |= MARK_REMOVED_ABOVE;
+        } else if (line < hunk.newStart + hunk.newCount) {
+            marks = (marks & ~MARK_MODIFIED) | (hunk.oldCount == 0 ? MARK_ADDED : MARK_MODIFIED);
+        }
+    }
+    if (line == lineTotal - 1 && hunkCount > 0) {
+        const DiffHunk& last = hunks[hunkCount - 1];
+        if (last.newCount == 0 && last.newStart == lineTotal) marks |= MARK_REMOVED_BELOW;
+    }
+    return marks;
+}
+
+void ChangeTracker::hashLines(const TextBuffer* buffer, int from, int to, unsigned long long* out) {
+    if (from >= to) return;
+    int pos = buffer->offsetOfLine(from);
+    int end = to < buffer->lineCount() ? buffer->offsetOfLine(to) : buffer->getLength();
+    int line = 0;
+    unsigned long long h = LineDiff::HASH_SEED;
+    while (pos < end) {
+        const char* data;
+        int n = std::min(buffer->chunkAt(pos, &data), end - pos);
+        const char* stop = data + n;
+        while (data < stop) {
+            const char* newline = (const char*)memchr(data, '\n', stop - data);
+            const char* next = newline ? newline + 1 : stop;
+            h = LineDiff::hash(data, next - data, h);
+            if (newline) {
+                out[line++] = h;
+                h = LineDiff::HASH_SEED;
+            }
+            data = next;
+        }
+        pos += n;
+    }
+    if (line < to - from) out[line] = h;
+}
@@ -0,0 +1,121 @@
+#ifndef CHANGETRACKER_H
+#define CHANGETRACKER_H
+
+#include "LineDiff.h"
+#include <atomic>
+#include <thread>
+
+class TextBuffer;
+
+// Which lines differ from the text as last saved, for the gutter. The
+// saved text is kept as one hash per line, read from the file on a worker
+// thread. The differences are a list of hunks in current line numbers;
+// an edit moves the hunks below it along and marks the lines it touched
+// dirty, which show as modified until they are diffed. update() diffs
+// only the dirty lines and the hunks next to them against the saved lines
+// they sit between, on the worker, and collect() splices the result in
+// once the worker calls the notify hook. A result for text that was
+// edited in the meantime is dropped and the lines are diffed again.
+class ChangeTracker {
+public:
+    typedef void (*NotifyFn)(void* data);
+
+    // Gutter marks of a line; lines removed show on the line below them,
+    // or on the last line when they were at the end
+    enum Mark { MARK_ADDED = 1, MARK_MODIFIED = 2, MARK_REMOVED_ABOVE = 4, MARK_REMOVED_BELOW = 8 };
+
+private:
+    NotifyFn notify;
+    void* notifyData;
+    bool enabled;
+
+    // Hash of each saved line, newline included; savedReady is false
+    // while the worker is still reading the file
+    unsigned long long* saved;
+    int savedCount;
+    int savedCapacity;
+    bool savedReady;
+    char* savedPath;
+    long long savedSize;
+
+    DiffHunk* hunks;
+    int hunkCount;
+    int hunkCapacity;
+    int lineTotal;
+
+    // Lines edited since they were last diffed, -1 when none
+    int dirtyFrom;
+    int dirtyTo;
+    int edits;   // bumped by every edit, to tell a stale result
+
+    // The job on the worker: reading the saved file, or diffing current
+    // lines [jobFrom, jobTo) against saved lines [jobSavedFrom, jobSavedTo),
+    // which replace hunks [jobHunkFrom, jobHunkTo)
+    enum Job { JOB_NONE, JOB_READ, JOB_DIFF };
+    Job job;
+    unsigned long long* current;
+    int currentCapacity;
+    int jobFrom;
+    int jobTo;
+    int jobSavedFrom;
+    int jobSavedTo;
+    int jobHunkFrom;
+    int jobHunkTo;
+    int jobEdits;
+    LineDiff diff;
+
+    std::thread worker;
+    std::atomic<bool> cancelled;
+    std::atomic<bool> done;
+
+    ChangeTracker(const ChangeTracker&);
+    ChangeTracker& operator=(const ChangeTracker&);
+
+    void runRead();
+    void runDiff();
+    void cancel();
+    bool finishJob(int& from, int& to);
+    void reserveSaved(int count);
+    void insertHunks(int at, const DiffHunk* added, int count);
+    void mergeHunks();
+
+public:
+    ChangeTracker();
+    ~ChangeTracker();
+
+    // Called on the worker thread when a job ends
+    void setNotify(NotifyFn fn, void* data);
+
+    // The text now matches the first size bytes of the file at path (all
+    // of it when size is -1), which hold lines lines; their hashes are
+    // read in the background. nullptr stands for an untitled text saved
+    // as empty.
+    void setSaved(const char* path, long long size, int lines);
+    // The text now matches the given line hashes
+    void setSavedLines(const unsigned long long* hashes, int count);
+    // Text added to the end of the saved file
+    void appendSaved(const char* text, int len);
+    // No marks at all, e.g. for a paged file
+    void disable();
+
+    // Same meaning as WrapLayout::onEdit
+    void onEdit(int firstLine, int lastLine, int lineDelta);
+
+    // Starts diffing the dirty lines unless a job is running
+    void update(const TextBuffer* buffer);
+    // Takes the result of a finished job and starts the next one; true if
+    // marks of lines [from, to] may have changed
+    bool collect(const TextBuffer* buffer, int& from, int& to);
+    // Blocks until the running job ends
+    void wait();
+    bool isIdle() const { return job == JOB_NONE && dirtyFrom < 0; }
+
+    int markOf(int line) const;
+    int getHunkCount() const { return hunkCount; }
+    const DiffHunk& getHunk(int i) const { return hunks[i]; }
+
+    // Hashes lines [from, to) of buffer into out, each with its newline
+    static void hashLines(const TextBuffer* buffer, int from, int to, unsigned long long* out);
+};
+
+#endif
@@ -0,0 +1,283 @@
+// Headless checks of the editing model, without FLTK:
+//
+//   ./texteditor-check [--backend=gap|piece|all]
+//
+// Each check prints "ok" or what went wrong; the exit status is the number
+// of checks that failed, so `make check` stops the build on any of them.
+
+#include "Document.h"
+#include "MappedFile.h"
+#include "Metrics.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+static int failures = 0;
+
+static void report(const char* backend, const char* name, const char* problem) {
+    if (problem) failures++;
+    printf("%-6s %-24s %s\n", backend, name, problem ? problem : "ok");
+    fflush(stdout);
+}
+
+// Whether the document's text is exactly len bytes of expected
+static bool textIs(Document& doc, const char* expected, int len) {
+    TextBuffer* buffer = doc.getBuffer();
+    if (buffer->getLength() != len) return false;
+    char* text = new char[len + 1];
+    buffer->read(0, len, text);
+    bool same = memcmp(text, expected, len) == 0;
+    delete[] text;
+    return same;
+}
+
+static bool writeFile(const char* path, const char* text, int len, bool inPlace) {
+    // In place keeps the inode, as `echo x > file` does
+    int fd = inPlace ? open(path, O_WRONLY | O_TRUNC) : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = write(fd, text, len) == len;
+    return close(fd) == 0 && ok;
+}
+
+// Numbered lines, every step-th one replaced when rewritten is set
+static char* makeLines(int lines, int step, bool rewritten, int& len) {
+    char* text = new char[lines * 32 + 1];
+    len = 0;
+    for (int i = 0; i < lines; i++) {
+        if (rewritten && i % step == 0) len += sprintf(text + len, "rewritten %d\n", i);
+        else len += sprintf(text + len, "line %d of the original\n", i);
+    }
+    return text;
+}
+
+// --- Checks ---
+// A file rewritten in place (same inode, shorter) under an open buffer
+// with an unsaved edit: the reload must give the new text, and undoing it
+// the edited old text. With copyLimit 0 the piece table reads straight
+// from the mapping, whose old text is gone, so it must load afresh.
+static void checkRewriteInPlace(const char* backend, long long copyLimit) {
+    const char* name = copyLimit ? "reload-in-place" : "reload-in-place-mapped";
+    char path[256];
+    sprintf(path, "/tmp/texteditor-check-%d.txt", (int)getpid());
+    int oldLen, newLen;
+    char* oldText = makeLines(2000, 7, false, oldLen);
+    char* newText = makeLines(1500, 7, true, newLen);
+    long long savedLimit = MappedFile::copyLimit;
+    MappedFile::copyLimit = copyLimit;
+
+    const char* problem = nullptr;
+    Document doc(backend);
+    if (!writeFile(path, oldText, oldLen, false) || !doc.loadFromFile(path)) {
+        problem = "FAIL: cannot load";
+    } else {
+        doc.setCursor(0);
+        doc.typeText("edit ", 5, false);
+        // A later mtime, even on filesystems with coarse timestamps
+        usleep(20000);
+        Document::Reload result = writeFile(path, newText, newLen, true) ? doc.reloadFromDisk() : Document::RELOAD_FAILED;
+        bool mapped = !copyLimit && strcmp(backend, "piece") == 0;
+        if (mapped && result != Document::RELOAD_REPLACED) {
+            problem = "FAIL: mapped text not reloaded afresh";
+        } else if (!mapped && result != Document::RELOAD_REWRITTEN) {
+            problem = "FAIL: rewrite not diffed";
+        } else if (!textIs(doc, newText, newLen)) {
+            problem = "FAIL: wrong text after reload";
+        } else if (!mapped) {
+            char* edited = new char[oldLen + 5];
+            memcpy(edited, "edit ", 5);
+            memcpy(edited + 5, oldText, oldLen);
+            if (!doc.undo() || !textIs(doc, edited, oldLen + 5)) problem = "FAIL: undo of the reload is wrong";
+            else if (!doc.redo() || !textIs(doc, newText, newLen)) problem = "FAIL: redo of the reload is wrong";
+            delete[] edited;
+        }
+    }
+    report(backend, name, problem);
+    MappedFile::copyLimit = savedLimit;
+    unlink(path);
+    delete[] oldText;
+    delete[] newText;
+}
+
+// A file truncated under its buffer, as logrotate's copytruncate does,
+// then written to again. With copyLimit 0 the piece table reads straight
+// from the mapping; reading past the truncation must not kill the
+// process, and the reload must load the new text afresh.
+static void checkTruncateMapped(const char* backend) {
+    const char* name = "truncate-mapped";
+    char path[256];
+    sprintf(path, "/tmp/texteditor-check-%d.txt", (int)getpid());
+    int oldLen, newLen;
+    char* oldText = makeLines(2000, 7, false, oldLen);
+    char* newText = makeLines(100, 7, true, newLen);
+    long long savedLimit = MappedFile::copyLimit;
+    MappedFile::copyLimit = 0;
+
+    const char* problem = nullptr;
+    Document doc(backend);
+    if (!writeFile(path, oldText, oldLen, false) || !doc.loadFromFile(path)) {
+        problem = "FAIL: cannot load";
+    } else if (truncate(path, 0) != 0) {
+        problem = "FAIL: cannot truncate";
+    } else {
+        // Reads every page of the mapping, all of them now past the end
+        char* seen = new char[oldLen];
+        doc.getBuffer()->read(0, oldLen, seen);
+        delete[] seen;
+        usleep(20000);
+        Document::Reload result = writeFile(path, newText, newLen, true) ? doc.reloadFromDisk() : Document::RELOAD_FAILED;
+        bool mapped = strcmp(backend, "piece") == 0;
+        if (mapped && result != Document::RELOAD_REPLACED) {
+            problem = "FAIL: truncated mapping not reloaded afresh";
+        } else if (!mapped && result != Document::RELOAD_REWRITTEN) {
+            problem = "FAIL: rewrite not diffed";
+        } else if (!textIs(doc, newText, newLen)) {
+            problem = "FAIL: wrong text after reload";
+        }
+    }
+    report(backend, name, problem);
+    MappedFile::copyLimit = savedLimit;
+    unlink(path);
+    delete[] oldText;
+    delete[] newText;
+}
+
+// A file just under the paged threshold opens in the buffer, not paged,
+// and can still be typed into and reloaded with bytes appended up to the
+// threshold; the buffer's growth has to stay within int offsets to get
+// there. The file is sparse, so it costs no disk, only the buffer's memory.
+static void checkNearThreshold(const char* backend) {
+    const char* name = "load-near-threshold";
+    char path[256];
+    sprintf(path, "/tmp/texteditor-check-%d.txt", (int)getpid());
+    long long size = Document::DEFAULT_PAGED_THRESHOLD - 16;
+
+    const char* problem = nullptr;
+    Document doc(backend);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool made = fd >= 0 && ftruncate(fd, size) == 0;
+    if (!made || !doc.loadFromFile(path)) {
+        problem = "FAIL: cannot load";
+    } else if (doc.isPaged() || doc.getBuffer()->getLength() != size) {
+        problem = "FAIL: not loaded whole";
+    } else {
+        doc.setCursor((int)size);
+        doc.typeText("12345678", 8, false);
+        usleep(20000);
+        bool appended = pwrite(fd, "abcdefgh", 8, size) == 8;
+        if (doc.getBuffer()->getLength() != size + 8) {
+            problem = "FAIL: typing at the end";
+        } else if (!appended || doc.reloadFromDisk() != Document::RELOAD_APPENDED) {
+            problem = "FAIL: append not reloaded";
+        } else if (doc.getBuffer()->getLength() != Document::DEFAULT_PAGED_THRESHOLD) {
+            problem = "FAIL: wrong length after append";
+        }
+    }
+    if (fd >= 0) close(fd);
+    report(backend, name, problem);
+    unlink(path);
+}
+
+// A history budget smaller than one step still leaves that step whole:
+// typing at 10 carets, and a reload's hunks, each undo in one go
+static void checkTrimKeepsSteps(const char* backend) {
+    const char* name = "trim-keeps-steps";
+    char path[256];
+    sprintf(path, "/tmp/texteditor-check-%d.txt", (int)getpid());
+    int oldLen, newLen;
+    char* oldText = makeLines(200, 7, false, oldLen);
+    char* newText = makeLines(200, 7, true, newLen);
+
+    const char* problem = nullptr;
+    Document doc(backend);
+    if (!writeFile(path, oldText, oldLen, false) || !doc.loadFromFile(path)) {
+        problem = "FAIL: cannot load";
+    } else {
+        doc.setHistoryBudget(200);
+        doc.setCursor(0);
+        for (int line = 1; line < 10; line++) doc.addCaret(doc.getBuffer()->offsetOfLine(line));
+        doc.typeText("abc", 3, false);
+        if (!doc.undo() || !textIs(doc, oldText, oldLen)) {
+            problem = "FAIL: multi-cursor step undone in part";
+        } else {
+            usleep(20000);
+            Document::Reload result = writeFile(path, newText, newLen, true) ? doc.reloadFromDisk() : Document::RELOAD_FAILED;
+            if (result != Document::RELOAD_REWRITTEN || !textIs(doc, newText, newLen)) problem = "FAIL: rewrite not reloaded";
+            else if (!doc.undo() || !textIs(doc, oldText, oldLen)) problem = "FAIL: reload undone in part";
+        }
+    }
+    report(backend, name, problem);
+    unlink(path);
+    delete[] oldText;
+    delete[] newText;
+}
+
+// Once warmed up, keystrokes allocate nothing: typing, deleting both ways
+// and moving the cursor, with a jump every 16 keys. The text's arrays are
+// sized with an eighth to spare at load, more than the keys use, and the
+// undo ring stops growing once the history is at its budget, which the
+// warm-up reaches.
+static void checkKeyAllocs(const char* backend) {
+    const char* name = "key-allocs";
+    const int keys = 20000;
+    int len;
+    char* text = makeLines(160000, 1, false, len);
+    Document doc(backend);
+    doc.getBuffer()->loadFromString(text);
+    doc.setHistoryBudget(256 << 10);
+    doc.getWrap()->reset(doc.getBuffer()->lineCount());
+    doc.getWrap()->setWidth(80);
+
+    unsigned rng = 2463534242u;
+    long long allocations = 0;
+    int allocating = 0;
+    for (int i = 0; i < 2 * keys; i++) {
+        long long before = Metrics::allocations();
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        if (i % 16 == 0) doc.setCursor(rng % (doc.getBuffer()->getLength() + 1));
+        switch ((rng >> 8) % 8) {
+            case 0: doc.backspace(); break;
+            case 1: doc.deleteForward(); break;
+            case 2: doc.moveLeft(false); break;
+            case 3: doc.moveDown(false); break;
+            case 4: doc.typeText("\n", 1, true); break;
+            default: doc.typeText("x", 1, true); break;
+        }
+        long long count = Metrics::allocations() - before;
+        if (i < keys || count == 0) continue;
+        allocations += count;
+        allocating++;
+    }
+    char problem[96];
+    snprintf(problem, sizeof problem, "FAIL: %lld allocations in %d of %d keys", allocations, allocating, keys);
+    report(backend, name, allocations ? problem : nullptr);
+    delete[] text;
+}
+
+int main(int argc, char** argv) {
+    const char* backendArg = "all";
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--backend=", 10) == 0) {
+            backendArg = argv[i] + 10;
+        } else {
+            fprintf(stderr, "usage: %s [--backend=gap|piece|all]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const char* backends[2] = { "gap", "piece" };
+    for (int b = 0; b < 2; b++) {
+        const char* backend = backends[b];
+        if (strcmp(backendArg, "all") != 0 && strcmp(backendArg, backend) != 0) continue;
+        checkRewriteInPlace(backend, MappedFile::copyLimit);
+        checkRewriteInPlace(backend, 0);
+        checkTruncateMapped(backend);
+        checkTrimKeepsSteps(backend);
+        checkKeyAllocs(backend);
+        checkNearThreshold(backend);
+    }
+    return failures;
+}
@@ -0,0 +1,146 @@
+#include "ColumnIndex.h"
+#include "TextBuffer.h"
+#include <cstring>
+
+ColumnIndex::ColumnIndex() : slots(new Slot[SLOTS]), lineText(nullptr), lineTextCapacity(0) {
+    for (int i = 0; i < SLOTS; i++) {
+        slots[i].line = -1;
+        slots[i].starts = nullptr;
+        slots[i].capacity = 0;
+    }
+}
+
+ColumnIndex::~ColumnIndex() {
+    for (int i = 0; i < SLOTS; i++) delete[] slots[i].starts;
+    delete[] slots;
+    delete[] lineText;
+}
+
+int ColumnIndex::sequenceLength(unsigned char lead) {
+    if (lead >= 0xC2 && lead <= 0xDF) return 2;
+    if (lead >= 0xE0 && lead <= 0xEF) return 3;
+    if (lead >= 0xF0 && lead <= 0xF4) return 4;
+    return 1;
+}
+
+void ColumnIndex::onEdit(int firstLine, int lastLine, int lineDelta) {
+    for (int i = 0; i < SLOTS; i++) {
+        int line = slots[i].line;
+        if (line >= firstLine && (lineDelta != 0 || line <= lastLine)) slots[i].line = -1;
+    }
+}
+
+void ColumnIndex::reset() {
+    for (int i = 0; i < SLOTS; i++) slots[i].line = -1;
+}
+
+// Reads the line once; a line with no byte above 0x7f is marked ASCII
+// after a word-at-a-time scan and nothing else is stored for it
+ColumnIndex::Slot& ColumnIndex::slotFor(const TextBuffer* buffer, int line) {
+    Slot& slot = slots[line % SLOTS];
+    int start = buffer->offsetOfLine(line);
+    if (slot.line == line) {
+        // An edit on an earlier line moves this one without changing it
+        slot.start = start;
+        return slot;
+    }
+
+    int len = buffer->lineEnd(line) - start;
+    if (len >= lineTextCapacity) {
+        delete[] lineText;
+        lineTextCapacity = len + 256;
+        lineText = new char[lineTextCapacity];
+    }
+    buffer->read(start, len, lineText);
+    slot.line = line;
+    slot.start = start;
+    slot.length = len;
+
+    int i = 0;
+    for (; i + 8 <= len; i += 8) {
+        unsigned long long word;
+        memcpy(&word, lineText + i, 8);
+        if (word & 0x8080808080808080ULL) break;
+    }
+    while (i < len && !(lineText[i] & 0x80)) i++;
+    slot.ascii = i == len;
+    if (slot.ascii) {
+        slot.columns = len;
+        return slot;
+    }
+
+    if (slot.capacity < len + 1) {
+        delete[] slot.starts;
+        slot.capacity = len + 1;
+        slot.starts = new int[slot.capacity];
+    }
+    const unsigned char* text = (const unsigned char*)lineText;
+    int columns = 0;
+    i = 0;
+    while (i < len) {
+        slot.starts[columns++] = i;
+        int n = sequenceLength(text[i]);
+        bool whole = i + n <= len;
+        for (int k = 1; whole && k < n; k++) whole = (text[i + k] & 0xC0) == 0x80;
+        i += whole ? n : 1;
+    }
+    slot.starts[columns] = len;
+    slot.columns = columns;
+    return slot;
+}
+
+int ColumnIndex::columnOf(const TextBuffer* buffer, int pos) {
+    return columnOf(buffer, buffer->lineOfOffset(pos), pos);
+}
+
+int ColumnIndex::columnOf(const TextBuffer* buffer, int line, int pos) {
+    Slot& slot = slotFor(buffer, line);
+    int offset = pos - slot.start;
+    if (offset <= 0) return offset;
+    if (offset >= slot.length) return slot.columns + (offset - slot.length);
+    if (slot.ascii) return offset;
+
+    // Last column starting at or before offset
+    int lo = 0, hi = slot.columns - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (slot.starts[mid] <= offset) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+int ColumnIndex::offsetAt(const TextBuffer* buffer, int line, int column) {
+    Slot& slot = slotFor(buffer, line);
+    if (column <= 0) return slot.start;
+    if (column >= slot.columns) return slot.start + slot.length;
+    return slot.start + (slot.ascii ? column : slot.starts[column]);
+}
+
+int ColumnIndex::columnCount(const TextBuffer* buffer, int line) {
+    return slotFor(buffer, line).columns;
+}
+
+// Both step over the bytes of one sequence with getCharAt, deciding
+// exactly as the line scan does, so a delete doesn't map the whole line.
+// A lead byte is never a continuation byte, so the sequence ending at a
+// character boundary starts at the nearest lead before it, if any.
+int ColumnIndex::previousChar(const TextBuffer* buffer, int pos) {
+    if (pos <= 0) return 0;
+    for (int k = 1; k <= 4 && pos - k >= 0; k++) {
+        unsigned char c = buffer->getCharAt(pos - k);
+        if ((c & 0xC0) == 0x80) continue;
+        return sequenceLength(c) == k ? pos - k : pos - 1;
+    }
+    return pos - 1;
+}
+
+int ColumnIndex::nextChar(const TextBuffer* buffer, int pos) {
+    int length = buffer->getLength();
+    if (pos >= length) return length;
+    int n = sequenceLength(buffer->getCharAt(pos));
+    for (int k = 1; k < n; k++) {
+        if ((buffer->getCharAt(pos + k) & 0xC0) != 0x80) return pos + 1;
+    }
+    return pos + n;
+}
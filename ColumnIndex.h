@@ -0,0 +1,62 @@
+#ifndef COLUMNINDEX_H
+#define COLUMNINDEX_H
+
+class TextBuffer;
+
+// Maps byte offsets within a line to display columns for UTF-8 text, one
+// column per code point. Bytes that don't form a valid sequence take a
+// column each. Recently used lines are cached in line-indexed slots; a
+// line of pure ASCII stores nothing, since its columns are its byte
+// offsets, and other lines keep the byte offset of every column so both
+// directions are a lookup or a binary search rather than a decode.
+class ColumnIndex {
+private:
+    static const int SLOTS = 64;
+
+    struct Slot {
+        int line;        // -1 when empty
+        int start;       // offset of the line's first byte when cached
+        int length;      // bytes, excluding the '\n'
+        int columns;     // columns in the line
+        bool ascii;      // columns are byte offsets; starts is unused
+        int* starts;     // byte offset (from start) of each column, then length
+        int capacity;
+    };
+
+    Slot* slots;
+    char* lineText;
+    int lineTextCapacity;
+
+    Slot& slotFor(const TextBuffer* buffer, int line);
+
+public:
+    ColumnIndex();
+    ~ColumnIndex();
+
+    // Bytes in the sequence a lead byte starts (1 for ASCII and stray bytes)
+    static int sequenceLength(unsigned char lead);
+
+    // The text of lines [firstLine, lastLine] changed and the document
+    // gained lineDelta lines; later lines keep their entries unless lines
+    // were added or removed
+    void onEdit(int firstLine, int lastLine, int lineDelta);
+    void reset();
+
+    // Column of the character containing pos
+    int columnOf(const TextBuffer* buffer, int pos);
+    // Same, measured on line; offsets past its end count a column per byte
+    // so the '\n' and anything after it stay addressable
+    int columnOf(const TextBuffer* buffer, int line, int pos);
+    // Offset of the character at column on line; past the last column,
+    // the line end
+    int offsetAt(const TextBuffer* buffer, int line, int column);
+    int columnCount(const TextBuffer* buffer, int line);
+
+    // Start of the character before pos, and the offset after the one at
+    // pos; a line's '\n' counts as one character. Read from the few bytes
+    // around pos, without mapping the line.
+    int previousChar(const TextBuffer* buffer, int pos);
+    int nextChar(const TextBuffer* buffer, int pos);
+};
+
+#endif
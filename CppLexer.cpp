@@ -0,0 +1,123 @@
+#include "CppLexer.h"
+#include <cstring>
+#include <cstdlib>
+
+// Sorted for bsearch
+static const char* const keywords[] = {
+    "break", "case", "catch", "class", "const", "constexpr", "continue", "default",
+    "delete", "do", "else", "enum", "explicit", "extern", "false", "for", "friend",
+    "goto", "if", "inline", "namespace", "new", "nullptr", "operator", "override",
+    "private", "protected", "public", "return", "sizeof", "static", "static_cast",
+    "struct", "switch", "template", "this", "throw", "true", "try", "typedef",
+    "typename", "union", "using", "virtual", "volatile", "while"
+};
+
+static const char* const types[] = {
+    "auto", "bool", "char", "double", "float", "int", "long", "short", "signed",
+    "size_t", "unsigned", "void"
+};
+
+// bsearch key: a word inside the line, which is not NUL-terminated
+struct Word {
+    const char* text;
+    int len;
+};
+
+static int compareWord(const void* key, const void* entry) {
+    const Word* w = (const Word*)key;
+    const char* e = *(const char* const*)entry;
+    int c = strncmp(w->text, e, w->len);
+    if (c != 0) return c;
+    return e[w->len] == '\0' ? 0 : -1;
+}
+
+static bool inTable(const char* text, int len, const char* const* table, int n) {
+    Word w = { text, len };
+    return bsearch(&w, table, n, sizeof(table[0]), compareWord) != nullptr;
+}
+
+static bool isIdentStart(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool isIdentChar(char c) {
+    return isIdentStart(c) || (c >= '0' && c <= '9');
+}
+
+int CppLexer::lexLine(const char* text, int len, int state,
+                      Token* out, int maxTokens, int& count) const {
+    count = 0;
+    int i = 0;
+
+    // Finish a block comment carried over from the previous line
+    if (state == BLOCK_COMMENT) {
+        while (i < len && !(text[i] == '*' && i + 1 < len && text[i + 1] == '/')) i++;
+        if (i >= len) {
+            emit(out, maxTokens, count, 0, len, STYLE_COMMENT);
+            return BLOCK_COMMENT;
+        }
+        i += 2;
+        emit(out, maxTokens, count, 0, i, STYLE_COMMENT);
+    }
+
+    // A '#' as the first non-blank character starts a preprocessor line
+    int first = i;
+    while (first < len && (text[first] == ' ' || text[first] == '\t')) first++;
+    bool preproc = state == NORMAL && first < len && text[first] == '#';
+
+    while (i < len) {
+        char c = text[i];
+        int start = i;
+
+        if (c == '/' && i + 1 < len && text[i + 1] == '/') {
+            emit(out, maxTokens, count, i, len - i, STYLE_COMMENT);
+            return NORMAL;
+        }
+        if (c == '/' && i + 1 < len && text[i + 1] == '*') {
+            i += 2;
+            while (i < len && !(text[i] == '*' && i + 1 < len && text[i + 1] == '/')) i++;
+            if (i >= len) {
+                emit(out, maxTokens, count, start, len - start, STYLE_COMMENT);
+                return BLOCK_COMMENT;
+            }
+            i += 2;
+            emit(out, maxTokens, count, start, i - start, STYLE_COMMENT);
+            continue;
+        }
+        if (preproc) {
+            // The directive up to any comment
+            while (i < len && !(text[i] == '/' && i + 1 < len && (text[i + 1] == '/' || text[i + 1] == '*'))) i++;
+            emit(out, maxTokens, count, start, i - start, STYLE_PREPROC);
+            continue;
+        }
+        if (c == '"' || c == '\'') {
+            i++;
+            while (i < len && text[i] != c) {
+                if (text[i] == '\\') i++;
+                i++;
+            }
+            if (i < len) i++;
+            if (i > len) i = len;
+            emit(out, maxTokens, count, start, i - start, STYLE_STRING);
+            continue;
+        }
+        if ((c >= '0' && c <= '9') || (c == '.' && i + 1 < len && text[i + 1] >= '0' && text[i + 1] <= '9')) {
+            // Digits, hex digits, suffixes and exponents all count as part of the number
+            while (i < len && (isIdentChar(text[i]) || text[i] == '.' ||
+                               ((text[i] == '+' || text[i] == '-') && (text[i - 1] == 'e' || text[i - 1] == 'E')))) i++;
+            emit(out, maxTokens, count, start, i - start, STYLE_NUMBER);
+            continue;
+        }
+        if (isIdentStart(c)) {
+            while (i < len && isIdentChar(text[i])) i++;
+            int n = i - start;
+            if (inTable(text + start, n, keywords, sizeof(keywords) / sizeof(keywords[0])))
+                emit(out, maxTokens, count, start, n, STYLE_KEYWORD);
+            else if (inTable(text + start, n, types, sizeof(types) / sizeof(types[0])))
+                emit(out, maxTokens, count, start, n, STYLE_TYPE);
+            continue;
+        }
+        i++;
+    }
+    return NORMAL;
+}
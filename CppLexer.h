@@ -0,0 +1,18 @@
+#ifndef CPPLEXER_H
+#define CPPLEXER_H
+
+#include "Lexer.h"
+
+// C and C++: keywords, built-in types, literals, comments and
+// preprocessor lines. Block comments are the only construct that
+// continues onto the next line.
+class CppLexer : public Lexer {
+public:
+    enum State { NORMAL = 0, BLOCK_COMMENT = 1 };
+
+    int lexLine(const char* text, int len, int state,
+                Token* out, int maxTokens, int& count) const override;
+    const char* name() const override { return "C++"; }
+};
+
+#endif
@@ -0,0 +1,1540 @@
+#include "Document.h"
+#include "MappedFile.h"
+#include "Journal.h"
+#include "UndoFile.h"
+#include "PagedFile.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+Document::Document(const char* backend)
+    : buffer(TextBuffer::create(backend)),
+      cursorPos(0), selectionStart(-1), selectionEnd(-1), selecting(false), coalescing(false),
+      carets(nullptr), caretCount(0), caretCapacity(0),
+      scratch(nullptr), scratchCapacity(0), ranges(nullptr), rangeCapacity(0),
+      undoBytes(0), redoBytes(0), historyBudget(DEFAULT_HISTORY_BUDGET),
+      undoFile(nullptr), persistedCount(0), persistedChecked(false), wrap(&columns), changedFrom(-1), changedTo(-1), version(0), savedVersion(0),
+      filePath(nullptr), journal(nullptr), recoveredEdits(0),
+      diskSize(-1), diskMtime(0), diskInode(0), diskTailLen(0),
+      paged(nullptr), pagedThreshold(DEFAULT_PAGED_THRESHOLD), page(0), pageNewlines(0),
+      patches(nullptr), patchLengths(nullptr), lineDeltas(nullptr), patchSlots(0), patchCount(0) {}
+
+Document::~Document() {
+    // A journal with unsaved edits stays on disk for recovery
+    if (journal) {
+        journal->close(!isModified());
+        delete journal;
+    }
+    closePaged();
+    delete undoFile;
+    delete[] filePath;
+    delete[] carets;
+    delete[] scratch;
+    delete[] ranges;
+    delete buffer;
+}
+
+// Grows the scratch buffer to len bytes; its old contents are not kept
+char* Document::reserveScratch(int len) {
+    if (!scratch || len > scratchCapacity) {
+        delete[] scratch;
+        scratchCapacity = std::max(len, scratchCapacity * 2);
+        if (scratchCapacity < 256) scratchCapacity = 256;
+        scratch = new char[scratchCapacity];
+    }
+    return scratch;
+}
+
+void Document::setCursor(int pos) {
+    if (pos < 0) pos = 0;
+    if (pos > buffer->getLength()) pos = buffer->getLength();
+    cursorPos = pos;
+    coalescing = false;
+}
+
+void Document::markChanged(int from, int to) {
+    if (changedFrom < 0 || from < changedFrom) changedFrom = from;
+    if (to > changedTo) changedTo = to;
+}
+
+void Document::takeChangedLines(int& from, int& to) {
+    from = changedFrom;
+    to = changedTo;
+    changedFrom = changedTo = -1;
+}
+
+// Replace [start, end) with text, without touching the undo history
+void Document::replaceText(int start, int end, const char* text, int len) {
+    int startLine = buffer->lineOfOffset(start);
+    int oldLineCount = buffer->lineCount();
+    {
+        std::lock_guard<std::mutex> guard(textLock);
+        buffer->erase(start, end - start);
+        buffer->insert(text, len);
+    }
+    brackets.onEdit(buffer, start, end - start, len);
+    version++;
+    if (journal) journal->logReplace(start, end - start, text, len);
+
+    int endLine = buffer->lineOfOffset(start + len);
+    highlighter.onEdit(startLine, endLine, buffer->lineCount() - oldLineCount);
+    columns.onEdit(startLine, endLine, buffer->lineCount() - oldLineCount);
+    wrap.onEdit(startLine, endLine, buffer->lineCount() - oldLineCount);
+    changes.onEdit(startLine, endLine, buffer->lineCount() - oldLineCount);
+
+    // Lines below shift when the line count changes
+    if (buffer->lineCount() != oldLineCount) markChanged(startLine, 0x7fffffff);
+    else markChanged(startLine, endLine);
+}
+
+// Whether [start, end) -> len bytes continues record: typing on at the
+// end of what it inserted, deleting back through that, or deleting next
+// to a pure deletion
+static bool continuesRecord(const EditorState& record, int start, int end, int len) {
+    int recordEnd = record.pos + record.insertedLen;
+    int delLen = end - start;
+    if (delLen == 0 && start == recordEnd) return true;
+    if (len == 0 && end == recordEnd && delLen <= record.insertedLen) return true;
+    return len == 0 && record.insertedLen == 0 && (end == record.pos || start == record.pos);
+}
+
+// Folds an edit continuesRecord accepted into record
+static void extendRecord(EditorState& record, int start, int end, const char* text, int len, const char* deleted) {
+    int delLen = end - start;
+    if (delLen == 0) record.appendInserted(text, len);
+    else if (end == record.pos + record.insertedLen && delLen <= record.insertedLen) record.truncateInserted(delLen);
+    else if (end == record.pos) record.prependDeleted(deleted, delLen);
+    else record.appendDeleted(deleted, delLen);
+    record.cursorAfter = start + len;
+}
+
+// Record [start, end) -> text as an undo delta, then apply it.
+// Mergeable edits (typing, backspace, x) extend the top record while
+// the user keeps editing at the same spot.
+void Document::applyEdit(int start, int end, const char* text, int len, bool mergeable) {
+    long long started = Metrics::enabled ? Metrics::nowUs() : 0;
+    int delLen = end - start;
+    char* deleted = reserveScratch(delLen);
+    buffer->read(start, delLen, deleted);
+
+    bool merged = false;
+    if (mergeable && coalescing && !undoStack.isEmpty() && continuesRecord(undoStack.peek(), start, end, len)) {
+        EditorState& top = undoStack.peek();
+        long long topBytes = top.bytes();
+        extendRecord(top, start, end, text, len, deleted);
+        undoBytes += top.bytes() - topBytes;
+        merged = true;
+    }
+
+    if (!merged) {
+        const EditorState& state =
+            undoStack.emplace(start, deleted, delLen, text, len, cursorPos, selectionStart, selectionEnd);
+        undoBytes += state.bytes();
+    }
+    redoStack.clear();
+    redoBytes = 0;
+    trimHistory();
+
+    replaceText(start, end, text, len);
+    cursorPos = start + len;
+    clearSelection();
+
+    // A newline closes the current undo group
+    coalescing = mergeable && !(len == 1 && text[0] == '\n');
+    if (Metrics::enabled) Metrics::editTime.add(Metrics::nowUs() - started);
+}
+
+void Document::setHistoryBudget(long long bytes) {
+    historyBudget = bytes;
+    trimHistory();
+}
+
+// Forgets the oldest undo steps until the history fits its budget. A step
+// joined from several records (a multi-cursor edit, a reload's hunks) goes
+// whole or not at all, and the newest step always stays. Redo records
+// only exist after undos and are dropped with the next edit.
+void Document::trimHistory() {
+    if (undoBytes + redoBytes <= historyBudget) return;
+    int newest = undoStack.size() - 1;
+    while (newest > 0 && undoStack.at(newest).joined) newest--;
+    while (undoBytes + redoBytes > historyBudget && newest > 0) {
+        int records = 1;
+        while (records < newest && undoStack.at(records).joined) records++;
+        for (int i = 0; i < records; i++) {
+            undoBytes -= undoStack.bottom().bytes();
+            undoStack.dropBottom();
+        }
+        newest -= records;
+        // Saved history no longer connects to what is left
+        dropPersistedUndo();
+    }
+}
+
+// Inserts at the cursor, replacing the selection if there is one
+void Document::typeText(const char* text, int len, bool mergeable) {
+    if (caretCount > 0) {
+        editCarets(EDIT_INSERT, text, len, mergeable);
+        return;
+    }
+    int start = cursorPos, end = cursorPos;
+    if (hasSelection()) getSelection(start, end);
+    applyEdit(start, end, text, len, mergeable);
+}
+
+void Document::backspace() {
+    if (caretCount > 0) editCarets(EDIT_BACKSPACE, "", 0, true);
+    else if (hasSelection()) deleteSelection();
+    else if (cursorPos > 0) applyEdit(columns.previousChar(buffer, cursorPos), cursorPos, "", 0, true);
+}
+
+void Document::deleteForward() {
+    if (caretCount > 0) editCarets(EDIT_DELETE, "", 0, true);
+    else if (hasSelection()) deleteSelection();
+    else if (cursorPos < buffer->getLength()) applyEdit(cursorPos, columns.nextChar(buffer, cursorPos), "", 0, true);
+}
+
+void Document::deleteSelection() {
+    if (caretCount > 0) {
+        editCarets(EDIT_INSERT, "", 0, false);
+        return;
+    }
+    if (!hasSelection()) return;
+
+    int start, end;
+    getSelection(start, end);
+    applyEdit(start, end, "", 0, false);
+}
+
+// Undo and redo take a multi-cursor edit's records as one step, and
+// leave a single cursor
+bool Document::undo() {
+    if (undoStack.isEmpty() && !loadPersistedUndo()) return false;
+    clearCarets();
+    bool joined = true;
+    while (joined && (!undoStack.isEmpty() || loadPersistedUndo())) {
+        EditorState prevState = undoStack.pop();
+        replaceText(prevState.pos, prevState.pos + prevState.insertedLen, prevState.deleted, prevState.deletedLen);
+        cursorPos = prevState.cursorBefore;
+        selectionStart = prevState.selStart;
+        selectionEnd = prevState.selEnd;
+        undoBytes -= prevState.bytes();
+        redoBytes += prevState.bytes();
+        joined = prevState.joined;
+        redoStack.push(std::move(prevState));
+    }
+    coalescing = false;
+    return true;
+}
+
+bool Document::redo() {
+    if (redoStack.isEmpty()) return false;
+    clearCarets();
+    do {
+        EditorState nextState = redoStack.pop();
+        replaceText(nextState.pos, nextState.pos + nextState.deletedLen, nextState.inserted, nextState.insertedLen);
+        cursorPos = nextState.cursorAfter;
+        redoBytes -= nextState.bytes();
+        undoBytes += nextState.bytes();
+        undoStack.push(std::move(nextState));
+    } while (!redoStack.isEmpty() && redoStack.peek().joined);
+    clearSelection();
+    coalescing = false;
+    return true;
+}
+
+// --- Cursor Movement ---
+static bool isWordByte(char c) {
+    unsigned char b = c;
+    return isalnum(b) || b == '_' || b >= 0x80;
+}
+
+// Vim's classes of characters for word motions: blanks, word characters
+// (any non-ASCII byte among them) and everything else
+enum CharClass { CLASS_BLANK, CLASS_PUNCT, CLASS_WORD };
+
+static CharClass charClass(char c) {
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') return CLASS_BLANK;
+    return isWordByte(c) ? CLASS_WORD : CLASS_PUNCT;
+}
+
+void Document::moveLeft(bool extend) {
+    moveAll(STEP_LEFT, extend);
+}
+
+void Document::moveRight(bool extend) {
+    moveAll(STEP_RIGHT, extend);
+}
+
+// In paged mode, moving off the first or last row turns the page
+void Document::moveUp(bool extend) {
+    int before = cursorPos;
+    moveAll(STEP_UP, extend);
+    if (paged && cursorPos == before && !extend && caretCount == 0) turnPage(-1);
+}
+
+void Document::moveDown(bool extend) {
+    int before = cursorPos;
+    moveAll(STEP_DOWN, extend);
+    if (paged && cursorPos == before && !extend && caretCount == 0) turnPage(1);
+}
+
+void Document::moveWordStart(bool extend) {
+    moveAll(STEP_WORD, extend);
+}
+
+void Document::moveWordBack(bool extend) {
+    moveAll(STEP_WORD_BACK, extend);
+}
+
+void Document::moveWordEnd(bool extend) {
+    moveAll(STEP_WORD_END, extend);
+}
+
+void Document::moveLineStart(bool extend) {
+    moveAll(STEP_LINE_START, extend);
+}
+
+void Document::moveLineEnd(bool extend) {
+    moveAll(STEP_LINE_END, extend);
+}
+
+void Document::gotoLine(int line) {
+    if (line < 0) line = 0;
+    if (line >= buffer->lineCount()) line = buffer->lineCount() - 1;
+    int pos = buffer->offsetOfLine(line);
+    int end = buffer->lineEnd(line);
+    while (pos < end && (buffer->getCharAt(pos) == ' ' || buffer->getCharAt(pos) == '\t')) pos++;
+    clearCarets();
+    clearSelection();
+    setCursor(pos);
+}
+
+bool Document::matchBracket() {
+    int end = buffer->lineEnd(buffer->lineOfOffset(cursorPos));
+    int at = brackets.find(buffer, cursorPos, end);
+    int other = at < 0 ? -1 : brackets.match(buffer, at);
+    if (other < 0) return false;
+    clearCarets();
+    clearSelection();
+    setCursor(other);
+    return true;
+}
+
+bool Document::selectInnerWord() {
+    int len = buffer->getLength();
+    if (cursorPos >= len || buffer->getCharAt(cursorPos) == '\n') return false;
+    CharClass cls = charClass(buffer->getCharAt(cursorPos));
+    int lo = cursorPos, hi = cursorPos + 1;
+    while (lo > 0 && buffer->getCharAt(lo - 1) != '\n' && charClass(buffer->getCharAt(lo - 1)) == cls) lo--;
+    while (hi < len && buffer->getCharAt(hi) != '\n' && charClass(buffer->getCharAt(hi)) == cls) hi++;
+    clearCarets();
+    setSelection(lo, hi);
+    return true;
+}
+
+bool Document::selectInnerBrackets(char c) {
+    char open = (c == ')' || c == ']' || c == '}') ? BracketIndex::partner(c) : c;
+    int openPos, closePos;
+    if (!brackets.enclosing(buffer, cursorPos, open, openPos, closePos)) return false;
+
+    // A block spanning lines keeps the line break after the opening bracket
+    // and the indent before the closing one, as in vim
+    int lo = openPos + 1, hi = closePos;
+    if (lo < hi && buffer->getCharAt(lo) == '\n') {
+        lo++;
+        int lineStart = buffer->offsetOfLine(buffer->lineOfOffset(closePos));
+        int p = lineStart;
+        while (p < closePos && (buffer->getCharAt(p) == ' ' || buffer->getCharAt(p) == '\t')) p++;
+        if (p == closePos && lineStart >= lo) hi = lineStart;
+    }
+    clearCarets();
+    setSelection(lo, hi);
+    return true;
+}
+
+// Moves the main cursor, then every extra one by swapping it in as the main
+// cursor for the same step
+void Document::moveAll(Step direction, bool extend) {
+    step(direction, extend);
+    if (caretCount == 0) return;
+    Caret main = { cursorPos, selectionStart, selectionEnd, selecting };
+    for (int i = 0; i < caretCount; i++) {
+        Caret& c = carets[i];
+        cursorPos = c.pos;
+        selectionStart = c.selStart;
+        selectionEnd = c.selEnd;
+        selecting = c.selecting;
+        step(direction, extend);
+        c.pos = cursorPos;
+        c.selStart = selectionStart;
+        c.selEnd = selectionEnd;
+        c.selecting = selecting;
+    }
+    cursorPos = main.pos;
+    selectionStart = main.selStart;
+    selectionEnd = main.selEnd;
+    selecting = main.selecting;
+    sortCarets();
+}
+
+void Document::step(Step direction, bool extend) {
+    if (direction == STEP_UP || direction == STEP_DOWN) {
+        moveRows(direction == STEP_UP ? -1 : 1, extend);
+        return;
+    }
+    if (extend) startSelection(); else clearSelection();
+    cursorPos = motionTarget(direction, cursorPos);
+    if (extend) updateSelection();
+    coalescing = false;
+}
+
+// Where a step along the line or through the words from pos lands
+int Document::motionTarget(Step direction, int pos) {
+    int len = buffer->getLength();
+    switch (direction) {
+        case STEP_LEFT:
+            return columns.previousChar(buffer, pos);
+        case STEP_RIGHT:
+            return columns.nextChar(buffer, pos);
+        case STEP_LINE_START:
+            return buffer->offsetOfLine(buffer->lineOfOffset(pos));
+        case STEP_LINE_END: {
+            int line = buffer->lineOfOffset(pos);
+            int end = buffer->lineEnd(line);
+            return end > buffer->offsetOfLine(line) ? columns.previousChar(buffer, end) : end;
+        }
+        case STEP_WORD: {
+            // Past the rest of this run, then past blanks up to an empty line
+            if (pos >= len) return len;
+            CharClass cls = charClass(buffer->getCharAt(pos));
+            if (cls != CLASS_BLANK) {
+                while (pos < len && charClass(buffer->getCharAt(pos)) == cls) pos++;
+            }
+            while (pos < len && charClass(buffer->getCharAt(pos)) == CLASS_BLANK) {
+                if (buffer->getCharAt(pos) == '\n' && buffer->getCharAt(pos + 1) == '\n') return pos + 1;
+                pos++;
+            }
+            return pos;
+        }
+        case STEP_WORD_BACK: {
+            // Back over blanks down to an empty line, then to the run's start
+            if (pos <= 0) return 0;
+            pos--;
+            while (pos > 0 && charClass(buffer->getCharAt(pos)) == CLASS_BLANK &&
+                   !(buffer->getCharAt(pos) == '\n' && buffer->getCharAt(pos - 1) == '\n')) {
+                pos--;
+            }
+            CharClass cls = charClass(buffer->getCharAt(pos));
+            if (cls != CLASS_BLANK) {
+                while (pos > 0 && charClass(buffer->getCharAt(pos - 1)) == cls) pos--;
+            }
+            return pos;
+        }
+        case STEP_WORD_END: {
+            // On at least one character, past blanks, then to the run's last
+            // character
+            if (pos >= len) return len;
+            pos = columns.nextChar(buffer, pos);
+            while (pos < len && charClass(buffer->getCharAt(pos)) == CLASS_BLANK) pos++;
+            if (pos >= len) return len;
+            CharClass cls = charClass(buffer->getCharAt(pos));
+            while (pos + 1 < len && charClass(buffer->getCharAt(pos + 1)) == cls) pos++;
+            while (pos > 0 && (buffer->getCharAt(pos) & 0xC0) == 0x80) pos--;
+            return pos;
+        }
+        default:
+            return pos;
+    }
+}
+
+void Document::moveRows(int delta, bool extend) {
+    if (extend) startSelection(); else clearSelection();
+    int line = buffer->lineOfOffset(cursorPos);
+    int column = columns.columnOf(buffer, line, cursorPos);
+    int row = wrap.rowOfColumn(buffer, line, column);
+    int width = wrap.getWidth();
+
+    // Column within the row; the end of a full row counts as its last cell
+    int cell = column - row * width;
+    if (width > 0 && cell >= width) cell = width - 1;
+    if (wrap.advance(buffer, line, row, delta) != 0) cursorPos = columns.offsetAt(buffer, line, row * width + cell);
+    if (extend) updateSelection();
+    coalescing = false;
+}
+
+// --- Multiple Cursors ---
+void Document::pushMainCaret() {
+    if (caretCount == caretCapacity) {
+        int newCapacity = caretCapacity ? caretCapacity * 2 : 16;
+        Caret* grown = new Caret[newCapacity];
+        if (caretCount > 0) memcpy(grown, carets, caretCount * sizeof(Caret));
+        delete[] carets;
+        carets = grown;
+        caretCapacity = newCapacity;
+    }
+    Caret main = { cursorPos, selectionStart, selectionEnd, selecting };
+    carets[caretCount++] = main;
+}
+
+// Restores offset order after cursors moved, and merges cursors that met
+// each other or the main cursor
+void Document::sortCarets() {
+    for (int i = 1; i < caretCount; i++) {
+        Caret c = carets[i];
+        int j = i;
+        while (j > 0 && carets[j - 1].pos > c.pos) {
+            carets[j] = carets[j - 1];
+            j--;
+        }
+        carets[j] = c;
+    }
+    int kept = 0;
+    for (int i = 0; i < caretCount; i++) {
+        if (carets[i].pos == cursorPos || (kept > 0 && carets[kept - 1].pos == carets[i].pos)) continue;
+        carets[kept++] = carets[i];
+    }
+    caretCount = kept;
+}
+
+void Document::addCaret(int pos) {
+    pushMainCaret();
+    clearSelection();
+    setCursor(pos);
+    sortCarets();
+}
+
+void Document::addCaretRow(int delta) {
+    pushMainCaret();
+    clearSelection();
+    moveRows(delta, false);
+    sortCarets();
+}
+
+void Document::clearCarets() {
+    if (caretCount > 0) coalescing = false;
+    caretCount = 0;
+}
+
+bool Document::addCaretAtNextMatch() {
+    if (!hasSelection()) {
+        int lo = cursorPos, hi = cursorPos;
+        while (lo > 0 && isWordByte(buffer->getCharAt(lo - 1))) lo--;
+        while (hi < buffer->getLength() && isWordByte(buffer->getCharAt(hi))) hi++;
+        if (lo == hi) return false;
+        setSelection(lo, hi);
+        return true;
+    }
+
+    int lo, hi;
+    getSelection(lo, hi);
+    char* needle = new char[hi - lo];
+    buffer->read(lo, hi - lo, needle);
+    Searcher finder;
+    finder.setPattern(needle, hi - lo);
+    delete[] needle;
+
+    // Search on from the last cursor, wrapping around to the start, and
+    // skip occurrences a cursor already selects
+    int from = hi;
+    for (int i = 0; i < caretCount; i++) from = std::max(from, std::max(carets[i].selStart, carets[i].selEnd));
+    int match = finder.findForward(buffer, from, buffer->getLength());
+    if (match < 0) match = finder.findForward(buffer, 0, from);
+    while (match >= 0) {
+        bool taken = match == lo;
+        for (int i = 0; i < caretCount && !taken; i++) {
+            taken = std::min(carets[i].selStart, carets[i].selEnd) == match && carets[i].selStart != carets[i].selEnd;
+        }
+        if (!taken) break;
+        match = match + 1 < from ? finder.findForward(buffer, match + 1, from) : -1;
+    }
+    if (match < 0) return false;
+
+    pushMainCaret();
+    setSelection(match, match + (hi - lo));
+    sortCarets();
+    return true;
+}
+
+void Document::getCaret(int i, int& pos, int& lo, int& hi) const {
+    const Caret& c = carets[i];
+    pos = c.pos;
+    lo = hi = -1;
+    if (c.selStart != -1 && c.selEnd != -1 && c.selStart != c.selEnd) {
+        lo = std::min(c.selStart, c.selEnd);
+        hi = std::max(c.selStart, c.selEnd);
+    }
+}
+
+int Document::caretFrom(int pos) const {
+    int lo = 0, hi = caretCount;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (carets[mid].pos < pos) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// One edit at every cursor, applied in a single sweep: the ranges are
+// taken in offset order, each shifted by what the ones before it added or
+// removed, so the buffer's edit point only ever moves forward. Each range
+// gets its own undo record and the records are joined into one undo step;
+// typing on with the same cursors extends those records in place.
+void Document::editCarets(CaretEdit kind, const char* text, int len, bool mergeable) {
+    long long started = Metrics::enabled ? Metrics::nowUs() : 0;
+    int n = caretCount + 1;
+    if (n > rangeCapacity) {
+        delete[] ranges;
+        rangeCapacity = std::max(n, rangeCapacity * 2);
+        ranges = new CaretRange[rangeCapacity];
+    }
+    Caret main = { cursorPos, selectionStart, selectionEnd, selecting };
+    for (int i = 0; i < n; i++) {
+        const Caret& c = i == 0 ? main : carets[i - 1];
+        CaretRange& r = ranges[i];
+        r.main = i == 0;
+        if (c.selStart != -1 && c.selEnd != -1 && c.selStart != c.selEnd) {
+            r.start = std::min(c.selStart, c.selEnd);
+            r.end = std::max(c.selStart, c.selEnd);
+        } else if (kind == EDIT_BACKSPACE) {
+            r.start = columns.previousChar(buffer, c.pos);
+            r.end = c.pos;
+        } else if (kind == EDIT_DELETE) {
+            r.start = c.pos;
+            r.end = columns.nextChar(buffer, c.pos);
+        } else {
+            r.start = r.end = c.pos;
+        }
+    }
+
+    // Offset order (the extras already are), merging ranges that overlap
+    for (int i = 1; i < n; i++) {
+        CaretRange r = ranges[i];
+        int j = i;
+        while (j > 0 && ranges[j - 1].start > r.start) {
+            ranges[j] = ranges[j - 1];
+            j--;
+        }
+        ranges[j] = r;
+    }
+    int m = 0;
+    int edits = 0;   // ranges that change text; the rest only move
+    for (int i = 0; i < n; i++) {
+        CaretRange& r = ranges[i];
+        if (m > 0 && (r.start < ranges[m - 1].end || (r.start == ranges[m - 1].start && r.end == ranges[m - 1].end))) {
+            ranges[m - 1].end = std::max(ranges[m - 1].end, r.end);
+            ranges[m - 1].main = ranges[m - 1].main || r.main;
+            continue;
+        }
+        if (r.start < r.end || len > 0) edits++;
+        ranges[m++] = r;
+    }
+    if (edits == 0) return;
+
+    // The top undo step takes the edits when it has a record for each
+    // range and every range continues its record
+    int count = undoStack.size();
+    bool merge = mergeable && coalescing && count >= edits && !undoStack.at(count - edits).joined;
+    for (int i = 0, e = 0; merge && i < m; i++) {
+        if (ranges[i].start == ranges[i].end && len == 0) continue;
+        const EditorState& record = undoStack.at(count - edits + e);
+        merge = (e == 0 || record.joined) && continuesRecord(record, ranges[i].start, ranges[i].end, len);
+        e++;
+    }
+    if (!merge) {
+        redoStack.clear();
+        redoBytes = 0;
+    }
+
+    caretCount = 0;
+    int shift = 0;
+    int e = 0;
+    for (int i = 0; i < m; i++) {
+        int start = ranges[i].start + shift;
+        int end = ranges[i].end + shift;
+        int delLen = end - start;
+        if (delLen > 0 || len > 0) {
+            char* deleted = reserveScratch(delLen);
+            buffer->read(start, delLen, deleted);
+            if (merge) {
+                EditorState& record = undoStack.at(count - edits + e);
+                long long recordBytes = record.bytes();
+                record.pos += shift;
+                extendRecord(record, start, end, text, len, deleted);
+                undoBytes += record.bytes() - recordBytes;
+            } else {
+                EditorState& state =
+                    undoStack.emplace(start, deleted, delLen, text, len, main.pos, main.selStart, main.selEnd);
+                state.joined = e > 0;
+                undoBytes += state.bytes();
+            }
+            e++;
+            replaceText(start, end, text, len);
+            shift += len - delLen;
+        }
+
+        int head = start + len;
+        if (ranges[i].main) {
+            cursorPos = head;
+        } else {
+            Caret c = { head, -1, -1, false };
+            carets[caretCount++] = c;
+        }
+    }
+
+    // Cursors that deleted up to each other now share a spot
+    sortCarets();
+    clearSelection();
+    count = undoStack.size();
+    for (int i = count - edits; i < count; i++) undoStack.at(i).cursorAfter = cursorPos;
+    trimHistory();
+    coalescing = mergeable && !(len == 1 && text[0] == '\n');
+    if (Metrics::enabled) Metrics::editTime.add(Metrics::nowUs() - started);
+}
+
+// --- Selection ---
+void Document::startSelection() { if (!selecting) { selectionStart = cursorPos; selecting = true; } }
+void Document::updateSelection() { selectionEnd = cursorPos; }
+void Document::clearSelection() { selectionStart = -1; selectionEnd = -1; selecting = false; }
+bool Document::hasSelection() const { return selectionStart != -1 && selectionEnd != -1 && selectionStart != selectionEnd; }
+
+void Document::setSelection(int anchor, int head) {
+    selectionStart = anchor;
+    selectionEnd = head;
+    cursorPos = head;
+    selecting = true;
+    coalescing = false;
+}
+
+void Document::selectAll() {
+    selectionStart = 0;
+    selectionEnd = buffer->getLength();
+    cursorPos = selectionEnd;
+}
+
+void Document::getSelection(int& lo, int& hi) const {
+    lo = std::min(selectionStart, selectionEnd);
+    hi = std::max(selectionStart, selectionEnd);
+}
+
+char* Document::copySelection(int& len) const {
+    int start, end;
+    getSelection(start, end);
+    len = end - start;
+    char* text = new char[len + 1];
+    buffer->read(start, len, text);
+    text[len] = '\0';
+    return text;
+}
+
+// --- Search ---
+// Moves the cursor to the next match after (or the previous one before)
+// the cursor, wrapping around the ends of the document
+bool Document::findNext(bool forward, bool& wrapped) {
+    wrapped = false;
+    int len = buffer->getLength();
+    int match;
+    if (forward) {
+        match = searcher.findForward(buffer, cursorPos + 1, len);
+        if (match < 0) {
+            match = searcher.findForward(buffer, 0, cursorPos + 1);
+            wrapped = true;
+        }
+    } else {
+        match = searcher.findBackward(buffer, cursorPos, 0);
+        if (match < 0) {
+            match = searcher.findBackward(buffer, len, cursorPos);
+            wrapped = true;
+        }
+    }
+    if (match < 0) return false;
+
+    clearSelection();
+    setCursor(match);
+    return true;
+}
+
+// Replaces every match with text in a single pass: the span from the first
+// match to the end of the last is rebuilt once and applied as one edit, so
+// the whole replacement is also a single undo step
+int Document::replaceAll(const char* text, int len) {
+    int m = searcher.length();
+    int first = searcher.findForward(buffer, 0, buffer->getLength());
+    if (first < 0) return 0;
+    clearCarets();
+
+    int capacity = 1024;
+    char* out = new char[capacity];
+    int outLen = 0;
+    int count = 0;
+    int pos = first;
+    int match = first;
+    int lastStart = first;
+    while (match >= 0) {
+        // Unchanged text before the match, then the replacement
+        int keep = match - pos;
+        if (outLen + keep + len > capacity) {
+            int newCapacity = std::max(capacity * 2, outLen + keep + len);
+            char* grown = new char[newCapacity];
+            memcpy(grown, out, outLen);
+            delete[] out;
+            out = grown;
+            capacity = newCapacity;
+        }
+        buffer->read(pos, keep, out + outLen);
+        outLen += keep;
+        lastStart = outLen;
+        memcpy(out + outLen, text, len);
+        outLen += len;
+        pos = match + m;
+        count++;
+        match = searcher.findForward(buffer, pos, buffer->getLength());
+    }
+
+    applyEdit(first, pos, out, outLen, false);
+    delete[] out;
+    setCursor(first + lastStart);
+    return count;
+}
+
+// --- File Operations ---
+void Document::resetHistory() {
+    cursorPos = 0;
+    clearSelection();
+    clearCarets();
+    undoStack.clear();
+    redoStack.clear();
+    undoBytes = redoBytes = 0;
+    dropPersistedUndo();
+    coalescing = false;
+    version++;
+    savedVersion = version;
+    highlighter.reset(buffer->lineCount());
+    columns.reset();
+    wrap.reset(buffer->lineCount());
+    brackets.reset();
+    markChanged(0, 0x7fffffff);
+}
+
+bool Document::loadFromFile(const char* filename) {
+    long long started = Metrics::enabled ? Metrics::nowUs() : 0;
+    struct stat st;
+    if (stat(filename, &st) == 0 && st.st_size > pagedThreshold) {
+        if (!openPaged(filename)) return false;
+    } else {
+        MappedFile* file = new MappedFile();
+        if (!file->open(filename) || file->getSize() > 0x7ffffff0LL) {
+            delete file;
+            return false;
+        }
+        closePaged();
+        std::lock_guard<std::mutex> guard(textLock);
+        buffer->loadFromMapping(file);
+    }
+    highlighter.setLexer(Lexer::forFile(filename), buffer->lineCount());
+    resetHistory();
+    setFilePath(filename);
+    noteDiskState();
+    if (paged) changes.disable();
+    else changes.setSaved(filename, diskSize, buffer->lineCount());
+    if (paged) {
+        dropPersistedUndo();
+        if (journal) {
+            discardJournal();
+            delete journal;
+            journal = nullptr;
+        }
+    } else {
+        openUndoFile();
+        if (journal) {
+            discardJournal();
+            startJournal(true);
+        }
+    }
+    if (Metrics::enabled) Metrics::fileLoad.add(Metrics::nowUs() - started);
+    return true;
+}
+
+// Writes every chunk of the buffer to fd, batching chunks into writev calls
+static bool writeBuffer(int fd, const TextBuffer* buffer) {
+    const int batch = 64;
+    struct iovec iov[batch];
+    int len = buffer->getLength();
+    int pos = 0;
+    while (pos < len) {
+        int count = 0;
+        while (count < batch && pos < len) {
+            const char* data;
+            int n = buffer->chunkAt(pos, &data);
+            iov[count].iov_base = (void*)data;
+            iov[count].iov_len = n;
+            count++;
+            pos += n;
+        }
+
+        // writev may stop early; resume from the first unwritten byte
+        struct iovec* next = iov;
+        while (count > 0) {
+            ssize_t written = writev(fd, next, count);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            while (count > 0 && (size_t)written >= next->iov_len) {
+                written -= next->iov_len;
+                next++;
+                count--;
+            }
+            if (count > 0) {
+                next->iov_base = (char*)next->iov_base + written;
+                next->iov_len -= written;
+            }
+        }
+    }
+    return true;
+}
+
+// Writes to a temp file next to the target, fsyncs it and renames it over
+// the target, so a crash mid-save leaves the old file intact. This also
+// keeps a mapping of the old file valid, since its inode is never rewritten.
+bool Document::saveToFile(const char* filename) {
+    long long started = Metrics::enabled ? Metrics::nowUs() : 0;
+
+    // Follow a symlink so the link itself is not replaced
+    char target[PATH_MAX];
+    if (!realpath(filename, target)) {
+        if (strlen(filename) >= sizeof(target)) return false;
+        strcpy(target, filename);
+    }
+
+    // Text read from a file that was rewritten in place is lost; the
+    // watcher reloads it rather than this writing out whatever is left
+    if (!paged && buffer->fileMapping()) {
+        struct stat current;
+        int fd = open(target, O_RDONLY);
+        bool lost = fd >= 0 && fstat(fd, &current) == 0 && mappingRewritten(fd, current);
+        if (fd >= 0) close(fd);
+        if (lost) return false;
+    }
+
+    char tempPath[PATH_MAX + 16];
+    sprintf(tempPath, "%s.XXXXXX", target);
+    int fd = mkstemp(tempPath);
+    if (fd < 0) return false;
+
+    // Keep the permissions of an existing file; new files get the umask default
+    struct stat st;
+    mode_t mode;
+    if (stat(target, &st) == 0) {
+        mode = st.st_mode & 07777;
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        mode = 0666 & ~mask;
+    }
+
+    long long newPageStart = 0;
+    bool ok = fchmod(fd, mode) == 0 && (paged ? writePaged(fd, newPageStart) : writeBuffer(fd, buffer)) &&
+              fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tempPath, target) != 0) {
+        unlink(tempPath);
+        return false;
+    }
+
+    // The file now holds every edit; restart the journal against it
+    savedVersion = version;
+    setFilePath(filename);
+    if (paged) {
+        // Page bounds moved with the patches; reopen at the cursor
+        long long cursorOffset = newPageStart + cursorPos;
+        if (!paged->open(target)) {
+            closePaged();
+            return false;
+        }
+        resetPatches();
+        loadPage(paged->pageOf(cursorOffset));
+        resetHistory();
+        setCursor((int)(cursorOffset - paged->pageStart(page)));
+    } else {
+        saveUndoFile();
+    }
+    noteDiskState();
+    if (paged) changes.disable();
+    else changes.setSaved(target, diskSize, buffer->lineCount());
+    if (journal) {
+        discardJournal();
+        startJournal(false);
+    }
+
+    // Saving under a new extension switches the highlighting language
+    Lexer* lexer = Lexer::forFile(filename);
+    const Lexer* current = highlighter.getLexer();
+    if (strcmp(lexer ? lexer->name() : "", current ? current->name() : "") != 0) {
+        highlighter.setLexer(lexer, buffer->lineCount());
+        markChanged(0, 0x7fffffff);
+    } else {
+        delete lexer;
+    }
+
+    // Persist the rename itself
+    char dir[PATH_MAX + 16];
+    strcpy(dir, target);
+    char* slash = strrchr(dir, '/');
+    if (slash == dir) slash[1] = '\0';
+    else if (slash) *slash = '\0';
+    else strcpy(dir, ".");
+    int dirFd = open(dir, O_RDONLY);
+    if (dirFd >= 0) {
+        fsync(dirFd);
+        close(dirFd);
+    }
+    if (Metrics::enabled) Metrics::fileSave.add(Metrics::nowUs() - started);
+    return true;
+}
+
+void Document::newFile() {
+    closePaged();
+    {
+        std::lock_guard<std::mutex> guard(textLock);
+        buffer->clear();
+    }
+    highlighter.setLexer(nullptr, 1);
+    resetHistory();
+    setFilePath(nullptr);
+    noteDiskState();
+    changes.setSaved(nullptr, 0, 1);
+    if (journal) {
+        discardJournal();
+        startJournal(false);
+    }
+}
+
+// --- Paged Mode ---
+bool Document::openPaged(const char* filename) {
+    PagedFile* file = new PagedFile();
+    if (!file->open(filename)) {
+        delete file;
+        return false;
+    }
+    closePaged();
+    paged = file;
+    resetPatches();
+    loadPage(0);
+    return true;
+}
+
+void Document::closePaged() {
+    if (!paged) return;
+    delete paged;
+    paged = nullptr;
+    resetPatches();
+}
+
+// Drops every patch and sizes the tables for the file's pages
+void Document::resetPatches() {
+    for (int i = 0; i < patchSlots; i++) delete[] patches[i];
+    delete[] patches;
+    delete[] patchLengths;
+    delete[] lineDeltas;
+    patches = nullptr;
+    patchLengths = lineDeltas = nullptr;
+    patchSlots = patchCount = 0;
+    if (!paged) return;
+    patchSlots = paged->pageCount() + 1;
+    patches = new char*[patchSlots];
+    patchLengths = new int[patchSlots];
+    lineDeltas = new int[patchSlots];
+    for (int i = 0; i < patchSlots; i++) {
+        patches[i] = nullptr;
+        patchLengths[i] = lineDeltas[i] = 0;
+    }
+}
+
+int Document::getPageCount() const {
+    return paged ? std::max(paged->pageCount(), 1) : 1;
+}
+
+// Fills the buffer with a page, from its patch if it has one; the caller
+// resets the history
+void Document::loadPage(int index) {
+    std::lock_guard<std::mutex> guard(textLock);
+    page = index;
+    buffer->clear();
+    if (patches[index]) {
+        buffer->insert(patches[index], patchLengths[index]);
+        pageNewlines = buffer->lineCount() - 1 - lineDeltas[index];
+    } else {
+        long long start = paged->pageStart(index);
+        int len = (int)(paged->pageStart(index + 1) - start);
+        char* text = new char[len > 0 ? len : 1];
+        if (!paged->read(start, len, text)) len = 0;
+        buffer->insert(text, len);
+        delete[] text;
+        pageNewlines = buffer->lineCount() - 1;
+    }
+    buffer->moveCursorTo(0);
+}
+
+// Keeps the current page's text as its patch if it was edited
+void Document::keepPage() {
+    if (version == savedVersion) return;
+    int len = buffer->getLength();
+    char* text = new char[len > 0 ? len : 1];
+    buffer->read(0, len, text);
+    if (patches[page]) delete[] patches[page];
+    else patchCount++;
+    patches[page] = text;
+    patchLengths[page] = len;
+    lineDeltas[page] = buffer->lineCount() - 1 - pageNewlines;
+}
+
+bool Document::gotoPage(int index) {
+    if (!paged || index < 0 || index >= getPageCount()) return false;
+    keepPage();
+    loadPage(index);
+    resetHistory();
+    return true;
+}
+
+bool Document::turnPage(int delta) {
+    if (!paged || delta == 0) return false;
+    int step = delta > 0 ? 1 : -1;
+    int target = page + delta;
+    while (target >= 0 && target < getPageCount() && !patches[target] &&
+           paged->pageStart(target) == paged->pageStart(target + 1)) target += step;
+    if (!gotoPage(target)) return false;
+    // Going back lands on the last line, as if scrolled up into it
+    if (delta < 0) setCursor(buffer->offsetOfLine(std::max(buffer->lineCount() - 2, 0)));
+    return true;
+}
+
+long long Document::getLineBase() const {
+    if (!paged) return 0;
+    long long base = paged->lineOfOffset(paged->pageStart(page));
+    if (base < 0) return -1;
+    for (int i = 0; i < page; i++) base += lineDeltas[i];
+    return base;
+}
+
+double Document::getIndexProgress() const {
+    return paged ? paged->indexProgress() : 1.0;
+}
+
+static bool writeBytes(int fd, const char* data, long long len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        len -= written;
+    }
+    return true;
+}
+
+// Writes the file with every edited page spliced in: unedited runs of
+// pages are copied straight from the old file. newPageStart is where the
+// current page begins in what was written.
+bool Document::writePaged(int fd, long long& newPageStart) {
+    long long from = 0;     // old-file offset copied up to
+    long long written = 0;
+    for (int i = 0; i < getPageCount(); i++) {
+        if (i != page && !patches[i]) continue;
+        long long start = paged->pageStart(i);
+        if (!paged->copyTo(fd, from, start)) return false;
+        written += start - from;
+        if (i == page) {
+            newPageStart = written;
+            if (!writeBuffer(fd, buffer)) return false;
+            written += buffer->getLength();
+        } else {
+            if (!writeBytes(fd, patches[i], patchLengths[i])) return false;
+            written += patchLengths[i];
+        }
+        from = paged->pageStart(i + 1);
+    }
+    return paged->copyTo(fd, from, paged->getSize());
+}
+
+// --- Reload ---
+// Reads up to len bytes at offset, retrying short reads; returns how many
+// were read
+static long long readAt(int fd, char* out, long long len, long long offset) {
+    long long done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, out + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    return done;
+}
+
+void Document::noteDiskState() {
+    diskSize = -1;
+    diskTailLen = 0;
+    if (!filePath || paged) return;
+    int fd = open(filePath, O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0) noteDiskState(fd, st);
+    close(fd);
+}
+
+// Remembers the file as st describes it, with its last bytes; st is what
+// the caller read the file by, so text appended since then is seen later
+void Document::noteDiskState(int fd, const struct stat& st) {
+    diskSize = st.st_size;
+    diskMtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    diskInode = st.st_ino;
+    int tail = (int)std::min((long long)sizeof(diskTail), diskSize);
+    diskTailLen = (int)readAt(fd, diskTail, tail, diskSize - tail);
+    if (diskTailLen != tail) diskSize = -1;
+}
+
+// The same file grown, with the bytes that used to end it still in place
+bool Document::appendedTo(int fd, const struct stat& st) const {
+    char tail[sizeof(diskTail)];
+    return diskSize >= 0 && (unsigned long long)st.st_ino == diskInode && st.st_size > diskSize &&
+           readAt(fd, tail, diskTailLen, diskSize - diskTailLen) == diskTailLen &&
+           memcmp(tail, diskTail, diskTailLen) == 0;
+}
+
+// Whether st is the file the buffer reads its text from, rewritten in place
+// since the document last saw it other than by an append; the buffer's
+// text is no longer what was loaded then
+bool Document::mappingRewritten(int fd, const struct stat& st) const {
+    const MappedFile* mapping = buffer->fileMapping();
+    if (!mapping || !mapping->changedInPlace(st)) return false;
+    long long mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    if (st.st_size == diskSize && mtime == diskMtime && (unsigned long long)st.st_ino == diskInode) return false;
+    return !appendedTo(fd, st);
+}
+
+Document::Reload Document::reloadFromDisk() {
+    if (!filePath || paged) return RELOAD_NONE;
+    // Missing between a writer's unlink and its rename; the next event finds it
+    int fd = open(filePath, O_RDONLY);
+    if (fd < 0) return RELOAD_NONE;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return RELOAD_FAILED;
+    }
+    long long mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    if (st.st_size == diskSize && mtime == diskMtime && (unsigned long long)st.st_ino == diskInode) {
+        close(fd);
+        return RELOAD_NONE;
+    }
+
+    bool appended = appendedTo(fd, st);
+    const MappedFile* mapping = buffer->fileMapping();
+    if (!appended && mapping && mapping->changedInPlace(st)) {
+        // The old text went with the rewrite; nothing to diff against
+        close(fd);
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s", filePath);
+        int cursor = cursorPos;
+        if (!loadFromFile(path)) return RELOAD_FAILED;
+        setCursor(std::min(cursor, buffer->getLength()));
+        return RELOAD_REPLACED;
+    }
+    Reload result;
+    if (appended) {
+        result = appendFromDisk(fd, st.st_size) ? RELOAD_APPENDED : RELOAD_FAILED;
+    } else {
+        int hunks = diffFromDisk(fd, st.st_size);
+        result = hunks < 0 ? RELOAD_FAILED : hunks > 0 ? RELOAD_REWRITTEN : RELOAD_NONE;
+    }
+    if (result != RELOAD_FAILED) noteDiskState(fd, st);
+    close(fd);
+    if (result == RELOAD_FAILED || !journal) return result;
+
+    // The journal's edits were against the old file. Unsaved edits survive
+    // only an append, which leaves them where they were.
+    if (!isModified()) {
+        discardJournal();
+        startJournal(false);
+    } else {
+        JournalBase base = { st.st_size, (long long)st.st_mtim.tv_sec, (long long)st.st_mtim.tv_nsec };
+        journal->rebase(base);
+    }
+    return result;
+}
+
+// Adds [diskSize, size) of the file at the end of the buffer. It is not
+// journaled either, since the file already has it.
+bool Document::appendFromDisk(int fd, long long size) {
+    long long added = size - diskSize;
+    if (buffer->getLength() + added > 0x7ffffff0LL) return false;
+    int len = (int)added;
+    char* text = new char[len];
+    if (readAt(fd, text, len, diskSize) != len) {
+        delete[] text;
+        return false;
+    }
+
+    int end = buffer->getLength();
+    bool follow = cursorPos == end && caretCount == 0 && !hasSelection();
+    bool saved = version == savedVersion;
+    Journal* logging = journal;
+    journal = nullptr;
+    changes.appendSaved(text, len);
+    replaceText(end, end, text, len);
+    journal = logging;
+    delete[] text;
+    if (saved) savedVersion = version;
+    if (follow) cursorPos = buffer->getLength();
+    // Redo records may have been at the old end
+    redoStack.clear();
+    redoBytes = 0;
+    coalescing = false;
+    return true;
+}
+
+// Makes the buffer match the file by replacing only the lines that differ,
+// last hunk first so earlier offsets stay put. The hunks' records are
+// joined into one undo step. Returns the number of hunks, or -1.
+int Document::diffFromDisk(int fd, long long size) {
+    if (size > 0x7ffffff0LL) return -1;
+    int newLen = (int)size;
+    char* text = new char[newLen > 0 ? newLen : 1];
+    if (readAt(fd, text, newLen, 0) != newLen) {
+        delete[] text;
+        return -1;
+    }
+
+    int oldLines = buffer->lineCount();
+    unsigned long long* oldHashes = new unsigned long long[oldLines];
+    ChangeTracker::hashLines(buffer, 0, oldLines, oldHashes);
+    int newLines = 1;
+    for (const char* p = text; (p = (const char*)memchr(p, '\n', text + newLen - p)) != nullptr; p++) newLines++;
+    int* newStarts = new int[newLines + 1];
+    unsigned long long* newHashes = new unsigned long long[newLines];
+    newStarts[0] = 0;
+    for (int i = 0, start = 0; i < newLines; i++) {
+        const char* newline = (const char*)memchr(text + start, '\n', newLen - start);
+        int end = newline ? (int)(newline - text) + 1 : newLen;
+        newHashes[i] = LineDiff::hash(text + start, end - start);
+        newStarts[i + 1] = start = end;
+    }
+
+    LineDiff diff;
+    int hunks = diff.run(oldHashes, oldLines, newHashes, newLines);
+    if (hunks > 0) {
+        clearCarets();
+        clearSelection();
+        // Where the cursor lands: shifted by the hunks before it, and kept
+        // at the same offset into a hunk it was inside
+        int cursorAfter = -1;
+        int shift = 0;
+        for (int i = 0; i < hunks; i++) {
+            const DiffHunk& hunk = diff.getHunk(i);
+            int start = buffer->offsetOfLine(hunk.oldStart);
+            int end = hunk.oldStart + hunk.oldCount < oldLines ? buffer->offsetOfLine(hunk.oldStart + hunk.oldCount)
+                                                               : buffer->getLength();
+            int inserted = newStarts[hunk.newStart + hunk.newCount] - newStarts[hunk.newStart];
+            if (cursorPos < end) {
+                cursorAfter = cursorPos < start ? cursorPos + shift : start + shift + std::min(cursorPos - start, inserted);
+                break;
+            }
+            shift += inserted - (end - start);
+        }
+        if (cursorAfter < 0) cursorAfter = cursorPos + shift;
+
+        Journal* logging = journal;
+        journal = nullptr;
+        redoStack.clear();
+        redoBytes = 0;
+        for (int i = hunks - 1; i >= 0; i--) {
+            const DiffHunk& hunk = diff.getHunk(i);
+            int start = buffer->offsetOfLine(hunk.oldStart);
+            int end = hunk.oldStart + hunk.oldCount < oldLines ? buffer->offsetOfLine(hunk.oldStart + hunk.oldCount)
+                                                               : buffer->getLength();
+            int from = newStarts[hunk.newStart];
+            int inserted = newStarts[hunk.newStart + hunk.newCount] - from;
+            char* deleted = reserveScratch(end - start);
+            buffer->read(start, end - start, deleted);
+            EditorState& state = undoStack.emplace(start, deleted, end - start, text + from, inserted, cursorPos, -1, -1);
+            state.cursorAfter = cursorAfter;
+            state.joined = i < hunks - 1;
+            undoBytes += state.bytes();
+            replaceText(start, end, text + from, inserted);
+        }
+        journal = logging;
+        trimHistory();
+        cursorPos = std::min(cursorAfter, buffer->getLength());
+        coalescing = false;
+    }
+    savedVersion = version;
+    changes.setSavedLines(newHashes, newLines);
+    delete[] newHashes;
+    delete[] newStarts;
+    delete[] oldHashes;
+    delete[] text;
+    return hunks;
+}
+
+// --- Persistent Undo ---
+unsigned long long Document::hashText() const {
+    ContentHash hash;
+    int len = buffer->getLength();
+    for (int pos = 0; pos < len; ) {
+        const char* data;
+        int n = buffer->chunkAt(pos, &data);
+        hash.update(data, n);
+        pos += n;
+    }
+    return hash.value();
+}
+
+// Reads only the saved history's header and index. A file that was
+// changed outside the editor is hashed when undo first reaches the saved
+// records, not now.
+void Document::openUndoFile() {
+    char path[PATH_MAX + 32];
+    UndoFile::pathFor(filePath, path, sizeof(path));
+    UndoFile* file = new UndoFile();
+    if (!file->open(path, filePath)) {
+        delete file;
+        return;
+    }
+    undoFile = file;
+    persistedCount = file->recordCount();
+    persistedChecked = file->fileUnchanged();
+}
+
+// Writes the saved history plus the undo stack next to the file, oldest
+// saved records dropped first to stay within the history budget. Redo
+// records are not kept.
+void Document::saveUndoFile() {
+    char path[PATH_MAX + 32];
+    UndoFile::pathFor(filePath, path, sizeof(path));
+    if (undoStack.isEmpty() && persistedCount == 0) {
+        unlink(path);
+        dropPersistedUndo();
+        return;
+    }
+
+    // Saved records that were never matched against the text can only be
+    // carried over while the text is still the one they end at
+    unsigned long long hash = hashText();
+    if (persistedCount > 0 && !persistedChecked) {
+        if (!undoStack.isEmpty() || hash != undoFile->contentHash()) dropPersistedUndo();
+    }
+
+    int first = 0;
+    while (first < persistedCount &&
+           undoFile->recordBytes(first, persistedCount - first) + undoBytes > historyBudget) first++;
+    if (!UndoFile::write(path, filePath, hash, undoFile, first, persistedCount - first, undoStack)) return;
+
+    // The new file starts with the saved records that were kept
+    int kept = persistedCount - first;
+    dropPersistedUndo();
+    UndoFile* file = new UndoFile();
+    if (!file->open(path, filePath)) {
+        delete file;
+        return;
+    }
+    undoFile = file;
+    persistedCount = kept;
+    persistedChecked = true;
+}
+
+// Moves the newest saved record onto the undo stack. The first time, the
+// text must hash to what the history was saved against: the records only
+// apply to exactly that text.
+bool Document::loadPersistedUndo() {
+    if (persistedCount == 0) return false;
+    if (!persistedChecked) {
+        if (hashText() != undoFile->contentHash()) {
+            dropPersistedUndo();
+            return false;
+        }
+        persistedChecked = true;
+    }
+    EditorState state;
+    if (!undoFile->read(persistedCount - 1, state)) {
+        dropPersistedUndo();
+        return false;
+    }
+    persistedCount--;
+    undoBytes += state.bytes();
+    undoStack.push(std::move(state));
+    return true;
+}
+
+void Document::dropPersistedUndo() {
+    delete undoFile;
+    undoFile = nullptr;
+    persistedCount = 0;
+    persistedChecked = false;
+}
+
+void Document::setFilePath(const char* path) {
+    delete[] filePath;
+    filePath = nullptr;
+    if (path) {
+        filePath = new char[strlen(path) + 1];
+        strcpy(filePath, path);
+    }
+}
+
+// --- Crash Recovery ---
+void Document::setJournaling(bool on) {
+    if (on && !journal && !paged) {
+        journal = new Journal();
+        startJournal(true);
+    } else if (!on && journal) {
+        journal->close(!isModified());
+        delete journal;
+        journal = nullptr;
+    }
+}
+
+void Document::discardRecovery() {
+    if (!journal) return;
+    discardJournal();
+    delete journal;
+    journal = nullptr;
+}
+
+// Opens the journal for the current file, first replaying what a crashed
+// session left in it when recover is set
+void Document::startJournal(bool recover) {
+    char path[PATH_MAX + 32];
+    Journal::pathFor(filePath, path, sizeof(path));
+    JournalBase base = Journal::baseOf(filePath);
+    long long validLength = 0;
+    recoveredEdits = 0;
+    if (recover) recoveredEdits = Journal::replay(path, base, replayEdit, this, validLength);
+    // Replayed edits aren't undoable, so saved history no longer lines up
+    if (recoveredEdits > 0) dropPersistedUndo();
+    journal->open(path, base, validLength);
+}
+
+// Closes the current journal and deletes it; its edits are saved or dropped
+void Document::discardJournal() {
+    journal->close(true);
+}
+
+// Replayed edits are applied directly: they are not undoable, and the
+// document counts as modified afterwards
+void Document::replayEdit(void* data, int pos, int deletedLen, const char* text, int len) {
+    Document* doc = (Document*)data;
+    int length = doc->buffer->getLength();
+    if (pos > length) pos = length;
+    if (deletedLen > length - pos) deletedLen = length - pos;
+    doc->replaceText(pos, pos + deletedLen, text, len);
+    doc->cursorPos = pos + len;
+}
@@ -0,0 +1,298 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include "TextBuffer.h"
+#include "Stack.h"
+#include "EditorState.h"
+#include "Search.h"
+#include "Highlighter.h"
+#include "ColumnIndex.h"
+#include "WrapLayout.h"
+#include "ChangeTracker.h"
+#include "BracketIndex.h"
+#include <mutex>
+
+class Journal;
+class UndoFile;
+class PagedFile;
+struct stat;
+
+// Editing model behind the widget: text backend, cursor, selection and
+// undo history, with no dependency on FLTK. TextEditor forwards input to
+// it and asks which lines changed when it repaints. Undo history is held
+// to a memory budget; past it the oldest records are forgotten first.
+class Document {
+private:
+    TextBuffer* buffer;
+    // Taken around every change to the buffer's text, so another thread
+    // (the regex worker taking its snapshot) can read it meanwhile
+    std::mutex textLock;
+    int cursorPos;
+    int selectionStart;
+    int selectionEnd;
+    bool selecting;
+    bool coalescing;   // next typed edit may merge into the top undo record
+
+    // Cursors besides the main one, in offset order, each with its own
+    // selection. Typing, deleting and pasting act on all of them at once.
+    struct Caret {
+        int pos;
+        int selStart;
+        int selEnd;
+        bool selecting;
+    };
+    Caret* carets;
+    int caretCount;
+    int caretCapacity;
+
+    // Scratch space kept between edits, so a keystroke allocates nothing:
+    // the text an edit deletes, and the ranges of a multi-cursor edit
+    struct CaretRange {
+        int start;
+        int end;
+        bool main;
+    };
+    char* scratch;
+    int scratchCapacity;
+    CaretRange* ranges;
+    int rangeCapacity;
+
+    Stack<EditorState> undoStack;
+    Stack<EditorState> redoStack;
+    long long undoBytes;      // memory held by each stack's records
+    long long redoBytes;
+    long long historyBudget;
+
+    // History saved by earlier sessions. Its newest persistedCount records
+    // sit below the undo stack and are read one at a time as undo reaches
+    // them; persistedChecked is set once the text has been matched against
+    // the hash the history was saved with.
+    UndoFile* undoFile;
+    int persistedCount;
+    bool persistedChecked;
+
+    Searcher searcher;
+    Highlighter highlighter;
+    ColumnIndex columns;
+    WrapLayout wrap;
+    ChangeTracker changes;   // lines that differ from the file as saved
+    BracketIndex brackets;
+
+    // Lines touched since the view last asked
+    int changedFrom;
+    int changedTo;
+    int version;       // bumped on every change to the text
+    int savedVersion;  // version last loaded or saved
+
+    char* filePath;    // nullptr while untitled
+    Journal* journal;  // crash-recovery log, when journaling is on
+    int recoveredEdits;
+
+    // The file as last read or written, to tell other processes' changes
+    // from this document's own saves, and appends from rewrites
+    long long diskSize;           // -1 when unknown
+    long long diskMtime;          // nanoseconds
+    unsigned long long diskInode;
+    char diskTail[64];            // its last bytes
+    int diskTailLen;
+
+    // Paged mode, for files over pagedThreshold: the buffer holds one page
+    // of the file at a time. A page that was edited and then left is kept
+    // as a patch until the next save writes it out. The journal and the
+    // persistent undo history are off, since their offsets are per page.
+    PagedFile* paged;
+    long long pagedThreshold;
+    int page;
+    int pageNewlines;     // newlines the current page has in the file
+    char** patches;       // text of each edited page, nullptr when unedited
+    int* patchLengths;
+    int* lineDeltas;      // newlines each patch adds over the file's page
+    int patchSlots;
+    int patchCount;
+
+    void replaceText(int start, int end, const char* text, int len);
+    void moveRows(int delta, bool extend);
+
+    enum Step { STEP_LEFT, STEP_RIGHT, STEP_UP, STEP_DOWN,
+                STEP_WORD, STEP_WORD_BACK, STEP_WORD_END, STEP_LINE_START, STEP_LINE_END };
+    enum CaretEdit { EDIT_INSERT, EDIT_BACKSPACE, EDIT_DELETE };
+    void step(Step direction, bool extend);
+    int motionTarget(Step direction, int pos);
+    void moveAll(Step direction, bool extend);
+    void pushMainCaret();
+    void sortCarets();
+    void editCarets(CaretEdit kind, const char* text, int len, bool mergeable);
+    void markChanged(int from, int to);
+    char* reserveScratch(int len);
+    void resetHistory();
+    void trimHistory();
+    unsigned long long hashText() const;
+    void openUndoFile();
+    void saveUndoFile();
+    bool loadPersistedUndo();
+    void dropPersistedUndo();
+    void setFilePath(const char* path);
+    void startJournal(bool recover);
+    void discardJournal();
+    static void replayEdit(void* data, int pos, int deletedLen, const char* text, int len);
+    bool openPaged(const char* filename);
+    void closePaged();
+    void resetPatches();
+    void loadPage(int index);
+    void keepPage();
+    bool writePaged(int fd, long long& newPageStart);
+    void noteDiskState();
+    void noteDiskState(int fd, const struct stat& st);
+    bool appendedTo(int fd, const struct stat& st) const;
+    bool mappingRewritten(int fd, const struct stat& st) const;
+    bool appendFromDisk(int fd, long long size);
+    int diffFromDisk(int fd, long long size);
+
+public:
+    Document(const char* backend = "gap");
+    ~Document();
+
+    TextBuffer* getBuffer() const { return buffer; }
+    std::mutex& getTextLock() { return textLock; }
+    int getCursor() const { return cursorPos; }
+    void setCursor(int pos);
+
+    // Editing
+    void applyEdit(int start, int end, const char* text, int len, bool mergeable);
+    void typeText(const char* text, int len, bool mergeable);
+    void backspace();
+    void deleteForward();
+    void deleteSelection();
+    void breakUndoGroup() { coalescing = false; }
+    bool undo();
+    bool redo();
+    int undoDepth() const { return undoStack.size() + persistedCount; }
+    int redoDepth() const { return redoStack.size(); }
+
+    // Undo history memory; the most recent edit stays undoable even when it
+    // alone is over the budget
+    static const long long DEFAULT_HISTORY_BUDGET = 64LL << 20;
+    void setHistoryBudget(long long bytes);
+    long long getHistoryBudget() const { return historyBudget; }
+    long long getHistoryBytes() const { return undoBytes + redoBytes; }
+
+    // Cursor movement, by UTF-8 character; up and down move a screen row
+    // (a wrapped line has several) and keep the column within the row.
+    // extend grows the selection instead of clearing it.
+    void moveLeft(bool extend);
+    void moveRight(bool extend);
+    void moveUp(bool extend);
+    void moveDown(bool extend);
+
+    // Vim motions. w, b and e stop at the start or end of each run of word
+    // characters and each run of other non-blank ones, and w and b also
+    // at empty lines; 0 and $ go to the first and last character of the
+    // line. Every cursor moves.
+    void moveWordStart(bool extend);
+    void moveWordBack(bool extend);
+    void moveWordEnd(bool extend);
+    void moveLineStart(bool extend);
+    void moveLineEnd(bool extend);
+    // To the first non-blank of line, clamped to the first and last (gg,
+    // G); one line index lookup however far it goes
+    void gotoLine(int line);
+    // To the partner of the bracket under the cursor, or of the first one
+    // after it on the line (%); false when there is none
+    bool matchBracket();
+
+    // Text objects: select the word or run of blanks under the cursor
+    // (iw), or the text inside the innermost pair of brackets c around it,
+    // either side of the pair naming it (i( and i)); false when there is
+    // nothing to select
+    bool selectInnerWord();
+    bool selectInnerBrackets(char c);
+
+    // Extra cursors. Adding one keeps the main cursor where it was as an
+    // extra and puts the main cursor at the new spot.
+    void addCaret(int pos);
+    // Selects the word under the cursor, or when there is a selection adds
+    // a cursor selecting its next occurrence; false when there is none
+    bool addCaretAtNextMatch();
+    // New main cursor delta screen rows from the main one (a column of cursors)
+    void addCaretRow(int delta);
+    void clearCarets();
+    int getCaretCount() const { return caretCount; }
+    // Extra cursor i in offset order; lo and hi are -1 without a selection
+    void getCaret(int i, int& pos, int& lo, int& hi) const;
+    // First extra cursor at or after pos
+    int caretFrom(int pos) const;
+
+    // Selection
+    void startSelection();
+    void updateSelection();
+    void clearSelection();
+    void setSelection(int anchor, int head);
+    void selectAll();
+    void endMouseSelection() { selecting = false; }
+    bool isSelecting() const { return selecting; }
+    int getSelectionAnchor() const { return selectionStart; }
+    bool hasSelection() const;
+    void getSelection(int& lo, int& hi) const;
+    char* copySelection(int& len) const;   // caller delete[]s
+
+    // Search; the pattern stays set so the view can highlight matches
+    void setSearchPattern(const char* text, int len) { searcher.setPattern(text, len); }
+    const Searcher& getSearcher() const { return searcher; }
+    bool findNext(bool forward, bool& wrapped);
+    int replaceAll(const char* text, int len);
+
+    Highlighter* getHighlighter() { return &highlighter; }
+    ColumnIndex* getColumns() { return &columns; }
+    // The view sets the wrap width
+    WrapLayout* getWrap() { return &wrap; }
+    // Gutter marks against the saved file; the view sets its notify hook
+    ChangeTracker* getChanges() { return &changes; }
+
+    // File Operations
+    bool loadFromFile(const char* filename);
+    bool saveToFile(const char* filename);
+    void newFile();
+    const char* getFilePath() const { return filePath; }
+    bool isModified() const { return version != savedVersion || patchCount > 0; }
+
+    // Picks up a change another process made to the file. Text appended
+    // past the old end is added as it is, outside the undo history, and a
+    // cursor at the end follows it (tail -f). Anything else is diffed by
+    // line against the buffer and applied as one undo step, so unsaved
+    // edits it replaces come back with undo. Paged files aren't reloaded.
+    // A buffer that still reads its text from the file (a large one, see
+    // MappedFile) has lost that text when the file is rewritten in place;
+    // it is loaded again from scratch, history and unsaved edits included.
+    enum Reload { RELOAD_NONE, RELOAD_APPENDED, RELOAD_REWRITTEN, RELOAD_REPLACED, RELOAD_FAILED };
+    Reload reloadFromDisk();
+
+    // Files larger than this open in paged mode; past 2 GB every file does,
+    // since buffer offsets are int
+    static const long long DEFAULT_PAGED_THRESHOLD = 0x7ffffff0LL;
+    void setPagedThreshold(long long bytes) { pagedThreshold = bytes; }
+    bool isPaged() const { return paged != nullptr; }
+    int getPage() const { return page; }
+    int getPageCount() const;
+    // Moves delta pages on, past any a long line left empty, keeping the
+    // edits made to this one; false at the first and last page
+    bool turnPage(int delta);
+    bool gotoPage(int index);
+    // Line number in the file of the page's first line; -1 until the
+    // background line count gets there
+    long long getLineBase() const;
+    double getIndexProgress() const;
+
+    // Journals every edit so unsaved work survives a crash. Turning it on
+    // first replays any journal left behind for the current file.
+    void setJournaling(bool on);
+    // Turns journaling off and deletes the journal, unsaved edits included
+    void discardRecovery();
+    int getRecoveredEdits() const { return recoveredEdits; }
+
+    // Returns and resets the line range changed since the last call;
+    // from is -1 when nothing changed
+    void takeChangedLines(int& from, int& to);
+    int getVersion() const { return version; }
+};
+
+#endif
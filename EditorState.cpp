@@ -1,25 +1,128 @@
 #include "EditorState.h"
+#include <utility>
 
-EditorState::EditorState() : text(nullptr), cursorPos(0), selStart(-1), selEnd(-1) {}
+// Points data at local when len fits there, else at a new heap array
+static void store(char*& data, int& cap, char* local, const char* src, int len) {
+    if (len <= EditorState::INLINE_SIZE) {
+        data = local;
+        cap = EditorState::INLINE_SIZE;
+    } else {
+        data = new char[len];
+        cap = len;
+    }
+    if (len > 0) memcpy(data, src, len);
+}
+
+EditorState::EditorState()
+    : pos(0), deleted(localDeleted), deletedLen(0), deletedCap(INLINE_SIZE), inserted(localInserted),
+      insertedLen(0), insertedCap(INLINE_SIZE), cursorBefore(0), cursorAfter(0), selStart(-1), selEnd(-1),
+      joined(false) {}
 
-EditorState::EditorState(const char* t, int cp, int ss, int se) 
-    : cursorPos(cp), selStart(ss), selEnd(se) {
-    int len = strlen(t);
-    text = new char[len + 1];
-    strcpy(text, t);
+EditorState::EditorState(int p, const char* del, int delLen, const char* ins, int insLen,
+                         int cb, int ss, int se)
+    : pos(p), deletedLen(delLen), insertedLen(insLen),
+      cursorBefore(cb), cursorAfter(p + insLen), selStart(ss), selEnd(se), joined(false) {
+    store(deleted, deletedCap, localDeleted, del, delLen);
+    store(inserted, insertedCap, localInserted, ins, insLen);
 }
 
 EditorState::~EditorState() {
-    if (text) delete[] text;
+    if (deleted != localDeleted) delete[] deleted;
+    if (inserted != localInserted) delete[] inserted;
 }
 
 EditorState::EditorState(const EditorState& other) 
-    : cursorPos(other.cursorPos), selStart(other.selStart), selEnd(other.selEnd) {
-    if (other.text) {
-        int len = strlen(other.text);
-        text = new char[len + 1];
-        strcpy(text, other.text);
+    : pos(other.pos), deletedLen(other.deletedLen), insertedLen(other.insertedLen),
+      cursorBefore(other.cursorBefore), cursorAfter(other.cursorAfter), selStart(other.selStart),
+      selEnd(other.selEnd), joined(other.joined) {
+    store(deleted, deletedCap, localDeleted, other.deleted, deletedLen);
+    store(inserted, insertedCap, localInserted, other.inserted, insertedLen);
+}
+
+EditorState& EditorState::operator=(const EditorState& other) {
+    if (this == &other) return *this;
+    EditorState copy(other);
+    return *this = std::move(copy);
+}
+
+EditorState::EditorState(EditorState&& other)
+    : deleted(localDeleted), inserted(localInserted) {
+    take(other);
+}
+
+EditorState& EditorState::operator=(EditorState&& other) {
+    if (this == &other) return *this;
+    if (deleted != localDeleted) delete[] deleted;
+    if (inserted != localInserted) delete[] inserted;
+    take(other);
+    return *this;
+}
+
+// Heap arrays are handed over; inline bytes are copied. other is left empty.
+void EditorState::take(EditorState& other) {
+    pos = other.pos;
+    deletedLen = other.deletedLen;
+    deletedCap = other.deletedCap;
+    insertedLen = other.insertedLen;
+    insertedCap = other.insertedCap;
+    cursorBefore = other.cursorBefore;
+    cursorAfter = other.cursorAfter;
+    selStart = other.selStart;
+    selEnd = other.selEnd;
+    joined = other.joined;
+    if (other.deleted == other.localDeleted) {
+        deleted = localDeleted;
+        memcpy(localDeleted, other.localDeleted, deletedLen);
     } else {
-        text = nullptr;
+        deleted = other.deleted;
     }
-}
\ No newline at end of file
+    if (other.inserted == other.localInserted) {
+        inserted = localInserted;
+        memcpy(localInserted, other.localInserted, insertedLen);
+    } else {
+        inserted = other.inserted;
+    }
+    other.deleted = other.localDeleted;
+    other.inserted = other.localInserted;
+    other.deletedLen = other.insertedLen = 0;
+    other.deletedCap = other.insertedCap = INLINE_SIZE;
+}
+
+// Grows data to hold needed bytes, at least doubling so a record that
+// keeps growing (typing on, backspacing back) reallocates rarely
+void EditorState::reserve(char*& data, int len, int& cap, char* local, int needed) {
+    if (needed <= cap) return;
+    int newCap = cap * 2;
+    if (newCap < needed) newCap = needed;
+    if (newCap < 64) newCap = 64;
+    char* grown = new char[newCap];
+    if (len > 0) memcpy(grown, data, len);
+    if (data != local) delete[] data;
+    data = grown;
+    cap = newCap;
+}
+
+void EditorState::appendInserted(const char* t, int n) {
+    reserve(inserted, insertedLen, insertedCap, localInserted, insertedLen + n);
+    memcpy(inserted + insertedLen, t, n);
+    insertedLen += n;
+}
+
+void EditorState::truncateInserted(int n) {
+    insertedLen -= n;
+    if (insertedLen < 0) insertedLen = 0;
+}
+
+void EditorState::prependDeleted(const char* t, int n) {
+    reserve(deleted, deletedLen, deletedCap, localDeleted, deletedLen + n);
+    memmove(deleted + n, deleted, deletedLen);
+    memcpy(deleted, t, n);
+    deletedLen += n;
+    pos -= n;
+}
+
+void EditorState::appendDeleted(const char* t, int n) {
+    reserve(deleted, deletedLen, deletedCap, localDeleted, deletedLen + n);
+    memcpy(deleted + deletedLen, t, n);
+    deletedLen += n;
+}
@@ -3,16 +3,55 @@
 
 #include <cstring>
 
+// One undoable edit: the text at [pos, pos + deletedLen) was replaced by
+// the inserted text. Undo applies the inverse replacement, so only the
+// changed bytes are stored rather than a snapshot of the whole document.
+// Up to INLINE_SIZE bytes of each side are kept in the record itself, so
+// a keystroke's record lives in its stack slot with no heap allocation.
 struct EditorState {
-    char* text;
-    int cursorPos;
+    static const int INLINE_SIZE = 16;
+
+    int pos;
+    char* deleted;     // localDeleted, or a heap array once it outgrows that
+    int deletedLen;
+    int deletedCap;
+    char* inserted;
+    int insertedLen;
+    int insertedCap;
+    int cursorBefore;
+    int cursorAfter;
     int selStart;
     int selEnd;
-    
+    bool joined;       // undone and redone together with the record below
+                       // it: one edit made at several cursors
+    char localDeleted[INLINE_SIZE];
+    char localInserted[INLINE_SIZE];
+
     EditorState();
-    EditorState(const char* t, int cp, int ss, int se);
+    EditorState(int p, const char* del, int delLen, const char* ins, int insLen,
+                int cb, int ss, int se);
     ~EditorState();
     EditorState(const EditorState& other);
+    EditorState& operator=(const EditorState& other);
+    // Moves hand over the byte arrays and leave other empty
+    EditorState(EditorState&& other);
+    EditorState& operator=(EditorState&& other);
+
+    // Memory held by the record, counted against the undo budget
+    long long bytes() const {
+        return sizeof(EditorState) + (deleted != localDeleted ? deletedCap : 0) +
+               (inserted != localInserted ? insertedCap : 0);
+    }
+
+    // Coalescing helpers used to merge consecutive typing into one record
+    void appendInserted(const char* t, int n);
+    void truncateInserted(int n);
+    void prependDeleted(const char* t, int n);
+    void appendDeleted(const char* t, int n);
+
+private:
+    void take(EditorState& other);
+    static void reserve(char*& data, int len, int& cap, char* local, int needed);
 };
 
-#endif
\ No newline at end of file
+#endif
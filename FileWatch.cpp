@@ -0,0 +1,103 @@
+#include "FileWatch.h"
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+FileWatch::FileWatch()
+    : fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)), entries(nullptr), count(0), capacity(0) {}
+
+FileWatch::~FileWatch() {
+    clear();
+    delete[] entries;
+    if (fd >= 0) close(fd);
+}
+
+void FileWatch::add(const char* path) {
+    if (fd < 0 || !path) return;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(entries[i].path, path) == 0) return;
+    }
+
+    // Watch the directory the file really lives in, past any symlink
+    char resolved[PATH_MAX];
+    if (!realpath(path, resolved)) {
+        if (strlen(path) >= sizeof(resolved)) return;
+        strcpy(resolved, path);
+    }
+    char* slash = strrchr(resolved, '/');
+    const char* name = slash ? slash + 1 : resolved;
+    char dir[PATH_MAX];
+    if (!slash) strcpy(dir, ".");
+    else if (slash == resolved) strcpy(dir, "/");
+    else {
+        memcpy(dir, resolved, slash - resolved);
+        dir[slash - resolved] = '\0';
+    }
+    int wd = inotify_add_watch(fd, dir, IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd < 0) return;
+
+    if (count == capacity) {
+        int newCapacity = capacity ? capacity * 2 : 8;
+        Entry* grown = new Entry[newCapacity];
+        if (count > 0) memcpy(grown, entries, count * sizeof(Entry));
+        delete[] entries;
+        entries = grown;
+        capacity = newCapacity;
+    }
+    Entry& entry = entries[count++];
+    entry.path = new char[strlen(path) + 1];
+    strcpy(entry.path, path);
+    entry.name = new char[strlen(name) + 1];
+    strcpy(entry.name, name);
+    entry.wd = wd;
+    entry.changed = false;
+}
+
+// Files in one directory share its watch, which is removed once
+void FileWatch::clear() {
+    for (int i = 0; i < count; i++) {
+        bool shared = false;
+        for (int j = 0; j < i && !shared; j++) shared = entries[j].wd == entries[i].wd;
+        if (!shared) inotify_rm_watch(fd, entries[i].wd);
+        delete[] entries[i].path;
+        delete[] entries[i].name;
+    }
+    count = 0;
+}
+
+bool FileWatch::readEvents() {
+    if (fd < 0) return false;
+    bool any = false;
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true) {
+        ssize_t n = read(fd, events, sizeof(events));
+        if (n <= 0) break;
+        for (char* p = events; p < events + n; ) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + event->len;
+            // Events were lost; any file may have changed
+            bool overflow = (event->mask & IN_Q_OVERFLOW) != 0;
+            for (int i = 0; i < count; i++) {
+                if (overflow || (entries[i].wd == event->wd && event->len > 0 &&
+                                 strcmp(entries[i].name, event->name) == 0)) {
+                    entries[i].changed = true;
+                    any = true;
+                }
+            }
+        }
+    }
+    return any;
+}
+
+bool FileWatch::takeChanged(const char* path) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(entries[i].path, path) == 0) {
+            bool changed = entries[i].changed;
+            entries[i].changed = false;
+            return changed;
+        }
+    }
+    return false;
+}
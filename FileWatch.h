@@ -0,0 +1,45 @@
+#ifndef FILEWATCH_H
+#define FILEWATCH_H
+
+// Notices when other processes change open files, through inotify. The
+// directory holding each file is watched rather than the file itself, so
+// a file replaced by renaming a new one over it (as most editors save,
+// and as Document::saveToFile does) is still seen. The caller polls
+// getFd() in its event loop, calls readEvents() when it is readable and
+// then asks takeChanged() for each of its files.
+class FileWatch {
+private:
+    struct Entry {
+        char* path;      // as the caller gave it
+        char* name;      // file name within the watched directory
+        int wd;
+        bool changed;
+    };
+
+    int fd;
+    Entry* entries;
+    int count;
+    int capacity;
+
+    FileWatch(const FileWatch&);
+    FileWatch& operator=(const FileWatch&);
+
+public:
+    FileWatch();
+    ~FileWatch();
+
+    // -1 when inotify isn't available
+    int getFd() const { return fd; }
+
+    // Starts watching path; watching it again does nothing
+    void add(const char* path);
+    // Stops watching every file
+    void clear();
+
+    // Reads the events waiting on getFd(); true if any was for a watched file
+    bool readEvents();
+    // Whether path changed since the last call for it
+    bool takeChanged(const char* path);
+};
+
+#endif
@@ -1,5 +1,9 @@
 #include "GapBuffer.h"
+#include "MappedFile.h"
+#include "Metrics.h"
+#include <climits>
 #include <cstring>
+#include <new>
 
 GapBuffer::GapBuffer(int initialCapacity) {
     capacity = initialCapacity;
@@ -14,20 +18,12 @@ GapBuffer::~GapBuffer() {
 
 void GapBuffer::resize(int newCapacity) {
     char* newBuffer = new char[newCapacity];
-    int gapSize = gapEnd - gapStart;
+    int tail = capacity - gapEnd;
     
-    // Copy pre-gap content
-    for (int i = 0; i < gapStart; i++) {
-        newBuffer[i] = buffer[i];
-    }
-    
-    // New gap position
-    int newGapEnd = newCapacity - (capacity - gapEnd);
-    
-    // Copy post-gap content
-    for (int i = gapEnd; i < capacity; i++) {
-        newBuffer[newGapEnd + (i - gapEnd)] = buffer[i];
-    }
+    // Copy pre-gap and post-gap content in one block each
+    memcpy(newBuffer, buffer, gapStart);
+    int newGapEnd = newCapacity - tail;
+    memcpy(newBuffer + newGapEnd, buffer + gapEnd, tail);
     
     delete[] buffer;
     buffer = newBuffer;
@@ -35,45 +31,104 @@ void GapBuffer::resize(int newCapacity) {
     gapEnd = newGapEnd;
 }
 
+// Room for required bytes plus slack to grow into, worked out in long long
+// and held to what an int offset can reach
+static int grownCapacity(long long required, long long slack) {
+    if (required > INT_MAX) throw std::bad_alloc();
+    long long capacity = required + slack;
+    return capacity > INT_MAX ? INT_MAX : (int)capacity;
+}
+
+// Grows once for the whole range instead of doubling per character
+void GapBuffer::reserveGap(int needed) {
+    if (gapEnd - gapStart >= needed) return;
+    long long required = (long long)getLength() + needed;
+    long long doubled = (long long)capacity * 2;
+    long long slack = required / 8;
+    if (doubled > required + slack) slack = doubled - required;
+    resize(grownCapacity(required, slack));
+}
+
 void GapBuffer::moveCursorTo(int pos) {
+    if (pos < 0) pos = 0;
+    if (pos > getLength()) pos = getLength();
     if (pos < gapStart) {
         // Move gap left
         int distance = gapStart - pos;
-        gapEnd -= distance;
+        if (Metrics::enabled) Metrics::gapMove.add(distance);
+        memmove(buffer + gapEnd - distance, buffer + pos, distance);
         gapStart = pos;
-        for (int i = 0; i < distance; i++) {
-            buffer[gapEnd + i] = buffer[gapStart + i];
-        }
+        gapEnd -= distance;
     } else if (pos > gapStart) {
         // Move gap right
         int distance = pos - gapStart;
-        for (int i = 0; i < distance; i++) {
-            buffer[gapStart + i] = buffer[gapEnd + i];
-        }
-        gapStart = pos;
+        if (Metrics::enabled) Metrics::gapMove.add(distance);
+        memmove(buffer + gapStart, buffer + gapEnd, distance);
+        gapStart += distance;
         gapEnd += distance;
     }
 }
 
 void GapBuffer::insert(char c) {
-    if (gapStart == gapEnd) {
-        resize(capacity * 2);
-    }
+    reserveGap(1);
+    lines.onInsert(gapStart, &c, 1);
     buffer[gapStart++] = c;
 }
 
+void GapBuffer::insert(const char* text, int len) {
+    if (len <= 0) return;
+    reserveGap(len);
+    lines.onInsert(gapStart, text, len);
+    memcpy(buffer + gapStart, text, len);
+    gapStart += len;
+}
+
 void GapBuffer::deleteLeft() {
     if (gapStart > 0) {
+        lines.onErase(gapStart - 1, 1);
         gapStart--;
     }
 }
 
 void GapBuffer::deleteRight() {
     if (gapEnd < capacity) {
+        lines.onErase(gapStart, 1);
         gapEnd++;
     }
 }
 
+void GapBuffer::erase(int pos, int len) {
+    if (pos < 0) pos = 0;
+    if (len > getLength() - pos) len = getLength() - pos;
+    moveCursorTo(pos);
+    if (len <= 0) return;
+    lines.onErase(pos, len);
+    gapEnd += len;
+}
+
+void GapBuffer::read(int pos, int len, char* out) const {
+    // Copy from the pre-gap half, then from the post-gap half
+    if (pos < gapStart) {
+        int n = gapStart - pos;
+        if (n > len) n = len;
+        memcpy(out, buffer + pos, n);
+        out += n;
+        pos += n;
+        len -= n;
+    }
+    if (len > 0) memcpy(out, buffer + gapEnd + (pos - gapStart), len);
+}
+
+int GapBuffer::chunkAt(int pos, const char** data) const {
+    if (pos < 0 || pos >= getLength()) return 0;
+    if (pos < gapStart) {
+        *data = buffer + pos;
+        return gapStart - pos;
+    }
+    *data = buffer + gapEnd + (pos - gapStart);
+    return getLength() - pos;
+}
+
 int GapBuffer::getCursorPosition() const {
     return gapStart;
 }
@@ -94,26 +149,28 @@ char GapBuffer::getCharAt(int pos) const {
 void GapBuffer::getText(char* dest, int maxLen) const {
     int len = getLength();
     if (len > maxLen - 1) len = maxLen - 1;
-    
-    int i = 0;
-    for (int pos = 0; pos < len; pos++) {
-        dest[i++] = getCharAt(pos);
-    }
-    dest[i] = '\0';
+    read(0, len, dest);
+    dest[len] = '\0';
 }
 
 void GapBuffer::clear() {
     gapStart = 0;
     gapEnd = capacity;
+    lines.clear();
 }
 
 void GapBuffer::loadFromString(const char* str) {
     clear();
-    int len = strlen(str);
-    while (capacity < len + 100) {
-        resize(capacity * 2);
-    }
-    for (int i = 0; i < len; i++) {
-        insert(str[i]);
-    }
-}
\ No newline at end of file
+    insert(str, strlen(str));
+}
+
+void GapBuffer::loadFromMapping(MappedFile* file) {
+    clear();
+    int len = (int)file->getSize();
+    if (capacity < len + 100LL) resize(grownCapacity(len, len / 8 + 100));
+    // One copy straight into the post-gap half, leaving the gap at offset 0
+    gapEnd = capacity - len;
+    if (len > 0) memcpy(buffer + gapEnd, file->getData(), len);
+    lines.build(file->getData(), len);
+    delete file;
+}
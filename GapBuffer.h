@@ -1,7 +1,9 @@
 #ifndef GAPBUFFER_H
 #define GAPBUFFER_H
 
-class GapBuffer {
+#include "TextBuffer.h"
+
+class GapBuffer : public TextBuffer {
 private:
     char* buffer;
     int capacity;
@@ -9,21 +11,28 @@ private:
     int gapEnd;
     
     void resize(int newCapacity);
+    void reserveGap(int needed);
     
 public:
     GapBuffer(int initialCapacity = 1024);
     ~GapBuffer();
     
-    void moveCursorTo(int pos);
-    void insert(char c);
-    void deleteLeft();
-    void deleteRight();
-    int getCursorPosition() const;
-    int getLength() const;
-    char getCharAt(int pos) const;
-    void getText(char* dest, int maxLen) const;
-    void clear();
-    void loadFromString(const char* str);
+    void moveCursorTo(int pos) override;
+    void insert(char c) override;
+    void insert(const char* text, int len) override;
+    void deleteLeft() override;
+    void deleteRight() override;
+    void erase(int pos, int len) override;
+    void read(int pos, int len, char* out) const override;
+    int chunkAt(int pos, const char** data) const override;
+    int getCursorPosition() const override;
+    int getLength() const override;
+    char getCharAt(int pos) const override;
+    void getText(char* dest, int maxLen) const override;
+    void clear() override;
+    void loadFromString(const char* str) override;
+    void loadFromMapping(MappedFile* file) override;
+    const char* backendName() const override { return "gap"; }
 };
 
 #endif
\ No newline at end of file
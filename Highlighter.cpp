@@ -0,0 +1,194 @@
+#include "Highlighter.h"
+#include "TextBuffer.h"
+#include <cstring>
+
+Highlighter::Highlighter()
+    : lexer(nullptr), states(nullptr), capacity(0), gapStart(0), gapEnd(0), lineTotal(1),
+      validLine(0), knownLines(1), convergeLine(1), restyledFrom(-1), restyledTo(-1),
+      slots(nullptr), lineText(nullptr), lineTextCapacity(0), linesLexed(0) {
+}
+
+Highlighter::~Highlighter() {
+    delete lexer;
+    delete[] states;
+    delete[] slots;
+    delete[] lineText;
+}
+
+// The token cache is made with the first lexer, so documents never
+// highlighted (plain text, new files) don't carry it
+void Highlighter::setLexer(Lexer* newLexer, int lines) {
+    delete lexer;
+    lexer = newLexer;
+    if (lexer && !slots) {
+        slots = new Slot[TOKEN_SLOTS];
+        for (int i = 0; i < TOKEN_SLOTS; i++) slots[i].line = -1;
+    }
+    reset(lines);
+}
+
+void Highlighter::reset(int lines) {
+    lineTotal = lines;
+    validLine = 0;
+    knownLines = 1;
+    convergeLine = 1;
+    restyledFrom = restyledTo = -1;
+    invalidateTokensFrom(0);
+    if (!lexer || !lexer->hasLineState()) return;
+
+    // Every line gets an entry; only line 0's state is known so far
+    if (capacity < lines + 64) {
+        delete[] states;
+        capacity = lines + lines / 8 + 64;
+        states = new int[capacity];
+    }
+    states[0] = 0;
+    gapStart = lines;
+    gapEnd = capacity;
+}
+
+int Highlighter::stateAt(int line) const {
+    if (line < gapStart) return states[line];
+    return states[line + (gapEnd - gapStart)];
+}
+
+void Highlighter::setState(int line, int state) {
+    if (line < gapStart) states[line] = state;
+    else states[line + (gapEnd - gapStart)] = state;
+}
+
+void Highlighter::moveGapTo(int line) {
+    if (line < gapStart) {
+        int n = gapStart - line;
+        memmove(states + gapEnd - n, states + line, n * sizeof(int));
+        gapStart -= n;
+        gapEnd -= n;
+    } else if (line > gapStart) {
+        int n = line - gapStart;
+        memmove(states + gapStart, states + gapEnd, n * sizeof(int));
+        gapStart += n;
+        gapEnd += n;
+    }
+}
+
+// New entries are left unset; they fall inside the edited range, which is
+// always re-lexed before it is read
+void Highlighter::insertLines(int at, int n) {
+    if (gapEnd - gapStart < n) {
+        int count = capacity - (gapEnd - gapStart);
+        int newCapacity = capacity * 2;
+        if (newCapacity < count + n + 64) newCapacity = count + n + 64;
+        int* grown = new int[newCapacity];
+        int tail = capacity - gapEnd;
+        memcpy(grown, states, gapStart * sizeof(int));
+        memcpy(grown + newCapacity - tail, states + gapEnd, tail * sizeof(int));
+        delete[] states;
+        states = grown;
+        gapEnd = newCapacity - tail;
+        capacity = newCapacity;
+    }
+    moveGapTo(at);
+    gapStart += n;
+}
+
+void Highlighter::removeLines(int at, int n) {
+    moveGapTo(at);
+    gapEnd += n;
+}
+
+void Highlighter::invalidateTokensFrom(int line) {
+    if (!slots) return;
+    for (int i = 0; i < TOKEN_SLOTS; i++) {
+        if (slots[i].line >= line) slots[i].line = -1;
+    }
+}
+
+void Highlighter::onEdit(int firstLine, int lastLine, int lineDelta) {
+    invalidateTokensFrom(firstLine);
+    lineTotal += lineDelta;
+    if (!lexer || !lexer->hasLineState()) return;
+
+    if (lineDelta > 0) insertLines(firstLine + 1, lineDelta);
+    else if (lineDelta < 0) removeLines(firstLine + 1, -lineDelta);
+
+    // Cached states after the edit moved with their lines
+    if (knownLines > firstLine + 1) {
+        knownLines += lineDelta;
+        if (knownLines < firstLine + 1) knownLines = firstLine + 1;
+    }
+    if (convergeLine > firstLine + 1) {
+        convergeLine += lineDelta;
+        if (convergeLine < firstLine + 1) convergeLine = firstLine + 1;
+    }
+    if (convergeLine < lastLine + 1) convergeLine = lastLine + 1;
+    if (validLine > firstLine) validLine = firstLine;
+}
+
+int Highlighter::lexLine(const TextBuffer* buffer, int line, Token* out, int& count) {
+    int start = buffer->offsetOfLine(line);
+    int len = buffer->lineEnd(line) - start;
+    if (len >= lineTextCapacity) {
+        delete[] lineText;
+        lineTextCapacity = len + 256;
+        lineText = new char[lineTextCapacity];
+    }
+    buffer->read(start, len, lineText);
+    linesLexed++;
+    int state = lexer->hasLineState() ? stateAt(line) : 0;
+    return lexer->lexLine(lineText, len, state, out, MAX_TOKENS, count);
+}
+
+// Lexes forward from the first line with an unknown start state. Past the
+// edited lines, once a line ends in the state already cached for the next
+// one, every later cached state is still right and lexing stops.
+void Highlighter::ensureValid(const TextBuffer* buffer, int line) {
+    if (!lexer || !lexer->hasLineState()) return;
+    if (line >= lineTotal) line = lineTotal - 1;
+
+    while (validLine < line) {
+        int i = validLine;
+        Slot& slot = slots[i % TOKEN_SLOTS];
+        int end = lexLine(buffer, i, slot.tokens, slot.count);
+        slot.line = i;
+
+        int next = i + 1;
+        if (next >= convergeLine && next < knownLines && stateAt(next) == end) {
+            validLine = knownLines - 1;
+            break;
+        }
+        if (next >= knownLines || stateAt(next) != end) {
+            // The next line's highlighting depends on this state
+            if (next < knownLines) {
+                if (restyledFrom < 0 || next < restyledFrom) restyledFrom = next;
+                if (next > restyledTo) restyledTo = next;
+            }
+            Slot& nextSlot = slots[next % TOKEN_SLOTS];
+            if (nextSlot.line == next) nextSlot.line = -1;
+            setState(next, end);
+        }
+        validLine = next;
+        if (knownLines < next + 1) knownLines = next + 1;
+    }
+}
+
+void Highlighter::takeRestyledLines(int& from, int& to) {
+    from = restyledFrom;
+    to = restyledTo;
+    restyledFrom = restyledTo = -1;
+}
+
+const Token* Highlighter::tokensFor(const TextBuffer* buffer, int line, int& count) {
+    count = 0;
+    if (!lexer || line < 0 || line >= lineTotal) return nullptr;
+
+    Slot& slot = slots[line % TOKEN_SLOTS];
+    if (slot.line == line) {
+        count = slot.count;
+        return slot.tokens;
+    }
+    ensureValid(buffer, line);
+    lexLine(buffer, line, slot.tokens, slot.count);
+    slot.line = line;
+    count = slot.count;
+    return slot.tokens;
+}
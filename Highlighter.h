@@ -0,0 +1,82 @@
+#ifndef HIGHLIGHTER_H
+#define HIGHLIGHTER_H
+
+#include "Lexer.h"
+
+class TextBuffer;
+
+// Syntax highlighting state for one document. The lexer state at the
+// start of every line is cached in a gap array, so inserting or removing
+// lines near the last edit is cheap. After an edit only the edited lines
+// are re-lexed, plus the lines after them until the recomputed state
+// matches the cached one again. Tokens of recently drawn lines are kept in
+// a small line-indexed cache so repainting doesn't lex at all.
+class Highlighter {
+private:
+    static const int TOKEN_SLOTS = 128;
+    static const int MAX_TOKENS = 256;   // per line; the rest of the line draws plain
+
+    struct Slot {
+        int line;          // -1 when empty
+        int count;
+        Token tokens[MAX_TOKENS];
+    };
+
+    Lexer* lexer;
+
+    // Start state of each line, as a gap array
+    int* states;
+    int capacity;
+    int gapStart;
+    int gapEnd;
+    int lineTotal;
+
+    int validLine;     // start states of lines [0, validLine] are exact
+    int knownLines;    // lines [0, knownLines) have had a state computed at some point
+    int convergeLine;  // from here on a matching state means the rest is valid
+
+    // Lines whose start state changed since the view last asked
+    int restyledFrom;
+    int restyledTo;
+
+    Slot* slots;       // nullptr until a lexer is set
+    char* lineText;
+    int lineTextCapacity;
+    long long linesLexed;
+
+    int stateAt(int line) const;
+    void setState(int line, int state);
+    void moveGapTo(int line);
+    void insertLines(int at, int n);
+    void removeLines(int at, int n);
+    void invalidateTokensFrom(int line);
+    int lexLine(const TextBuffer* buffer, int line, Token* out, int& count);
+
+public:
+    Highlighter();
+    ~Highlighter();
+
+    // Takes ownership of lexer (nullptr turns highlighting off)
+    void setLexer(Lexer* newLexer, int lines);
+    const Lexer* getLexer() const { return lexer; }
+    void reset(int lines);
+
+    // The text of lines [firstLine, lastLine] changed and the document
+    // gained lineDelta lines (negative when lines were removed)
+    void onEdit(int firstLine, int lastLine, int lineDelta);
+
+    // Brings the cached states up to date through line, so lines whose
+    // highlighting changed because of an edit above them can be reported
+    void ensureValid(const TextBuffer* buffer, int line);
+    // Returns and resets the lines restyled since the last call; from is
+    // -1 when there are none
+    void takeRestyledLines(int& from, int& to);
+
+    // Tokens for line; count is 0 for plain text. Valid until the next call.
+    const Token* tokensFor(const TextBuffer* buffer, int line, int& count);
+
+    // Lines run through the lexer so far; used by the benchmark
+    long long getLinesLexed() const { return linesLexed; }
+};
+
+#endif
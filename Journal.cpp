@@ -0,0 +1,214 @@
+#include "Journal.h"
+#include "MappedFile.h"
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char MAGIC[4] = { 'T', 'E', 'J', '1' };
+static const int HEADER_SIZE = 4 + 3 * 8;
+static const int RECORD_OVERHEAD = 3 * 4 + 4;
+
+// FNV-1a, enough to spot a record torn by a crash
+static unsigned checksum(const char* data, int len, unsigned hash = 2166136261u) {
+    for (int i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool writeAll(int fd, const char* data, int len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+Journal::Journal(double flushInterval)
+    : fd(-1), path(nullptr), interval(flushInterval),
+      pending(nullptr), pendingLen(0), pendingCapacity(0), writing(nullptr), writingCapacity(0),
+      stopping(false) {}
+
+Journal::~Journal() {
+    close(false);
+    delete[] path;
+    delete[] pending;
+    delete[] writing;
+}
+
+void Journal::pathFor(const char* filename, char* out, int outSize) {
+    if (!filename) {
+        const char* home = getenv("HOME");
+        snprintf(out, outSize, "%s/.texteditor-untitled.journal", home ? home : "/tmp");
+        return;
+    }
+    // dir/name -> dir/.name.journal
+    const char* slash = strrchr(filename, '/');
+    if (slash) {
+        snprintf(out, outSize, "%.*s/.%s.journal", (int)(slash - filename), filename, slash + 1);
+    } else {
+        snprintf(out, outSize, ".%s.journal", filename);
+    }
+}
+
+JournalBase Journal::baseOf(const char* filename) {
+    JournalBase base = { 0, 0, 0 };
+    struct stat st;
+    if (filename && stat(filename, &st) == 0) {
+        base.size = st.st_size;
+        base.mtimeSec = st.st_mtim.tv_sec;
+        base.mtimeNsec = st.st_mtim.tv_nsec;
+    }
+    return base;
+}
+
+int Journal::replay(const char* path, const JournalBase& base, ReplayFn apply, void* data,
+                    long long& validLength) {
+    validLength = 0;
+    MappedFile file;
+    if (!file.open(path)) return 0;
+    const char* p = file.getData();
+    long long size = file.getSize();
+
+    // A journal for another version of the file is of no use
+    JournalBase header;
+    if (size < HEADER_SIZE || memcmp(p, MAGIC, 4) != 0) return 0;
+    memcpy(&header, p + 4, sizeof(header));
+    if (header.size != base.size || header.mtimeSec != base.mtimeSec || header.mtimeNsec != base.mtimeNsec)
+        return 0;
+
+    long long off = HEADER_SIZE;
+    int count = 0;
+    while (size - off >= RECORD_OVERHEAD) {
+        int fields[3];
+        memcpy(fields, p + off, sizeof(fields));
+        int pos = fields[0], deletedLen = fields[1], insertedLen = fields[2];
+        if (pos < 0 || deletedLen < 0 || insertedLen < 0 ||
+            size - off - RECORD_OVERHEAD < insertedLen) break;
+
+        int bodyLen = sizeof(fields) + insertedLen;
+        unsigned stored;
+        memcpy(&stored, p + off + bodyLen, 4);
+        if (stored != checksum(p + off, bodyLen)) break;
+
+        apply(data, pos, deletedLen, p + off + sizeof(fields), insertedLen);
+        off += bodyLen + 4;
+        count++;
+    }
+    validLength = off;
+    return count;
+}
+
+bool Journal::open(const char* journalPath, const JournalBase& base, long long validLength) {
+    close(false);
+    fd = ::open(journalPath, O_WRONLY | O_CREAT, 0600);
+    if (fd < 0) return false;
+
+    delete[] path;
+    path = new char[strlen(journalPath) + 1];
+    strcpy(path, journalPath);
+
+    // Drop a torn tail, or start over with a header for this base
+    if (validLength > 0) {
+        if (ftruncate(fd, validLength) != 0 || lseek(fd, 0, SEEK_END) < 0) validLength = 0;
+    }
+    if (validLength == 0) {
+        char header[HEADER_SIZE];
+        memcpy(header, MAGIC, 4);
+        memcpy(header + 4, &base, sizeof(base));
+        if (ftruncate(fd, 0) != 0 || !writeAll(fd, header, HEADER_SIZE)) {
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        fdatasync(fd);
+    }
+
+    pendingLen = 0;
+    stopping = false;
+    writer = std::thread(&Journal::run, this);
+    return true;
+}
+
+void Journal::rebase(const JournalBase& base) {
+    std::lock_guard<std::mutex> fileGuard(fileLock);
+    if (fd < 0) return;
+    if (pwrite(fd, &base, sizeof(base), 4) == (ssize_t)sizeof(base)) fdatasync(fd);
+}
+
+void Journal::logReplace(int pos, int deletedLen, const char* text, int len) {
+    if (fd < 0) return;
+    std::lock_guard<std::mutex> guard(lock);
+    int needed = pendingLen + RECORD_OVERHEAD + len;
+    if (needed > pendingCapacity) {
+        int newCapacity = pendingCapacity ? pendingCapacity * 2 : 4096;
+        if (newCapacity < needed) newCapacity = needed;
+        char* grown = new char[newCapacity];
+        if (pendingLen > 0) memcpy(grown, pending, pendingLen);
+        delete[] pending;
+        pending = grown;
+        pendingCapacity = newCapacity;
+    }
+    char* record = pending + pendingLen;
+    int fields[3] = { pos, deletedLen, len };
+    memcpy(record, fields, sizeof(fields));
+    memcpy(record + sizeof(fields), text, len);
+    unsigned sum = checksum(record, sizeof(fields) + len);
+    memcpy(record + sizeof(fields) + len, &sum, 4);
+    pendingLen = needed;
+}
+
+void Journal::flush() {
+    std::lock_guard<std::mutex> fileGuard(fileLock);
+    int n;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        char* block = pending;
+        int blockCapacity = pendingCapacity;
+        pending = writing;
+        pendingCapacity = writingCapacity;
+        writing = block;
+        writingCapacity = blockCapacity;
+        n = pendingLen;
+        pendingLen = 0;
+    }
+    if (n == 0 || fd < 0) return;
+    if (writeAll(fd, writing, n)) fdatasync(fd);
+}
+
+// Writer thread: flushes on a timer until close()
+void Journal::run() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (!stopping) {
+        wake.wait_for(guard, std::chrono::duration<double>(interval));
+        guard.unlock();
+        flush();
+        guard.lock();
+    }
+}
+
+void Journal::close(bool remove) {
+    if (fd < 0) return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    writer.join();
+    flush();
+    ::close(fd);
+    fd = -1;
+    if (remove) unlink(path);
+}
@@ -0,0 +1,77 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Identity of the file a journal's edits apply to: the journal is only
+// replayed onto the exact file version it was started from
+struct JournalBase {
+    long long size;
+    long long mtimeSec;
+    long long mtimeNsec;
+};
+
+// Crash-recovery log of edits since the last save. The UI thread only
+// appends each edit to an in-memory block (a memcpy of the inserted text);
+// a writer thread moves pending blocks to disk and fdatasyncs about once a
+// second. Each record carries a checksum, so replay stops cleanly at a
+// record torn by a crash.
+//
+// File layout: "TEJ1", then the JournalBase, then one record per edit:
+//   pos, deletedLen, insertedLen (int32 each), inserted bytes, checksum (uint32)
+class Journal {
+public:
+    typedef void (*ReplayFn)(void* data, int pos, int deletedLen, const char* text, int len);
+
+private:
+    int fd;
+    char* path;
+    double interval;
+
+    // Double-buffered pending records; the writer swaps them under lock.
+    // fileLock is held across a swap and its write so blocks stay in order.
+    std::mutex lock;
+    std::mutex fileLock;
+    std::condition_variable wake;
+    char* pending;
+    int pendingLen;
+    int pendingCapacity;
+    char* writing;
+    int writingCapacity;
+    bool stopping;
+    std::thread writer;
+
+    void run();
+
+public:
+    Journal(double flushInterval = 1.0);
+    ~Journal();
+
+    // Replays the records of the journal at path onto the caller's
+    // document through apply, if its header matches base. Returns how many
+    // edits were replayed; validLength is set to the length of the
+    // journal's intact prefix (0 if it should be started afresh).
+    static int replay(const char* path, const JournalBase& base, ReplayFn apply, void* data,
+                      long long& validLength);
+    // Path of the journal kept for filename (nullptr for an untitled document)
+    static void pathFor(const char* filename, char* out, int outSize);
+    // Identity of filename as it is on disk now; all zero if it doesn't exist
+    static JournalBase baseOf(const char* filename);
+
+    // Opens path for appending after validLength bytes, writing a fresh
+    // header when validLength is 0, and starts the writer thread
+    bool open(const char* path, const JournalBase& base, long long validLength);
+    // Points the journal at a newer version of the file its records still
+    // apply to, one that only had text appended
+    void rebase(const JournalBase& base);
+    // Queues one edit: [pos, pos + deletedLen) was replaced by text
+    void logReplace(int pos, int deletedLen, const char* text, int len);
+    // Writes everything queued so far and waits for it to reach the disk
+    void flush();
+    // Stops the writer after a final flush; remove also deletes the file
+    void close(bool remove);
+};
+
+#endif
@@ -0,0 +1,46 @@
+#include "JsonLexer.h"
+#include <cstring>
+
+int JsonLexer::lexLine(const char* text, int len, int state,
+                       Token* out, int maxTokens, int& count) const {
+    (void)state;
+    count = 0;
+    int i = 0;
+    while (i < len) {
+        char c = text[i];
+        int start = i;
+
+        if (c == '"') {
+            i++;
+            while (i < len && text[i] != '"') {
+                if (text[i] == '\\') i++;
+                i++;
+            }
+            if (i < len) i++;
+            if (i > len) i = len;
+
+            // A string followed by ':' is an object key
+            int j = i;
+            while (j < len && (text[j] == ' ' || text[j] == '\t')) j++;
+            emit(out, maxTokens, count, start, i - start, (j < len && text[j] == ':') ? STYLE_KEY : STYLE_STRING);
+            continue;
+        }
+        if (c == '-' || (c >= '0' && c <= '9')) {
+            i++;
+            while (i < len && ((text[i] >= '0' && text[i] <= '9') || text[i] == '.' || text[i] == 'e' ||
+                               text[i] == 'E' || text[i] == '+' || text[i] == '-')) i++;
+            emit(out, maxTokens, count, start, i - start, STYLE_NUMBER);
+            continue;
+        }
+        if (c >= 'a' && c <= 'z') {
+            while (i < len && text[i] >= 'a' && text[i] <= 'z') i++;
+            int n = i - start;
+            if ((n == 4 && (strncmp(text + start, "true", 4) == 0 || strncmp(text + start, "null", 4) == 0)) ||
+                (n == 5 && strncmp(text + start, "false", 5) == 0))
+                emit(out, maxTokens, count, start, n, STYLE_KEYWORD);
+            continue;
+        }
+        i++;
+    }
+    return 0;
+}
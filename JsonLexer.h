@@ -0,0 +1,16 @@
+#ifndef JSONLEXER_H
+#define JSONLEXER_H
+
+#include "Lexer.h"
+
+// JSON: object keys, string values, numbers and true/false/null. Nothing
+// in JSON spans a line break, so every line lexes independently.
+class JsonLexer : public Lexer {
+public:
+    int lexLine(const char* text, int len, int state,
+                Token* out, int maxTokens, int& count) const override;
+    bool hasLineState() const override { return false; }
+    const char* name() const override { return "JSON"; }
+};
+
+#endif
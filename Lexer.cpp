@@ -0,0 +1,22 @@
+#include "Lexer.h"
+#include "CppLexer.h"
+#include "JsonLexer.h"
+#include "LogLexer.h"
+#include <cstring>
+#include <strings.h>
+
+Lexer* Lexer::forFile(const char* filename) {
+    if (!filename) return nullptr;
+    const char* dot = strrchr(filename, '.');
+    const char* slash = strrchr(filename, '/');
+    if (!dot || (slash && dot < slash)) return nullptr;
+    const char* ext = dot + 1;
+
+    static const char* cppExts[] = { "c", "cc", "cpp", "cxx", "h", "hh", "hpp", "hxx", "ino" };
+    for (unsigned i = 0; i < sizeof(cppExts) / sizeof(cppExts[0]); i++) {
+        if (strcasecmp(ext, cppExts[i]) == 0) return new CppLexer();
+    }
+    if (strcasecmp(ext, "json") == 0) return new JsonLexer();
+    if (strcasecmp(ext, "log") == 0) return new LogLexer();
+    return nullptr;
+}
@@ -0,0 +1,59 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+enum TokenStyle {
+    STYLE_PLAIN = 0,
+    STYLE_KEYWORD,
+    STYLE_TYPE,
+    STYLE_STRING,
+    STYLE_NUMBER,
+    STYLE_COMMENT,
+    STYLE_PREPROC,
+    STYLE_KEY,          // JSON object keys
+    STYLE_ERROR,        // log levels
+    STYLE_WARNING,
+    STYLE_INFO,
+    STYLE_DEBUG,
+    STYLE_COUNT
+};
+
+// A styled span within one line; text between tokens is plain
+struct Token {
+    int start;          // column
+    int length;
+    int style;
+};
+
+// Splits one line at a time into tokens. The int state carries whatever
+// spills over a line break (e.g. "inside a block comment"); lexing a line
+// from the same start state always gives the same tokens and end state,
+// which is what lets Highlighter cache states per line.
+class Lexer {
+protected:
+    // Appends a token if there is room; lexing goes on either way so the
+    // end state stays right on very busy lines
+    static void emit(Token* out, int maxTokens, int& count, int start, int len, int style) {
+        if (count < maxTokens && len > 0) {
+            out[count].start = start;
+            out[count].length = len;
+            out[count].style = style;
+            count++;
+        }
+    }
+
+public:
+    virtual ~Lexer() {}
+
+    // Lexes text[0, len) starting in state; writes at most maxTokens tokens
+    // to out, sets count, and returns the state at the end of the line
+    virtual int lexLine(const char* text, int len, int state,
+                        Token* out, int maxTokens, int& count) const = 0;
+    // False when every line starts in state 0, so no state needs caching
+    virtual bool hasLineState() const { return true; }
+    virtual const char* name() const = 0;
+
+    // Picks a lexer from the file extension; nullptr for plain text
+    static Lexer* forFile(const char* filename);
+};
+
+#endif
@@ -0,0 +1,267 @@
+#include "LineDiff.h"
+#include <cstring>
+
+LineDiff::LineDiff()
+    : a(nullptr), b(nullptr), aLines(nullptr), bLines(nullptr), aKept(nullptr), bKept(nullptr), aCapacity(0),
+      bCapacity(0), aChanged(nullptr), bChanged(nullptr), table(nullptr), tableSides(nullptr),
+      tableCapacity(0), forward(nullptr), backward(nullptr), vCapacity(0),
+      hunks(nullptr), hunkCount(0), hunkCapacity(0), pending(nullptr), pendingCount(0), pendingCapacity(0) {}
+
+LineDiff::~LineDiff() {
+    delete[] aLines;
+    delete[] bLines;
+    delete[] aKept;
+    delete[] bKept;
+    delete[] aChanged;
+    delete[] bChanged;
+    delete[] table;
+    delete[] tableSides;
+    delete[] forward;
+    delete[] backward;
+    delete[] hunks;
+    delete[] pending;
+}
+
+unsigned long long LineDiff::hash(const char* data, int len, unsigned long long h) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (int i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Slot of h in the hash set: where it is, or the empty slot it would go in
+int LineDiff::tableSlot(unsigned long long h) const {
+    int mask = tableCapacity - 1;
+    int slot = (int)((h ^ (h >> 29)) & mask);
+    while (tableSides[slot] && table[slot] != h) slot = (slot + 1) & mask;
+    return slot;
+}
+
+// Marks every line whose hash never appears on the other side as changed,
+// since it can't be matched, and copies the rest into aKept and bKept
+void LineDiff::dropUnmatched(const unsigned long long* oldLines, int oldCount, const unsigned long long* newLines,
+                             int newCount, int& aCount, int& bCount) {
+    int needed = 64;
+    while (needed < 2 * (oldCount + newCount)) needed *= 2;
+    if (needed > tableCapacity) {
+        delete[] table;
+        delete[] tableSides;
+        tableCapacity = needed;
+        table = new unsigned long long[tableCapacity];
+        tableSides = new unsigned char[tableCapacity];
+    }
+    memset(tableSides, 0, tableCapacity);
+    for (int i = 0; i < oldCount; i++) {
+        int slot = tableSlot(oldLines[i]);
+        table[slot] = oldLines[i];
+        tableSides[slot] |= 1;
+    }
+    for (int j = 0; j < newCount; j++) {
+        int slot = tableSlot(newLines[j]);
+        table[slot] = newLines[j];
+        tableSides[slot] |= 2;
+    }
+
+    if (oldCount + 1 > aCapacity) {
+        delete[] aLines;
+        delete[] aKept;
+        delete[] aChanged;
+        aCapacity = oldCount + 1;
+        aLines = new int[aCapacity];
+        aKept = new unsigned long long[aCapacity];
+        aChanged = new bool[aCapacity];
+    }
+    if (newCount + 1 > bCapacity) {
+        delete[] bLines;
+        delete[] bKept;
+        delete[] bChanged;
+        bCapacity = newCount + 1;
+        bLines = new int[bCapacity];
+        bKept = new unsigned long long[bCapacity];
+        bChanged = new bool[bCapacity];
+    }
+    aCount = 0;
+    for (int i = 0; i < oldCount; i++) {
+        aChanged[i] = tableSides[tableSlot(oldLines[i])] != 3;
+        if (aChanged[i]) continue;
+        aLines[aCount] = i;
+        aKept[aCount++] = oldLines[i];
+    }
+    bCount = 0;
+    for (int j = 0; j < newCount; j++) {
+        bChanged[j] = tableSides[tableSlot(newLines[j])] != 3;
+        if (bChanged[j]) continue;
+        bLines[bCount] = j;
+        bKept[bCount++] = newLines[j];
+    }
+}
+
+void LineDiff::markChanged(int a0, int a1, int b0, int b1) {
+    for (int i = a0; i < a1; i++) aChanged[aLines[i]] = true;
+    for (int j = b0; j < b1; j++) bChanged[bLines[j]] = true;
+}
+
+void LineDiff::addHunk(int a0, int a1, int b0, int b1) {
+    if (hunkCount == hunkCapacity) {
+        int newCapacity = hunkCapacity ? hunkCapacity * 2 : 64;
+        DiffHunk* grown = new DiffHunk[newCapacity];
+        if (hunkCount > 0) memcpy(grown, hunks, hunkCount * sizeof(DiffHunk));
+        delete[] hunks;
+        hunks = grown;
+        hunkCapacity = newCapacity;
+    }
+    DiffHunk hunk = { a0, a1 - a0, b0, b1 - b0 };
+    hunks[hunkCount++] = hunk;
+}
+
+void LineDiff::pushRange(int a0, int a1, int b0, int b1) {
+    if (pendingCount == pendingCapacity) {
+        int newCapacity = pendingCapacity ? pendingCapacity * 2 : 64;
+        int* grown = new int[newCapacity * 4];
+        if (pendingCount > 0) memcpy(grown, pending, pendingCount * 4 * sizeof(int));
+        delete[] pending;
+        pending = grown;
+        pendingCapacity = newCapacity;
+    }
+    int* range = pending + pendingCount * 4;
+    range[0] = a0;
+    range[1] = a1;
+    range[2] = b0;
+    range[3] = b1;
+    pendingCount++;
+}
+
+// Finds a point (x, y), relative to (a0, b0), on a shortest edit path of
+// the range by extending paths from the start and the end one edit at a
+// time until they meet. Diagonals that leave the edit graph are dropped
+// from the search. False when the range should be taken as one hunk.
+bool LineDiff::bisect(int a0, int a1, int b0, int b1, int& x, int& y) {
+    int n = a1 - a0;
+    int m = b1 - b0;
+    int maxD = (n + m + 1) / 2;
+    int steps = maxD < COST_LIMIT ? maxD : COST_LIMIT;
+    int offset = steps + 1;
+    int length = 2 * steps + 3;
+    if (length > vCapacity) {
+        delete[] forward;
+        delete[] backward;
+        vCapacity = length;
+        forward = new int[vCapacity];
+        backward = new int[vCapacity];
+    }
+    for (int i = 0; i < length; i++) forward[i] = backward[i] = -1;
+    forward[offset + 1] = 0;
+    backward[offset + 1] = 0;
+
+    int delta = n - m;
+    bool odd = (delta & 1) != 0;   // the forward search is the one to notice the overlap
+    int k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+    int d = 0;
+    for (; d < steps; d++) {
+        for (int k1 = -d + k1start; k1 <= d - k1end; k1 += 2) {
+            int i1 = offset + k1;
+            int x1 = (k1 == -d || (k1 != d && forward[i1 - 1] < forward[i1 + 1])) ? forward[i1 + 1] : forward[i1 - 1] + 1;
+            int y1 = x1 - k1;
+            while (x1 < n && y1 < m && a[a0 + x1] == b[b0 + y1]) {
+                x1++;
+                y1++;
+            }
+            forward[i1] = x1;
+            if (x1 > n) {
+                k1end += 2;
+            } else if (y1 > m) {
+                k1start += 2;
+            } else if (odd) {
+                int i2 = offset + delta - k1;
+                if (i2 >= 0 && i2 < length && backward[i2] != -1 && x1 >= n - backward[i2]) {
+                    x = x1;
+                    y = y1;
+                    return (x > 0 || y > 0) && (x < n || y < m);
+                }
+            }
+        }
+        for (int k2 = -d + k2start; k2 <= d - k2end; k2 += 2) {
+            int i2 = offset + k2;
+            int x2 = (k2 == -d || (k2 != d && backward[i2 - 1] < backward[i2 + 1])) ? backward[i2 + 1] : backward[i2 - 1] + 1;
+            int y2 = x2 - k2;
+            while (x2 < n && y2 < m && a[a1 - 1 - x2] == b[b1 - 1 - y2]) {
+                x2++;
+                y2++;
+            }
+            backward[i2] = x2;
+            if (x2 > n) {
+                k2end += 2;
+            } else if (y2 > m) {
+                k2start += 2;
+            } else if (!odd) {
+                int i1 = offset + delta - k2;
+                if (i1 >= 0 && i1 < length && forward[i1] != -1 && forward[i1] >= n - x2) {
+                    x = forward[i1];
+                    y = x - (i1 - offset);
+                    return (x > 0 || y > 0) && (x < n || y < m);
+                }
+            }
+        }
+    }
+    if (steps == maxD) return false;   // nothing in common
+
+    // Over the cost limit: split at the forward point that got furthest
+    int best = 0;
+    d--;
+    for (int k1 = -d + k1start; k1 <= d - k1end; k1 += 2) {
+        int x1 = forward[offset + k1];
+        int y1 = x1 - k1;
+        if (x1 >= 0 && x1 <= n && y1 >= 0 && y1 <= m && x1 + y1 > best) {
+            best = x1 + y1;
+            x = x1;
+            y = y1;
+        }
+    }
+    return best > 0 && best < n + m;
+}
+
+int LineDiff::run(const unsigned long long* oldLines, int oldCount, const unsigned long long* newLines, int newCount) {
+    int aCount, bCount;
+    dropUnmatched(oldLines, oldCount, newLines, newCount, aCount, bCount);
+    a = aKept;
+    b = bKept;
+    hunkCount = 0;
+    pendingCount = 0;
+
+    pushRange(0, aCount, 0, bCount);
+    while (pendingCount > 0) {
+        pendingCount--;
+        const int* range = pending + pendingCount * 4;
+        int a0 = range[0], a1 = range[1], b0 = range[2], b1 = range[3];
+        while (a0 < a1 && b0 < b1 && a[a0] == b[b0]) {
+            a0++;
+            b0++;
+        }
+        while (a0 < a1 && b0 < b1 && a[a1 - 1] == b[b1 - 1]) {
+            a1--;
+            b1--;
+        }
+        int x, y;
+        if (a0 == a1 || b0 == b1 || !bisect(a0, a1, b0, b1, x, y)) {
+            markChanged(a0, a1, b0, b1);
+            continue;
+        }
+        pushRange(a0, a0 + x, b0, b0 + y);
+        pushRange(a0 + x, a1, b0 + y, b1);
+    }
+
+    // Unchanged lines pair up in order; each stretch between two pairs is a hunk
+    aChanged[oldCount] = bChanged[newCount] = false;
+    int i = 0, j = 0;
+    while (i < oldCount || j < newCount) {
+        int i0 = i, j0 = j;
+        while (i < oldCount && aChanged[i]) i++;
+        while (j < newCount && bChanged[j]) j++;
+        if (i > i0 || j > j0) addHunk(i0, i, j0, j);
+        i++;
+        j++;
+    }
+    return hunkCount;
+}
@@ -0,0 +1,86 @@
+#ifndef LINEDIFF_H
+#define LINEDIFF_H
+
+// A run of lines that differs between the old and the new text: old lines
+// [oldStart, oldStart + oldCount) became new lines [newStart, newStart + newCount)
+struct DiffHunk {
+    int oldStart;
+    int oldCount;
+    int newStart;
+    int newCount;
+};
+
+// Line diff of two texts given as one hash per line, using Myers' O(ND)
+// algorithm in linear space: each range is split at the middle of its
+// shortest edit path, found by searching from both ends at once. Lines
+// that appear on only one side are marked changed before the search and
+// left out of it, and common first and last lines are stripped before a
+// range is searched. A range that would need more than COST_LIMIT edits
+// is split where the search got furthest instead, so a heavily rewritten
+// text still costs close to O(N * COST_LIMIT) rather than O(N^2); the hunks
+// then just aren't minimal.
+class LineDiff {
+private:
+    // Lines being compared: the ones left after dropping those with no
+    // equal on the other side, as hashes and as indexes into the inputs
+    const unsigned long long* a;
+    const unsigned long long* b;
+    int* aLines;
+    int* bLines;
+    unsigned long long* aKept;
+    unsigned long long* bKept;
+    int aCapacity;
+    int bCapacity;
+
+    // Whether each input line is part of a change
+    bool* aChanged;
+    bool* bChanged;
+
+    // Open-addressed set of line hashes, with which side each was seen on
+    unsigned long long* table;
+    unsigned char* tableSides;
+    int tableCapacity;
+
+    // Furthest x reached on each diagonal, searching forward and backward
+    int* forward;
+    int* backward;
+    int vCapacity;
+
+    DiffHunk* hunks;
+    int hunkCount;
+    int hunkCapacity;
+
+    // Ranges still to split, as (a0, a1, b0, b1), the next one on top
+    int* pending;
+    int pendingCount;
+    int pendingCapacity;
+
+    LineDiff(const LineDiff&);
+    LineDiff& operator=(const LineDiff&);
+
+    int tableSlot(unsigned long long h) const;
+    void dropUnmatched(const unsigned long long* oldLines, int oldCount, const unsigned long long* newLines, int newCount,
+                       int& aCount, int& bCount);
+    void markChanged(int a0, int a1, int b0, int b1);
+    void addHunk(int a0, int a1, int b0, int b1);
+    void pushRange(int a0, int a1, int b0, int b1);
+    bool bisect(int a0, int a1, int b0, int b1, int& x, int& y);
+
+public:
+    static const int COST_LIMIT = 256;
+    static const unsigned long long HASH_SEED = 14695981039346656037ULL;
+
+    LineDiff();
+    ~LineDiff();
+
+    // FNV-1a over len bytes, continuing from h
+    static unsigned long long hash(const char* data, int len, unsigned long long h = HASH_SEED);
+
+    // Diffs oldLines against newLines; returns the number of hunks, which
+    // stay valid until the next run
+    int run(const unsigned long long* oldLines, int oldCount, const unsigned long long* newLines, int newCount);
+    int getHunkCount() const { return hunkCount; }
+    const DiffHunk& getHunk(int i) const { return hunks[i]; }
+};
+
+#endif
@@ -0,0 +1,120 @@
+#include "LineIndex.h"
+#include <climits>
+#include <cstring>
+
+LineIndex::LineIndex(int initialCapacity) {
+    capacity = initialCapacity;
+    starts = new int[capacity];
+    gapStart = 0;
+    gapEnd = capacity;
+    docLength = 0;
+}
+
+LineIndex::~LineIndex() {
+    delete[] starts;
+}
+
+void LineIndex::resize(int newCapacity) {
+    int* newStarts = new int[newCapacity];
+    int tail = capacity - gapEnd;
+    memcpy(newStarts, starts, gapStart * sizeof(int));
+    memcpy(newStarts + newCapacity - tail, starts + gapEnd, tail * sizeof(int));
+    delete[] starts;
+    starts = newStarts;
+    capacity = newCapacity;
+    gapEnd = newCapacity - tail;
+}
+
+void LineIndex::moveGapTo(int pos) {
+    // Entries crossing the gap switch between absolute and end-relative form
+    while (gapStart > 0 && starts[gapStart - 1] > pos) {
+        gapStart--;
+        gapEnd--;
+        starts[gapEnd] = docLength - starts[gapStart];
+    }
+    while (gapEnd < capacity && docLength - starts[gapEnd] <= pos) {
+        starts[gapStart] = docLength - starts[gapEnd];
+        gapStart++;
+        gapEnd++;
+    }
+}
+
+int LineIndex::entryAt(int i) const {
+    if (i < gapStart) return starts[i];
+    return docLength - starts[gapEnd + (i - gapStart)];
+}
+
+int LineIndex::entryCount() const {
+    return gapStart + (capacity - gapEnd);
+}
+
+void LineIndex::clear() {
+    gapStart = 0;
+    gapEnd = capacity;
+    docLength = 0;
+}
+
+void LineIndex::build(const char* text, int len) {
+    clear();
+    docLength = len;
+    const char* end = text + len;
+    for (const char* p = text; p < end; p++) {
+        p = (const char*)memchr(p, '\n', end - p);
+        if (!p) break;
+        if (gapStart == gapEnd) resize(capacity > INT_MAX / 2 ? INT_MAX : capacity * 2);
+        starts[gapStart++] = (int)(p - text) + 1;
+    }
+    // An eighth to spare, as the wrap and highlight arrays keep, so lines
+    // typed after loading don't regrow it
+    long long spare = gapStart / 8 + 64;
+    if (gapEnd - gapStart < spare) resize((int)(gapStart + spare > INT_MAX ? INT_MAX : gapStart + spare));
+}
+
+void LineIndex::onInsert(int pos, const char* text, int len) {
+    moveGapTo(pos);
+    docLength += len;
+    const char* end = text + len;
+    for (const char* p = text; p < end; p++) {
+        p = (const char*)memchr(p, '\n', end - p);
+        if (!p) break;
+        if (gapStart == gapEnd) resize(capacity > INT_MAX / 2 ? INT_MAX : capacity * 2);
+        starts[gapStart++] = pos + (int)(p - text) + 1;
+    }
+}
+
+void LineIndex::onErase(int pos, int len) {
+    moveGapTo(pos);
+    // Line starts inside (pos, pos + len] belonged to deleted newlines
+    while (gapEnd < capacity && docLength - starts[gapEnd] <= pos + len) {
+        gapEnd++;
+    }
+    docLength -= len;
+}
+
+int LineIndex::lineCount() const {
+    return entryCount() + 1;
+}
+
+int LineIndex::lineOfOffset(int pos) const {
+    // Number of line starts <= pos
+    int lo = 0, hi = entryCount();
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (entryAt(mid) <= pos) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+int LineIndex::offsetOfLine(int line) const {
+    if (line <= 0) return 0;
+    int count = entryCount();
+    if (line > count) line = count;
+    return entryAt(line - 1);
+}
+
+int LineIndex::lineEnd(int line) const {
+    if (line < 0) line = 0;
+    if (line + 1 < lineCount()) return offsetOfLine(line + 1) - 1;
+    return docLength;
+}
@@ -0,0 +1,37 @@
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+// Sorted offsets of every line start after the first, kept in a gap array.
+// Entries before the gap are absolute offsets; entries after the gap are
+// stored as their distance from the end of the document, so an edit at the
+// gap shifts every later line for free. Edits near the previous one only
+// move the gap across the newlines in between.
+class LineIndex {
+private:
+    int* starts;
+    int capacity;
+    int gapStart;
+    int gapEnd;
+    int docLength;
+
+    void resize(int newCapacity);
+    void moveGapTo(int pos);   // before-gap entries become exactly those <= pos
+    int entryAt(int i) const;  // absolute offset of the i-th line start
+    int entryCount() const;
+
+public:
+    LineIndex(int initialCapacity = 64);
+    ~LineIndex();
+
+    void clear();
+    void build(const char* text, int len);
+    void onInsert(int pos, const char* text, int len);
+    void onErase(int pos, int len);
+
+    int lineCount() const;
+    int lineOfOffset(int pos) const;   // O(log n)
+    int offsetOfLine(int line) const;  // O(1)
+    int lineEnd(int line) const;       // offset of the line's '\n' (or document end)
+};
+
+#endif
@@ -0,0 +1,57 @@
+#include "LogLexer.h"
+#include <cstring>
+
+struct Level {
+    const char* word;
+    int style;
+};
+
+static const Level levels[] = {
+    { "FATAL", STYLE_ERROR }, { "CRITICAL", STYLE_ERROR }, { "ERROR", STYLE_ERROR }, { "ERR", STYLE_ERROR },
+    { "WARNING", STYLE_WARNING }, { "WARN", STYLE_WARNING },
+    { "NOTICE", STYLE_INFO }, { "INFO", STYLE_INFO },
+    { "DEBUG", STYLE_DEBUG }, { "TRACE", STYLE_DEBUG },
+};
+
+static bool isTimestampChar(char c) {
+    return (c >= '0' && c <= '9') || c == '-' || c == ':' || c == '.' || c == ',' ||
+           c == '/' || c == 'T' || c == 'Z' || c == '+' || c == ' ' || c == '[' || c == ']';
+}
+
+static bool isUpper(char c) {
+    return c >= 'A' && c <= 'Z';
+}
+
+int LogLexer::lexLine(const char* text, int len, int state,
+                      Token* out, int maxTokens, int& count) const {
+    (void)state;
+    count = 0;
+
+    // Timestamp: a run of date/time characters at the start that holds a digit
+    int i = 0;
+    bool digit = false;
+    while (i < len && isTimestampChar(text[i])) {
+        if (text[i] >= '0' && text[i] <= '9') digit = true;
+        i++;
+    }
+    while (i > 0 && (text[i - 1] == ' ' || text[i - 1] == '[')) i--;
+    if (digit && i >= 6) emit(out, maxTokens, count, 0, i, STYLE_NUMBER);
+
+    // First all-caps word that names a level
+    while (i < len) {
+        if (!isUpper(text[i]) || (i > 0 && isUpper(text[i - 1]))) {
+            i++;
+            continue;
+        }
+        int start = i;
+        while (i < len && isUpper(text[i])) i++;
+        int n = i - start;
+        for (unsigned k = 0; k < sizeof(levels) / sizeof(levels[0]); k++) {
+            if ((int)strlen(levels[k].word) == n && strncmp(text + start, levels[k].word, n) == 0) {
+                emit(out, maxTokens, count, start, n, levels[k].style);
+                return 0;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef LOGLEXER_H
+#define LOGLEXER_H
+
+#include "Lexer.h"
+
+// Log files: a leading timestamp and the first severity word on each line
+// (ERROR, WARN, INFO, DEBUG and their usual spellings). Stateless.
+class LogLexer : public Lexer {
+public:
+    int lexLine(const char* text, int len, int state,
+                Token* out, int maxTokens, int& count) const override;
+    bool hasLineState() const override { return false; }
+    const char* name() const override { return "Log"; }
+};
+
+#endif
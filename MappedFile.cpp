@@ -0,0 +1,137 @@
+#include "MappedFile.h"
+#include <atomic>
+#include <csignal>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+long long MappedFile::copyLimit = 64LL << 20;
+
+// Mappings of files, for the SIGBUS handler to look up. A slot is taken
+// by setting start last and freed by clearing it.
+struct Guarded {
+    std::atomic<char*> start;
+    size_t length;             // rounded up to whole pages
+    volatile sig_atomic_t lost;
+};
+static Guarded guarded[MappedFile::MAX_MAPPED];
+static size_t pageSize;
+static struct sigaction previousAction;
+
+// A read past the end of a file truncated under its mapping. The pages
+// from the fault on are replaced with zeros so the read completes, and
+// the mapping is marked lost; its owner then reloads it as a file changed
+// in place. Faults anywhere else go to the handler there was before.
+static void onBusError(int sig, siginfo_t* info, void* context) {
+    char* addr = (char*)info->si_addr;
+    for (int i = 0; i < MappedFile::MAX_MAPPED; i++) {
+        char* start = guarded[i].start.load();
+        if (!start || addr < start || addr >= start + guarded[i].length) continue;
+        char* from = start + (addr - start) / pageSize * pageSize;
+        size_t span = start + guarded[i].length - from;
+        if (mmap(from, span, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) break;
+        guarded[i].lost = 1;
+        return;
+    }
+    if (previousAction.sa_flags & SA_SIGINFO) {
+        previousAction.sa_sigaction(sig, info, context);
+    } else if (previousAction.sa_handler != SIG_IGN && previousAction.sa_handler != SIG_DFL) {
+        previousAction.sa_handler(sig);
+    } else {
+        // Returning retries the read, which now ends the process
+        signal(SIGBUS, SIG_DFL);
+    }
+}
+
+// A free slot for a mapping, with the handler installed; -1 when all are
+// in use
+static int claimGuard() {
+    static bool installed = false;
+    if (!installed) {
+        pageSize = sysconf(_SC_PAGESIZE);
+        struct sigaction action;
+        action.sa_sigaction = onBusError;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_SIGINFO;
+        if (sigaction(SIGBUS, &action, &previousAction) != 0) return -1;
+        installed = true;
+    }
+    for (int i = 0; i < MappedFile::MAX_MAPPED; i++) {
+        if (!guarded[i].start.load()) return i;
+    }
+    return -1;
+}
+
+MappedFile::MappedFile() : data(nullptr), size(0), pinned(false), guard(-1), inode(0), mtime(0) {}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const char* filename) {
+    close();
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+
+    size = st.st_size;
+    inode = st.st_ino;
+    mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    // Past MAX_MAPPED mappings a truncation couldn't be caught, so the
+    // file is copied instead
+    if (size > copyLimit) guard = claimGuard();
+    pinned = guard < 0;
+    if (size > 0 && pinned) {
+        // Anonymous memory, so the pages are the editor's own
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        long long done = 0;
+        while (p != MAP_FAILED && done < size) {
+            ssize_t n = pread(fd, (char*)p + done, size - done, done);
+            if (n <= 0) break;
+            done += n;
+        }
+        if (p == MAP_FAILED || done < size || mprotect(p, size, PROT_READ) != 0) {
+            if (p != MAP_FAILED) munmap(p, size);
+            ::close(fd);
+            size = 0;
+            return false;
+        }
+        data = (const char*)p;
+    } else if (size > 0) {
+        void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            size = 0;
+            guard = -1;
+            return false;
+        }
+        data = (const char*)p;
+        guarded[guard].length = (size + pageSize - 1) / pageSize * pageSize;
+        guarded[guard].lost = 0;
+        guarded[guard].start.store((char*)p);
+    }
+    // The mapping keeps the file contents reachable after the descriptor closes
+    ::close(fd);
+    return true;
+}
+
+bool MappedFile::changedInPlace(const struct stat& st) const {
+    if (pinned || !data) return false;
+    if (guarded[guard].lost) return true;
+    long long now = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return (unsigned long long)st.st_ino == inode && (st.st_size != size || now != mtime);
+}
+
+void MappedFile::close() {
+    if (guard >= 0) guarded[guard].start.store(nullptr);
+    guard = -1;
+    if (data) munmap((void*)data, size);
+    data = nullptr;
+    size = 0;
+}
@@ -0,0 +1,45 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+struct stat;
+
+// Read-only memory mapping of a whole file. Backends can keep pointing at
+// the mapped pages as their original text, so loading does not copy the
+// file and only pages that are actually read become resident.
+//
+// A private mapping still shows pages another process rewrites in place,
+// and reading past a point the file was truncated to raises SIGBUS. Files
+// up to copyLimit are therefore read into private anonymous memory
+// instead, which nothing else can change. Larger ones stay mapped; their
+// owner asks changedInPlace() when the file changes and loads it again.
+// Until then a SIGBUS handler turns reads past the truncation into zeros
+// (and makes changedInPlace() true) rather than ending the process.
+class MappedFile {
+private:
+    const char* data;
+    long long size;
+    bool pinned;                 // data is a private copy, not the file's pages
+    int guard;                   // slot watched by the SIGBUS handler, or -1
+    unsigned long long inode;
+    long long mtime;             // nanoseconds
+
+public:
+    static long long copyLimit;
+    // Files mapped at once; past this they are copied like small ones
+    static const int MAX_MAPPED = 64;
+
+    MappedFile();
+    ~MappedFile();
+
+    bool open(const char* filename);
+    void close();
+
+    const char* getData() const { return data; }
+    long long getSize() const { return size; }
+    bool isPinned() const { return pinned; }
+    // Whether st, the file's current state, is the mapped file written to
+    // in place since it was mapped; always false for a pinned copy
+    bool changedInPlace(const struct stat& st) const;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "Metrics.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+
+// --- Allocation Counter ---
+// Replacing the global operator new counts every allocation in the
+// program, FLTK's and the standard library's included
+static std::atomic<long long> allocationCount(0);
+
+void* operator new(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+// --- Histogram ---
+Histogram::Histogram(const char* histogramName, const char* histogramUnit)
+    : name(histogramName), unit(histogramUnit) {
+    reset();
+}
+
+// Values below 4 get a bucket each; above that, 4 buckets per power of two
+int Histogram::bucketOf(long long v) {
+    if (v < 4) return v < 0 ? 0 : (int)v;
+    int e = 63 - __builtin_clzll((unsigned long long)v);
+    int sub = (int)(v >> (e - 2)) & 3;
+    return 4 + (e - 2) * 4 + sub;
+}
+
+long long Histogram::bucketLow(int b) {
+    if (b < 4) return b;
+    int e = (b - 4) / 4 + 2;
+    int sub = (b - 4) % 4;
+    return (long long)(4 + sub) << (e - 2);
+}
+
+void Histogram::add(long long v) {
+    counts[bucketOf(v)]++;
+    total++;
+    sum += v;
+    if (v > maxValue) maxValue = v;
+}
+
+void Histogram::reset() {
+    memset(counts, 0, sizeof(counts));
+    total = 0;
+    sum = 0;
+    maxValue = 0;
+}
+
+long long Histogram::percentile(double p) const {
+    if (total == 0) return 0;
+    long long rank = (long long)(total * p / 100.0);
+    if (rank >= total) rank = total - 1;
+    long long seen = 0;
+    for (int b = 0; b < BUCKETS; b++) {
+        seen += counts[b];
+        if (seen > rank) {
+            long long high = b + 1 < BUCKETS ? bucketLow(b + 1) - 1 : maxValue;
+            return high < maxValue ? high : maxValue;
+        }
+    }
+    return maxValue;
+}
+
+void Histogram::dump(FILE* out) const {
+    fprintf(out, "%-14s %-6s count %lld  mean %.1f  p50 %lld  p90 %lld  p99 %lld  max %lld\n",
+            name, unit, total, mean(), percentile(50), percentile(90), percentile(99), maxValue);
+    for (int b = 0; b < BUCKETS; b++) {
+        if (counts[b] == 0) continue;
+        long long high = b + 1 < BUCKETS ? bucketLow(b + 1) - 1 : maxValue;
+        fprintf(out, "  [%lld, %lld] %lld\n", bucketLow(b), high, counts[b]);
+    }
+}
+
+// --- Metrics ---
+bool Metrics::enabled = false;
+Histogram Metrics::keyToPaint("key-to-paint", "us");
+Histogram Metrics::handleTime("handle", "us");
+Histogram Metrics::frameTime("frame", "us");
+Histogram Metrics::editTime("edit", "us");
+Histogram Metrics::gapMove("gap-move", "bytes");
+Histogram Metrics::allocsPerKey("allocs-per-key", "allocs");
+Histogram Metrics::fileLoad("file-load", "us");
+Histogram Metrics::fileSave("file-save", "us");
+
+static Histogram* all[] = {
+    &Metrics::keyToPaint, &Metrics::handleTime, &Metrics::frameTime, &Metrics::editTime,
+    &Metrics::gapMove, &Metrics::allocsPerKey, &Metrics::fileLoad, &Metrics::fileSave,
+};
+static const int histogramCount = sizeof(all) / sizeof(all[0]);
+
+long long Metrics::nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+long long Metrics::allocations() {
+    return allocationCount.load(std::memory_order_relaxed);
+}
+
+void Metrics::reset() {
+    for (int i = 0; i < histogramCount; i++) all[i]->reset();
+}
+
+void Metrics::summary(char* out, int outSize) {
+    snprintf(out, outSize, "key %.1f/%.1fms  frame %.1f/%.1fms  gap %lldK  %lld alloc/key",
+             keyToPaint.percentile(50) / 1000.0, keyToPaint.percentile(99) / 1000.0,
+             frameTime.percentile(50) / 1000.0, frameTime.percentile(99) / 1000.0,
+             gapMove.percentile(99) >> 10, allocsPerKey.percentile(50));
+}
+
+bool Metrics::dump(const char* path, const char* label, bool append) {
+    FILE* out = fopen(path, append ? "a" : "w");
+    if (!out) return false;
+    time_t now = time(nullptr);
+    char when[32];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    fprintf(out, "# %s  built %s %s  dumped %s\n", label, __DATE__, __TIME__, when);
+    for (int i = 0; i < histogramCount; i++) all[i]->dump(out);
+    fprintf(out, "\n");
+    return fclose(out) == 0;
+}
@@ -0,0 +1,67 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstdio>
+
+// Fixed-size histogram of non-negative integer samples (microseconds,
+// bytes, counts). Each power of two is split into 4 buckets, so adding a
+// sample is O(1), memory never grows, and a percentile read back is at
+// most 25% above the true value.
+class Histogram {
+private:
+    static const int BUCKETS = 256;
+
+    const char* name;
+    const char* unit;
+    long long counts[BUCKETS];
+    long long total;
+    double sum;
+    long long maxValue;
+
+    static int bucketOf(long long v);
+    static long long bucketLow(int b);
+
+public:
+    Histogram(const char* histogramName, const char* histogramUnit);
+
+    void add(long long v);
+    void reset();
+    long long count() const { return total; }
+    double mean() const { return total ? sum / total : 0; }
+    long long max() const { return maxValue; }
+    // Upper bound of the bucket holding the p-th percentile (0-100)
+    long long percentile(double p) const;
+    const char* getName() const { return name; }
+
+    // Summary line followed by one line per non-empty bucket
+    void dump(FILE* out) const;
+};
+
+// Instrumentation shared by the editor and its model. Nothing is recorded
+// unless enabled is set, apart from the allocation counter, which is a
+// single atomic increment per operator new.
+class Metrics {
+public:
+    static bool enabled;
+
+    static Histogram keyToPaint;    // keystroke handled -> frame painted, us
+    static Histogram handleTime;    // one event in TextEditor::handle, us
+    static Histogram frameTime;     // one TextEditor::draw, us
+    static Histogram editTime;      // one Document::applyEdit incl. undo record, us
+    static Histogram gapMove;       // bytes memmoved per gap buffer cursor move
+    static Histogram allocsPerKey;  // operator new calls from keystroke to paint
+    static Histogram fileLoad;      // Document::loadFromFile, us
+    static Histogram fileSave;      // Document::saveToFile, us
+
+    static long long nowUs();
+    static long long allocations();
+    static void reset();
+
+    // Short summary for the status bar
+    static void summary(char* out, int outSize);
+    // Writes every histogram to path, appending when append is set;
+    // label names the run (build, backend, scenario)
+    static bool dump(const char* path, const char* label, bool append);
+};
+
+#endif
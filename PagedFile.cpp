@@ -0,0 +1,190 @@
+#include "PagedFile.h"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Reads up to len bytes at offset, retrying short reads; returns how many
+// were read
+static long long readFully(int fd, char* out, long long len, long long offset) {
+    long long done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, out + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    return done;
+}
+
+static long long countNewlines(const char* data, int len) {
+    long long count = 0;
+    const char* end = data + len;
+    const char* p = data;
+    while ((p = (const char*)memchr(p, '\n', end - p)) != nullptr) {
+        count++;
+        p++;
+    }
+    return count;
+}
+
+PagedFile::PagedFile()
+    : fd(-1), size(0), chunkCount(0), slots(new Slot[CACHE_CHUNKS]), useClock(0),
+      newlinesBefore(nullptr), indexed(0), cancelled(false) {
+    for (int i = 0; i < CACHE_CHUNKS; i++) {
+        slots[i].chunk = -1;
+        slots[i].data = nullptr;
+        slots[i].length = 0;
+        slots[i].lastUse = 0;
+    }
+}
+
+PagedFile::~PagedFile() {
+    close();
+    for (int i = 0; i < CACHE_CHUNKS; i++) delete[] slots[i].data;
+    delete[] slots;
+}
+
+bool PagedFile::open(const char* filename) {
+    close();
+    fd = ::open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    size = st.st_size;
+    chunkCount = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    newlinesBefore = new long long[chunkCount + 1];
+    newlinesBefore[0] = 0;
+    indexed = 0;
+    cancelled = false;
+    worker = std::thread(&PagedFile::runIndex, this);
+    return true;
+}
+
+void PagedFile::close() {
+    if (worker.joinable()) {
+        cancelled = true;
+        worker.join();
+    }
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    size = 0;
+    chunkCount = 0;
+    for (int i = 0; i < CACHE_CHUNKS; i++) slots[i].chunk = -1;
+    delete[] newlinesBefore;
+    newlinesBefore = nullptr;
+    indexed = 0;
+}
+
+// The worker reads with its own buffer rather than through the cache, so
+// the UI thread never waits on it and its pass evicts nothing
+void PagedFile::runIndex() {
+    char* data = new char[CHUNK_SIZE];
+    for (long long i = 0; i < chunkCount && !cancelled; i++) {
+        int len = (int)readFully(fd, data, CHUNK_SIZE, i * CHUNK_SIZE);
+        newlinesBefore[i + 1] = newlinesBefore[i] + countNewlines(data, len);
+        indexed.store(i + 1, std::memory_order_release);
+    }
+    delete[] data;
+}
+
+const PagedFile::Slot& PagedFile::load(long long chunk) {
+    useClock++;
+    int victim = 0;
+    for (int i = 0; i < CACHE_CHUNKS; i++) {
+        if (slots[i].chunk == chunk) {
+            slots[i].lastUse = useClock;
+            return slots[i];
+        }
+        if (slots[i].lastUse < slots[victim].lastUse) victim = i;
+    }
+
+    Slot& slot = slots[victim];
+    if (!slot.data) slot.data = new char[CHUNK_SIZE];
+    slot.length = (int)readFully(fd, slot.data, CHUNK_SIZE, chunk * CHUNK_SIZE);
+    slot.chunk = slot.length > 0 ? chunk : -1;
+    slot.lastUse = useClock;
+    return slot;
+}
+
+bool PagedFile::read(long long pos, int len, char* out) {
+    if (pos < 0 || pos + len > size) return false;
+    while (len > 0) {
+        long long chunk = pos / CHUNK_SIZE;
+        int offset = (int)(pos - chunk * CHUNK_SIZE);
+        const Slot& slot = load(chunk);
+        int n = std::min(slot.length - offset, len);
+        if (n <= 0) return false;
+        memcpy(out, slot.data + offset, n);
+        out += n;
+        pos += n;
+        len -= n;
+    }
+    return true;
+}
+
+long long PagedFile::nextLineStart(long long pos, int limit) {
+    long long end = std::min(pos + limit, size);
+    while (pos < end) {
+        long long chunk = pos / CHUNK_SIZE;
+        int offset = (int)(pos - chunk * CHUNK_SIZE);
+        const Slot& slot = load(chunk);
+        int n = (int)std::min((long long)(slot.length - offset), end - pos);
+        if (n <= 0) break;
+        const char* newline = (const char*)memchr(slot.data + offset, '\n', n);
+        if (newline) return pos + (newline - (slot.data + offset)) + 1;
+        pos += n;
+    }
+    return -1;
+}
+
+bool PagedFile::copyTo(int outFd, long long from, long long to) {
+    char* data = new char[CHUNK_SIZE];
+    bool ok = true;
+    while (ok && from < to) {
+        long long n = readFully(fd, data, std::min((long long)CHUNK_SIZE, to - from), from);
+        for (long long done = 0; ok && done < n; ) {
+            ssize_t w = write(outFd, data + done, n - done);
+            if (w < 0 && errno == EINTR) continue;
+            ok = w > 0;
+            if (ok) done += w;
+        }
+        ok = ok && n > 0;
+        from += n;
+    }
+    delete[] data;
+    return ok;
+}
+
+long long PagedFile::pageStart(int page) {
+    if (page <= 0) return 0;
+    if (page >= pageCount()) return size;
+    long long at = (long long)page * PAGE_SIZE;
+    long long start = nextLineStart(at - 1, PAGE_SIZE);
+    return start < 0 ? at : start;
+}
+
+int PagedFile::pageOf(long long pos) {
+    if (pos >= size) return pageCount() > 0 ? pageCount() - 1 : 0;
+    int page = (int)(pos / PAGE_SIZE);
+    return pos < pageStart(page) ? page - 1 : page;
+}
+
+double PagedFile::indexProgress() const {
+    return chunkCount == 0 ? 1.0 : (double)indexed.load(std::memory_order_acquire) / chunkCount;
+}
+
+long long PagedFile::lineOfOffset(long long pos) {
+    long long chunk = pos / CHUNK_SIZE;
+    if (pos < 0 || pos > size || chunk > indexed.load(std::memory_order_acquire)) return -1;
+    int offset = (int)(pos - chunk * CHUNK_SIZE);
+    if (offset == 0) return newlinesBefore[chunk];
+    const Slot& slot = load(chunk);
+    return newlinesBefore[chunk] + countNewlines(slot.data, std::min(offset, slot.length));
+}
@@ -0,0 +1,80 @@
+#ifndef PAGEDFILE_H
+#define PAGEDFILE_H
+
+#include <atomic>
+#include <thread>
+
+// A file too large to load, read through a small cache of fixed-size
+// chunks with 64-bit offsets. A chunk is read with pread the first time it
+// is needed and the least recently used one is dropped when the cache is
+// full, so memory stays at CACHE_CHUNKS chunks whatever the file size.
+//
+// The file is split into pages for editing: page i runs from the first
+// line start at or after i * PAGE_SIZE to the one for page i + 1, so
+// finding a page costs one short scan and never depends on the pages
+// before it. A line longer than a page is cut where the page would start.
+//
+// A worker thread counts the newlines of every chunk once, front to back;
+// line numbers are known for the part of the file it has reached.
+class PagedFile {
+public:
+    static const int CHUNK_SIZE = 1 << 20;
+    static const int CACHE_CHUNKS = 64;
+    static const int PAGE_SIZE = 8 << 20;
+
+private:
+    struct Slot {
+        long long chunk;   // -1 when empty
+        char* data;
+        int length;
+        unsigned long long lastUse;
+    };
+
+    int fd;
+    long long size;
+    long long chunkCount;
+    Slot* slots;
+    unsigned long long useClock;
+
+    // newlinesBefore[i] counts the newlines in chunks [0, i); entries up
+    // to indexed are final
+    long long* newlinesBefore;
+    std::atomic<long long> indexed;
+    std::atomic<bool> cancelled;
+    std::thread worker;
+
+    PagedFile(const PagedFile&);
+    PagedFile& operator=(const PagedFile&);
+
+    const Slot& load(long long chunk);
+    void runIndex();
+
+public:
+    PagedFile();
+    ~PagedFile();
+
+    bool open(const char* filename);
+    void close();
+    long long getSize() const { return size; }
+
+    // Copies [pos, pos + len) through the cache; false past the end or on
+    // a read error
+    bool read(long long pos, int len, char* out);
+    // Offset just past the first '\n' at or after pos, looking no further
+    // than limit bytes; -1 when there is none that close
+    long long nextLineStart(long long pos, int limit);
+    // Writes [from, to) to outFd, bypassing the cache
+    bool copyTo(int outFd, long long from, long long to);
+
+    int pageCount() const { return (int)((size + PAGE_SIZE - 1) / PAGE_SIZE); }
+    // Start of page, and the file size for pageCount()
+    long long pageStart(int page);
+    int pageOf(long long pos);
+
+    // Share of the file whose lines are counted, from 0 to 1
+    double indexProgress() const;
+    // Line containing pos, or -1 while the index hasn't reached it
+    long long lineOfOffset(long long pos);
+};
+
+#endif
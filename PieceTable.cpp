@@ -0,0 +1,334 @@
+#include "PieceTable.h"
+#include "MappedFile.h"
+#include <climits>
+#include <cstring>
+
+PieceTable::PieceTable()
+    : original(nullptr), originalLength(0), ownedOriginal(nullptr), mapping(nullptr), add(nullptr), addLength(0), addCapacity(0),
+      root(nullptr), cursor(0), seed(2463534242u), cacheNode(nullptr), cacheStart(0) {
+    addCapacity = 1024;
+    add = new char[addCapacity];
+}
+
+// The arena releases the tree's nodes
+PieceTable::~PieceTable() {
+    delete[] ownedOriginal;
+    delete mapping;
+    delete[] add;
+}
+
+PieceTable::Node* PieceTable::newNode(int source, int start, int length) {
+    // xorshift32 keeps the treap balanced in expectation
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    Node* n = (Node*)nodes.allocate(sizeof(Node));
+    n->source = source;
+    n->start = start;
+    n->length = length;
+    n->total = length;
+    n->priority = seed;
+    n->left = nullptr;
+    n->right = nullptr;
+    return n;
+}
+
+void PieceTable::freeTree(Node* t) {
+    if (!t) return;
+    freeTree(t->left);
+    freeTree(t->right);
+    nodes.release(t, sizeof(Node));
+}
+
+void PieceTable::update(Node* t) {
+    t->total = total(t->left) + t->length + total(t->right);
+}
+
+// Splits t so that l holds the first pos characters; a piece straddling
+// pos is cut in two
+void PieceTable::split(Node* t, int pos, Node*& l, Node*& r) {
+    if (!t) {
+        l = r = nullptr;
+        return;
+    }
+    int leftTotal = total(t->left);
+    if (pos <= leftTotal) {
+        split(t->left, pos, l, t->left);
+        update(t);
+        r = t;
+    } else if (pos >= leftTotal + t->length) {
+        split(t->right, pos - leftTotal - t->length, t->right, r);
+        update(t);
+        l = t;
+    } else {
+        int k = pos - leftTotal;
+        Node* tail = newNode(t->source, t->start + k, t->length - k);
+        tail->priority = t->priority;  // still dominates t's old right subtree
+        tail->right = t->right;
+        t->right = nullptr;
+        t->length = k;
+        update(t);
+        update(tail);
+        l = t;
+        r = tail;
+    }
+}
+
+PieceTable::Node* PieceTable::merge(Node* l, Node* r) {
+    if (!l) return r;
+    if (!r) return l;
+    if (l->priority > r->priority) {
+        l->right = merge(l->right, r);
+        update(l);
+        return l;
+    }
+    r->left = merge(l, r->left);
+    update(r);
+    return r;
+}
+
+const PieceTable::Node* PieceTable::find(int pos, int& pieceStart) const {
+    const Node* t = root;
+    int off = pos;
+    while (t) {
+        int leftTotal = total(t->left);
+        if (off < leftTotal) {
+            t = t->left;
+        } else if (off < leftTotal + t->length) {
+            pieceStart = pos - (off - leftTotal);
+            return t;
+        } else {
+            off -= leftTotal + t->length;
+            t = t->right;
+        }
+    }
+    return nullptr;
+}
+
+// Grows or shrinks the piece containing pos in place, fixing subtree totals
+// on the way down
+void PieceTable::adjustPieceAt(int pos, int delta, int startShift) {
+    Node* t = root;
+    int off = pos;
+    while (t) {
+        t->total += delta;
+        int leftTotal = total(t->left);
+        if (off < leftTotal) {
+            t = t->left;
+        } else if (off < leftTotal + t->length) {
+            t->length += delta;
+            t->start += startShift;
+            return;
+        } else {
+            off -= leftTotal + t->length;
+            t = t->right;
+        }
+    }
+}
+
+void PieceTable::cutRange(int pos, int len) {
+    Node* l;
+    Node* mid;
+    Node* r;
+    split(root, pos, l, r);
+    split(r, len, mid, r);
+    freeTree(mid);
+    root = merge(l, r);
+    cacheNode = nullptr;
+}
+
+const char* PieceTable::pieceData(const Node* n) const {
+    return (n->source == ORIGINAL ? original : add) + n->start;
+}
+
+void PieceTable::appendToAdd(const char* text, int len) {
+    if (addLength + len > addCapacity) {
+        // Doubling is held to what an int offset can reach
+        int newCapacity = addCapacity > INT_MAX / 2 ? INT_MAX : addCapacity * 2;
+        if (newCapacity < addLength + len) newCapacity = addLength + len;
+        char* grown = new char[newCapacity];
+        memcpy(grown, add, addLength);
+        delete[] add;
+        add = grown;
+        addCapacity = newCapacity;
+    }
+    memcpy(add + addLength, text, len);
+    addLength += len;
+}
+
+void PieceTable::moveCursorTo(int pos) {
+    if (pos < 0) pos = 0;
+    if (pos > getLength()) pos = getLength();
+    cursor = pos;
+}
+
+void PieceTable::insert(char c) {
+    insert(&c, 1);
+}
+
+void PieceTable::insert(const char* text, int len) {
+    if (len <= 0) return;
+    int addPos = addLength;
+    appendToAdd(text, len);
+    lines.onInsert(cursor, text, len);
+    cacheNode = nullptr;
+
+    // Typing right after the last inserted text just extends its piece
+    if (cursor > 0) {
+        int pieceStart;
+        const Node* prev = find(cursor - 1, pieceStart);
+        if (prev && prev->source == ADD && prev->start + prev->length == addPos &&
+            pieceStart + prev->length == cursor) {
+            adjustPieceAt(cursor - 1, len, 0);
+            cursor += len;
+            return;
+        }
+    }
+
+    Node* l;
+    Node* r;
+    split(root, cursor, l, r);
+    root = merge(merge(l, newNode(ADD, addPos, len)), r);
+    cursor += len;
+}
+
+void PieceTable::deleteLeft() {
+    if (cursor == 0) return;
+    cursor--;
+    deleteRight();
+}
+
+void PieceTable::deleteRight() {
+    if (cursor >= getLength()) return;
+    lines.onErase(cursor, 1);
+    cacheNode = nullptr;
+
+    int pieceStart;
+    const Node* n = find(cursor, pieceStart);
+    if (n->length > 1 && cursor == pieceStart + n->length - 1) {
+        adjustPieceAt(cursor, -1, 0);
+    } else if (n->length > 1 && cursor == pieceStart) {
+        adjustPieceAt(cursor, -1, 1);
+    } else {
+        cutRange(cursor, 1);
+    }
+}
+
+void PieceTable::erase(int pos, int len) {
+    if (pos < 0) pos = 0;
+    if (pos > getLength()) pos = getLength();
+    if (len > getLength() - pos) len = getLength() - pos;
+    cursor = pos;
+    if (len <= 0) return;
+    lines.onErase(pos, len);
+    cutRange(pos, len);
+}
+
+void PieceTable::read(int pos, int len, char* out) const {
+    copyRange(root, pos, len, out);
+}
+
+int PieceTable::getCursorPosition() const {
+    return cursor;
+}
+
+int PieceTable::getLength() const {
+    return total(root);
+}
+
+char PieceTable::getCharAt(int pos) const {
+    if (pos < 0 || pos >= getLength()) return '\0';
+    if (!cacheNode || pos < cacheStart || pos >= cacheStart + cacheNode->length) {
+        cacheNode = find(pos, cacheStart);
+    }
+    return pieceData(cacheNode)[pos - cacheStart];
+}
+
+int PieceTable::chunkAt(int pos, const char** data) const {
+    if (pos < 0 || pos >= getLength()) return 0;
+    if (!cacheNode || pos < cacheStart || pos >= cacheStart + cacheNode->length) {
+        cacheNode = find(pos, cacheStart);
+    }
+    *data = pieceData(cacheNode) + (pos - cacheStart);
+    return cacheStart + cacheNode->length - pos;
+}
+
+// Copies [pos, pos + len) of t's subtree, visiting only overlapping pieces
+void PieceTable::copyRange(const Node* t, int pos, int len, char* out) const {
+    if (!t || len <= 0) return;
+    int leftTotal = total(t->left);
+    if (pos < leftTotal) {
+        int n = len < leftTotal - pos ? len : leftTotal - pos;
+        copyRange(t->left, pos, n, out);
+        out += n;
+        pos += n;
+        len -= n;
+    }
+    if (len > 0 && pos < leftTotal + t->length) {
+        int off = pos - leftTotal;
+        int n = len < t->length - off ? len : t->length - off;
+        memcpy(out, pieceData(t) + off, n);
+        out += n;
+        pos += n;
+        len -= n;
+    }
+    if (len > 0) copyRange(t->right, pos - leftTotal - t->length, len, out);
+}
+
+void PieceTable::getText(char* dest, int maxLen) const {
+    int len = getLength();
+    if (len > maxLen - 1) len = maxLen - 1;
+    copyRange(root, 0, len, dest);
+    dest[len] = '\0';
+}
+
+void PieceTable::clear() {
+    nodes.reset();
+    root = nullptr;
+    delete[] ownedOriginal;
+    ownedOriginal = nullptr;
+    delete mapping;
+    mapping = nullptr;
+    original = nullptr;
+    originalLength = 0;
+    addLength = 0;
+    cursor = 0;
+    cacheNode = nullptr;
+    lines.clear();
+}
+
+void PieceTable::loadFromString(const char* str) {
+    clear();
+    originalLength = strlen(str);
+    ownedOriginal = new char[originalLength > 0 ? originalLength : 1];
+    memcpy(ownedOriginal, str, originalLength);
+    original = ownedOriginal;
+    if (originalLength > 0) root = newNode(ORIGINAL, 0, originalLength);
+    lines.build(original, originalLength);
+    reserveAdd();
+}
+
+const MappedFile* PieceTable::fileMapping() const {
+    return mapping && !mapping->isPinned() ? mapping : nullptr;
+}
+
+void PieceTable::loadFromMapping(MappedFile* file) {
+    clear();
+    mapping = file;
+    original = file->getData();
+    originalLength = (int)file->getSize();
+    if (originalLength > 0) root = newNode(ORIGINAL, 0, originalLength);
+    lines.build(original, originalLength);
+    reserveAdd();
+}
+
+// Room in the add buffer for an eighth of the file, the slack the gap
+// buffer leaves, up to ADD_SLACK_MAX
+void PieceTable::reserveAdd() {
+    int wanted = originalLength / 8 > ADD_SLACK_MAX ? ADD_SLACK_MAX : originalLength / 8;
+    if (addCapacity >= wanted) return;
+    delete[] add;
+    add = new char[wanted];
+    addCapacity = wanted;
+}
@@ -0,0 +1,86 @@
+#ifndef PIECETABLE_H
+#define PIECETABLE_H
+
+#include "TextBuffer.h"
+#include "Arena.h"
+
+class MappedFile;
+
+// Piece table: the document is a sequence of pieces, each a slice of either
+// the read-only original text or the append-only add buffer. Pieces live in
+// a treap ordered by document position, so locating, splitting and joining
+// pieces is O(log p) and moving the cursor is O(1) no matter how far it jumps.
+// When loaded from a mapped file the original text is the mapping itself,
+// so only inserted text is ever copied (small files are mapped as a
+// private copy, see MappedFile).
+class PieceTable : public TextBuffer {
+private:
+    enum Source { ORIGINAL = 0, ADD = 1 };
+
+    struct Node {
+        int source;
+        int start;
+        int length;
+        int total;          // characters in this subtree
+        unsigned priority;
+        Node* left;
+        Node* right;
+    };
+
+    static const int ADD_SLACK_MAX = 16 << 20;
+
+    const char* original;
+    int originalLength;
+    char* ownedOriginal;    // set when loaded from a string
+    MappedFile* mapping;    // set when loaded from a file
+    char* add;
+    int addLength;
+    int addCapacity;
+
+    Arena nodes;            // every Node, freed in one go by clear()
+    Node* root;
+    int cursor;
+    unsigned seed;
+
+    // Last piece found by getCharAt; sequential reads stay O(1)
+    mutable const Node* cacheNode;
+    mutable int cacheStart;
+
+    Node* newNode(int source, int start, int length);
+    void freeTree(Node* t);
+    static int total(const Node* t) { return t ? t->total : 0; }
+    static void update(Node* t);
+    void split(Node* t, int pos, Node*& l, Node*& r);
+    Node* merge(Node* l, Node* r);
+    const Node* find(int pos, int& pieceStart) const;
+    void adjustPieceAt(int pos, int delta, int startShift);
+    void cutRange(int pos, int len);
+    const char* pieceData(const Node* n) const;
+    void appendToAdd(const char* text, int len);
+    void reserveAdd();
+    void copyRange(const Node* t, int pos, int len, char* out) const;
+
+public:
+    PieceTable();
+    ~PieceTable();
+
+    void moveCursorTo(int pos) override;
+    void insert(char c) override;
+    void insert(const char* text, int len) override;
+    void deleteLeft() override;
+    void deleteRight() override;
+    void erase(int pos, int len) override;
+    void read(int pos, int len, char* out) const override;
+    int chunkAt(int pos, const char** data) const override;
+    int getCursorPosition() const override;
+    int getLength() const override;
+    char getCharAt(int pos) const override;
+    void getText(char* dest, int maxLen) const override;
+    void clear() override;
+    void loadFromString(const char* str) override;
+    void loadFromMapping(MappedFile* file) override;
+    const MappedFile* fileMapping() const override;
+    const char* backendName() const override { return "piece"; }
+};
+
+#endif
@@ -0,0 +1,223 @@
+#include "RegexSearch.h"
+#include "TextBuffer.h"
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+// The worker checks for cancellation between windows of about this size
+static const int WINDOW_SIZE = 256 * 1024;
+
+// The snapshot is copied in chunks of this size, the lock held per chunk
+static const int COPY_CHUNK = 1 << 20;
+
+// Results stop growing past this many matches
+static const int MAX_MATCHES = 1 << 22;
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+RegexSearch::RegexSearch(NotifyFn notify, void* notifyData)
+    : notify(notify), notifyData(notifyData), compiled(false), source(nullptr), sourceLock(nullptr),
+      text(nullptr), textLen(0), textCapacity(0), cancelled(false), running(false),
+      starts(nullptr), ends(nullptr), count(0), capacity(0), truncated(false) {
+    pattern[0] = '\0';
+    errorMsg[0] = '\0';
+}
+
+RegexSearch::~RegexSearch() {
+    clear();
+    delete[] text;
+    delete[] starts;
+    delete[] ends;
+}
+
+bool RegexSearch::start(const char* pat, const TextBuffer* buffer, std::mutex& bufferLock) {
+    clear();
+    int err = regcomp(&regex, pat, REG_EXTENDED | REG_NEWLINE);
+    if (err != 0) {
+        regerror(err, &regex, errorMsg, sizeof(errorMsg));
+        return false;
+    }
+    compiled = true;
+    errorMsg[0] = '\0';
+    snprintf(pattern, sizeof(pattern), "%s", pat);
+    restart(buffer, bufferLock);
+    return true;
+}
+
+void RegexSearch::restart(const TextBuffer* buffer, std::mutex& bufferLock) {
+    cancel();
+    if (!compiled) return;
+
+    source = buffer;
+    sourceLock = &bufferLock;
+    count = 0;
+    truncated = false;
+    cancelled = false;
+    running = true;
+    worker = std::thread(&RegexSearch::run, this);
+}
+
+void RegexSearch::cancel() {
+    if (worker.joinable()) {
+        cancelled = true;
+        worker.join();
+    }
+    running = false;
+}
+
+void RegexSearch::clear() {
+    cancel();
+    if (compiled) regfree(&regex);
+    compiled = false;
+    pattern[0] = '\0';
+    count = 0;
+    truncated = false;
+}
+
+void RegexSearch::addMatch(int start, int end) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (count == MAX_MATCHES) {
+        truncated = true;
+        return;
+    }
+    if (count == capacity) {
+        int newCapacity = capacity ? capacity * 2 : 1024;
+        int* grownStarts = new int[newCapacity];
+        int* grownEnds = new int[newCapacity];
+        if (count > 0) {
+            memcpy(grownStarts, starts, count * sizeof(int));
+            memcpy(grownEnds, ends, count * sizeof(int));
+        }
+        delete[] starts;
+        delete[] ends;
+        starts = grownStarts;
+        ends = grownEnds;
+        capacity = newCapacity;
+    }
+    starts[count] = start;
+    ends[count] = end;
+    count++;
+}
+
+// Copies the source buffer a chunk at a time, holding the lock only for
+// each chunk so an edit waits at most that long. Returns false when
+// cancelled, or when the text changed length under the copy: the owner
+// sees the edit and starts again anyway.
+bool RegexSearch::takeSnapshot() {
+    int len;
+    {
+        std::lock_guard<std::mutex> guard(*sourceLock);
+        len = source->getLength();
+    }
+    if (len + 1 > textCapacity) {
+        delete[] text;
+        textCapacity = len + 1;
+        text = new char[textCapacity];
+    }
+    for (int pos = 0; pos < len; pos += COPY_CHUNK) {
+        if (cancelled) return false;
+        if (pos > 0) std::this_thread::yield();
+        std::lock_guard<std::mutex> guard(*sourceLock);
+        if (source->getLength() != len) return false;
+        source->read(pos, len - pos < COPY_CHUNK ? len - pos : COPY_CHUNK, text + pos);
+    }
+    text[len] = '\0';
+    textLen = len;
+    return true;
+}
+
+// Worker: walks the snapshot in windows that end on a line break, so
+// no match is lost at a window edge and cancel() is honoured promptly
+void RegexSearch::run() {
+    if (!takeSnapshot()) {
+        running = false;
+        return;
+    }
+    double lastNotify = nowSeconds();
+    int pos = 0;
+    while (pos < textLen && !cancelled && !truncated) {
+        int windowEnd = textLen;
+        if (textLen - pos > WINDOW_SIZE) {
+            const char* nl = (const char*)memchr(text + pos + WINDOW_SIZE, '\n',
+                                                 textLen - pos - WINDOW_SIZE);
+            if (nl) windowEnd = nl - text + 1;
+        }
+
+        // '$' may only match at a real newline, not at the window's end
+        int flags = REG_STARTEND | (windowEnd < textLen ? REG_NOTEOL : 0);
+        int p = pos;
+        while (p < windowEnd && !cancelled && !truncated) {
+            regmatch_t m;
+            m.rm_so = p;
+            m.rm_eo = windowEnd;
+            if (regexec(&regex, text, 1, &m, flags) != 0) break;
+            // Empty matches are skipped; they have nothing to highlight
+            if (m.rm_eo > m.rm_so) {
+                addMatch(m.rm_so, m.rm_eo);
+                p = m.rm_eo;
+            } else {
+                p = m.rm_so + 1;
+            }
+        }
+        pos = windowEnd;
+
+        double now = nowSeconds();
+        if (notify && now - lastNotify > 0.05) {
+            notify(notifyData);
+            lastNotify = now;
+        }
+    }
+    bool finished = !cancelled;
+    running = false;
+    if (finished && notify) notify(notifyData);
+}
+
+int RegexSearch::matchCount() {
+    std::lock_guard<std::mutex> guard(lock);
+    return count;
+}
+
+bool RegexSearch::isTruncated() {
+    std::lock_guard<std::mutex> guard(lock);
+    return truncated;
+}
+
+int RegexSearch::matchesIn(int from, int to, int* outStarts, int* outEnds, int max) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    // Matches don't overlap, so ends are sorted too; find the first ending after from
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ends[mid] <= from) lo = mid + 1;
+        else hi = mid;
+    }
+    int n = 0;
+    for (int i = lo; i < count && starts[i] < to && n < max; i++, n++) {
+        outStarts[n] = starts[i];
+        outEnds[n] = ends[i];
+    }
+    return n;
+}
+
+int RegexSearch::nextMatch(int pos, bool forward) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    // First match starting after pos
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (starts[mid] <= pos) lo = mid + 1;
+        else hi = mid;
+    }
+    if (forward) return lo < count ? starts[lo] : -1;
+
+    // Step back past a match starting exactly at pos
+    int i = lo - 1;
+    if (i >= 0 && starts[i] == pos) i--;
+    return i >= 0 ? starts[i] : -1;
+}
@@ -0,0 +1,85 @@
+#ifndef REGEXSEARCH_H
+#define REGEXSEARCH_H
+
+#include <regex.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+class TextBuffer;
+
+// POSIX extended regex search on a worker thread. start() returns at once;
+// the worker first copies the buffer into a private snapshot, a chunk at
+// a time under the lock the owner takes around every change to the text,
+// then appends matches in document order and calls the notify hook (at
+// most every 50 ms, and once when finished) so the UI can pick them up.
+// Matches are found within lines only. Editing the document makes the
+// results stale: the owner cancels and starts again against a fresh
+// snapshot. The worker reads the buffer until the snapshot is taken, so
+// the owner must cancel or clear before freeing the buffer or its lock.
+class RegexSearch {
+public:
+    typedef void (*NotifyFn)(void* data);
+
+private:
+    NotifyFn notify;
+    void* notifyData;
+
+    regex_t regex;
+    bool compiled;
+    char pattern[200];
+    char errorMsg[128];
+
+    // What the worker snapshots, and the lock that keeps edits out meanwhile
+    const TextBuffer* source;
+    std::mutex* sourceLock;
+
+    // Snapshot, reused between runs so restarts don't fault in new pages
+    char* text;
+    int textLen;
+    int textCapacity;
+
+    std::thread worker;
+    std::atomic<bool> cancelled;
+    std::atomic<bool> running;
+
+    // Results; the worker appends under the lock
+    std::mutex lock;
+    int* starts;
+    int* ends;
+    int count;
+    int capacity;
+    bool truncated;
+
+    bool takeSnapshot();
+    void run();
+    void addMatch(int start, int end);
+
+public:
+    RegexSearch(NotifyFn notify, void* notifyData);
+    ~RegexSearch();
+
+    // Compiles the pattern and searches a snapshot of buffer, taken on the
+    // worker with bufferLock held; returns false and sets error() if the
+    // pattern does not compile
+    bool start(const char* pat, const TextBuffer* buffer, std::mutex& bufferLock);
+    // Searches again with the current pattern, e.g. after an edit
+    void restart(const TextBuffer* buffer, std::mutex& bufferLock);
+    void cancel();
+    void clear();
+
+    bool isActive() const { return compiled; }
+    bool isRunning() const { return running; }
+    const char* getPattern() const { return pattern; }
+    const char* error() const { return errorMsg; }
+
+    int matchCount();
+    bool isTruncated();
+    // Copies up to max matches overlapping [from, to); returns how many
+    int matchesIn(int from, int to, int* outStarts, int* outEnds, int max);
+    // First match starting after pos (or last starting before it); -1 if
+    // none has been found yet
+    int nextMatch(int pos, bool forward);
+};
+
+#endif
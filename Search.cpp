@@ -0,0 +1,127 @@
+#include "Search.h"
+#include "TextBuffer.h"
+#include <cstring>
+#include <algorithm>
+
+// Backward searches copy the text in blocks of this size
+static const int BLOCK_SIZE = 64 * 1024;
+
+// Below this length the memchr scan beats Horspool's skip table
+static const int HORSPOOL_MIN = 4;
+
+Searcher::Searcher() : needle(nullptr), needleLen(0), scratch(nullptr), scratchSize(0) {
+    setPattern("", 0);
+}
+
+Searcher::~Searcher() {
+    delete[] needle;
+    delete[] scratch;
+}
+
+void Searcher::setPattern(const char* text, int len) {
+    delete[] needle;
+    needle = new char[len + 1];
+    memcpy(needle, text, len);
+    needle[len] = '\0';
+    needleLen = len;
+
+    // Shift by the distance from a byte's last occurrence (ignoring the
+    // final position) to the end of the needle
+    for (int i = 0; i < 256; i++) skip[i] = len;
+    for (int i = 0; i < len - 1; i++) skip[(unsigned char)needle[i]] = len - 1 - i;
+
+    delete[] scratch;
+    scratchSize = BLOCK_SIZE + 2 * len;
+    scratch = new char[scratchSize];
+}
+
+// First match fully inside data[0, n), or -1
+int Searcher::scanForward(const char* data, int n) const {
+    int m = needleLen;
+    if (n < m) return -1;
+
+    if (m < HORSPOOL_MIN) {
+        const char* p = data;
+        const char* end = data + n - m + 1;
+        while (p < end) {
+            p = (const char*)memchr(p, needle[0], end - p);
+            if (!p) return -1;
+            if (memcmp(p + 1, needle + 1, m - 1) == 0) return p - data;
+            p++;
+        }
+        return -1;
+    }
+
+    int last = m - 1;
+    char lastChar = needle[last];
+    int i = 0;
+    while (i <= n - m) {
+        char c = data[i + last];
+        if (c == lastChar && memcmp(data + i, needle, last) == 0) return i;
+        i += skip[(unsigned char)c];
+    }
+    return -1;
+}
+
+// Last match fully inside data[0, n), or -1
+int Searcher::scanBackward(const char* data, int n) const {
+    int m = needleLen;
+    int end = n - m + 1;
+    while (end > 0) {
+        const char* p = (const char*)memrchr(data, needle[0], end);
+        if (!p) return -1;
+        if (memcmp(p + 1, needle + 1, m - 1) == 0) return p - data;
+        end = p - data;
+    }
+    return -1;
+}
+
+int Searcher::findForward(const TextBuffer* buffer, int from, int limit) const {
+    int m = needleLen;
+    int len = buffer->getLength();
+    if (m == 0) return -1;
+    if (from < 0) from = 0;
+    limit = std::min(limit, len - m + 1);
+
+    // Text a match starting before limit can reach
+    int reach = limit + m - 1;
+    int pos = from;
+    while (pos < limit) {
+        const char* data;
+        int n = std::min(buffer->chunkAt(pos, &data), reach - pos);
+        int off = scanForward(data, n);
+        if (off >= 0) return pos + off;
+
+        // Matches that start in this chunk and run into the next ones
+        int chunkEnd = pos + n;
+        if (m > 1 && chunkEnd < reach) {
+            int winStart = std::max(pos, chunkEnd - (m - 1));
+            int winEnd = std::min(chunkEnd + m - 1, reach);
+            buffer->read(winStart, winEnd - winStart, scratch);
+            off = scanForward(scratch, winEnd - winStart);
+            if (off >= 0 && winStart + off < limit) return winStart + off;
+        }
+        pos = chunkEnd;
+    }
+    return -1;
+}
+
+int Searcher::findBackward(const TextBuffer* buffer, int before, int limit) const {
+    int m = needleLen;
+    int len = buffer->getLength();
+    if (m == 0) return -1;
+    if (limit < 0) limit = 0;
+    before = std::min(before, len - m + 1);
+
+    // Scan blocks from the end, each extended by m - 1 bytes so matches
+    // that start inside the block are complete
+    while (before > limit) {
+        int blockStart = std::max(limit, before - BLOCK_SIZE);
+        int n = before - blockStart + m - 1;
+        buffer->read(blockStart, n, scratch);
+        int off = scanBackward(scratch, n);
+        if (off >= 0) return blockStart + off;
+        before = blockStart;
+    }
+    return -1;
+}
@@ -0,0 +1,38 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+class TextBuffer;
+
+// Literal substring search that runs directly on a buffer's contiguous
+// chunks (the two halves of a gap buffer, the pieces of a piece table).
+// Short needles scan for their first byte with memchr; longer ones use
+// Boyer-Moore-Horspool. Matches that straddle a chunk boundary are found
+// by checking a small window copied from around the boundary.
+class Searcher {
+private:
+    char* needle;
+    int needleLen;
+    int skip[256];          // Horspool shift per byte
+    char* scratch;          // boundary windows and backward blocks
+    int scratchSize;
+
+    int scanForward(const char* data, int n) const;
+    int scanBackward(const char* data, int n) const;
+
+public:
+    Searcher();
+    ~Searcher();
+
+    void setPattern(const char* text, int len);
+    void clear() { setPattern("", 0); }
+    bool isEmpty() const { return needleLen == 0; }
+    int length() const { return needleLen; }
+    const char* pattern() const { return needle; }
+
+    // First match starting in [from, limit), or -1
+    int findForward(const TextBuffer* buffer, int from, int limit) const;
+    // Last match starting in [limit, before), or -1
+    int findBackward(const TextBuffer* buffer, int before, int limit) const;
+};
+
+#endif
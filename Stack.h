@@ -1,56 +1,105 @@
 #ifndef STACK_H
 #define STACK_H
 
+#include <utility>
+
+// Stack over a growable ring of slots. Elements are moved in and out
+// rather than copied, or built from constructor arguments with emplace;
+// slots are reused so pushing costs no allocation once the ring has grown,
+// and the oldest element can be dropped from the bottom, which is how a
+// bounded history forgets.
 template<typename T>
 class Stack {
 private:
-    struct Node {
-        T data;
-        Node* next;
-        Node(const T& d) : data(d), next(nullptr) {}
-    };
-    Node* top;
+    T* slots;
+    int capacity;
+    int head;      // slot of the bottom element
     int count;
 
+    Stack(const Stack&);
+    Stack& operator=(const Stack&);
+
+    void grow() {
+        int newCapacity = capacity ? capacity * 2 : 16;
+        T* grown = new T[newCapacity];
+        for (int i = 0; i < count; i++) grown[i] = std::move(at(i));
+        delete[] slots;
+        slots = grown;
+        capacity = newCapacity;
+        head = 0;
+    }
+
 public:
-    Stack() : top(nullptr), count(0) {}
-    
+    Stack() : slots(nullptr), capacity(0), head(0), count(0) {}
+
     ~Stack() {
-        while (!isEmpty()) {
-            pop();
-        }
+        delete[] slots;
     }
-    
+
     void push(const T& item) {
-        Node* newNode = new Node(item);
-        newNode->next = top;
-        top = newNode;
+        push(T(item));
+    }
+
+    void push(T&& item) {
+        if (count == capacity) grow();
+        at(count) = std::move(item);
+        count++;
+    }
+
+    // Constructs the new top element from args and moves it into its slot;
+    // returns it. The slot is only touched once construction has
+    // succeeded, so a throwing constructor leaves the stack as it was.
+    template<typename... Args>
+    T& emplace(Args&&... args) {
+        T item(std::forward<Args>(args)...);
+        if (count == capacity) grow();
+        T& slot = at(count);
+        slot = std::move(item);
         count++;
+        return slot;
     }
-    
+
     T pop() {
         if (isEmpty()) return T();
-        Node* temp = top;
-        T data = temp->data;
-        top = top->next;
-        delete temp;
         count--;
-        return data;
+        return std::move(at(count));
     }
-    
-    bool isEmpty() const { 
-        return top == nullptr; 
+
+    T& peek() {
+        return at(count - 1);
+    }
+
+    // i counts up from the bottom
+    T& at(int i) {
+        return slots[(head + i) % capacity];
+    }
+
+    // The oldest element
+    T& bottom() {
+        return at(0);
+    }
+
+    void dropBottom() {
+        if (isEmpty()) return;
+        at(0) = T();
+        head = (head + 1) % capacity;
+        count--;
+    }
+
+    bool isEmpty() const {
+        return count == 0;
     }
-    
-    int size() const { 
-        return count; 
+
+    int size() const {
+        return count;
     }
-    
+
+    // Empties the stack; the slots are kept for reuse
     void clear() {
-        while (!isEmpty()) {
-            pop();
-        }
+        for (int i = 0; i < count; i++) at(i) = T();
+        head = 0;
+        count = 0;
     }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,9 @@
+#include "TextBuffer.h"
+#include "GapBuffer.h"
+#include "PieceTable.h"
+#include <cstring>
+
+TextBuffer* TextBuffer::create(const char* backend) {
+    if (backend && strcmp(backend, "piece") == 0) return new PieceTable();
+    return new GapBuffer();
+}
@@ -0,0 +1,53 @@
+#ifndef TEXTBUFFER_H
+#define TEXTBUFFER_H
+
+#include "LineIndex.h"
+
+class MappedFile;
+
+// Abstract text storage used by the editor. Every backend keeps an
+// incremental line index so line lookups behave the same regardless of
+// how the bytes themselves are stored.
+class TextBuffer {
+protected:
+    LineIndex lines;
+
+public:
+    virtual ~TextBuffer() {}
+
+    virtual void moveCursorTo(int pos) = 0;
+    virtual void insert(char c) = 0;
+    virtual void deleteLeft() = 0;
+    virtual void deleteRight() = 0;
+    // Bulk operations: one cursor move and one copy for the whole range.
+    // insert() places text at the cursor; erase() leaves the cursor at pos.
+    virtual void insert(const char* text, int len) = 0;
+    virtual void erase(int pos, int len) = 0;
+    virtual void read(int pos, int len, char* out) const = 0;
+    // Points *data at the contiguous bytes starting at pos and returns how
+    // many there are (0 at or past the end); valid until the next edit
+    virtual int chunkAt(int pos, const char** data) const = 0;
+    virtual int getCursorPosition() const = 0;
+    virtual int getLength() const = 0;
+    virtual char getCharAt(int pos) const = 0;
+    virtual void getText(char* dest, int maxLen) const = 0;
+    virtual void clear() = 0;
+    virtual void loadFromString(const char* str) = 0;
+    // Replaces the contents with a mapped file; the buffer takes ownership
+    virtual void loadFromMapping(MappedFile* file) = 0;
+    virtual const char* backendName() const = 0;
+    // The file mapping the text is still read from, if any; a backend that
+    // copied what it loaded has none
+    virtual const MappedFile* fileMapping() const { return nullptr; }
+
+    // Line lookups backed by the incremental line index
+    int lineCount() const { return lines.lineCount(); }
+    int lineOfOffset(int pos) const { return lines.lineOfOffset(pos); }
+    int offsetOfLine(int line) const { return lines.offsetOfLine(line); }
+    int lineEnd(int line) const { return lines.lineEnd(line); }
+
+    // Creates a backend by name ("gap" or "piece"); unknown names fall back to "gap"
+    static TextBuffer* create(const char* backend);
+};
+
+#endif
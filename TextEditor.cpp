@@ -1,181 +1,410 @@
 #include "TextEditor.h"
+#include "Metrics.h"
 #include <FL/Fl.H>
 #include <FL/fl_draw.H>
+#include <climits>
 #include <cstring>
-#include <fstream>
 #include <cstdio>
+#include <cstdlib>
 #include <algorithm>
 
-TextEditor::TextEditor(int X, int Y, int W, int H)
-    : Fl_Widget(X, Y, W, H),
-      cursorPos(0), selectionStart(-1), selectionEnd(-1), selecting(false),
-      firstVisibleLine(0), fontSize(16), gutterWidth(50), mode('n') {
+// Text color for each TokenStyle
+static const unsigned char styleColors[STYLE_COUNT][3] = {
+    { 220, 220, 220 },  // plain
+    { 197, 134, 192 },  // keyword
+    {  86, 156, 214 },  // type
+    { 206, 145, 120 },  // string
+    { 181, 206, 168 },  // number
+    { 106, 153,  85 },  // comment
+    { 155, 155, 155 },  // preprocessor
+    { 156, 220, 254 },  // JSON key
+    { 244,  71,  71 },  // error
+    { 220, 200,  80 },  // warning
+    {  80, 200, 120 },  // info
+    { 128, 128, 128 },  // debug
+};
+
+TextEditor::TextEditor(int X, int Y, int W, int H, const char* backendName)
+    : Fl_Widget(X, Y, W, H), buffers(new Buffer[8]), bufferCount(0), bufferCapacity(8), current(0),
+      historyBudget(Document::DEFAULT_HISTORY_BUDGET), pagedThreshold(Document::DEFAULT_PAGED_THRESHOLD), doc(nullptr),
+      regex(new RegexSearch(regexNotifyCb, this)), regexVersion(0), watcher(new FileWatch()), changesVersion(-1),
+      firstVisibleLine(0), firstVisibleRow(0), softWrap(false),
+      lineHeight(20), charWidth(10), gutterWidth(50), fontSize(16), mode('n'), promptLen(0), pendingLen(0),
+      rowLines(nullptr), rowColumns(nullptr), drawnRowLines(nullptr), drawnRowColumns(nullptr), rowCapacity(0),
+      drawnRows(0), dirtyFrom(-1), dirtyTo(-1), drawnFirstVisibleLine(-1), drawnFirstVisibleRow(-1), drawnCursorLine(-1),
+      drawnSelLo(-1), drawnSelHi(-1), drawnCaretCount(0), drawnFontSize(0),
+      lineBase(0), drawnLineBase(0),
+      keyPending(false), keyStartUs(0), keyStartAllocs(0) {
+    prompt[0] = '\0';
+    snprintf(backend, sizeof(backend), "%s", backendName);
+
+    if (watcher->getFd() >= 0) Fl::add_fd(watcher->getFd(), FL_READ, watchCb, this);
+
+    // The first untitled buffer picks up unsaved edits from a session that crashed
+    newFile();
     strcpy(statusMsg, "-- NORMAL --");
+    if (doc->getRecoveredEdits() > 0) sprintf(statusMsg, "Recovered %d unsaved edits", doc->getRecoveredEdits());
 }
 
-void TextEditor::saveState() {
-    char* text = new char[gapBuffer.getLength() + 1];
-    gapBuffer.getText(text, gapBuffer.getLength() + 1);
-
-    EditorState state(text, cursorPos, selectionStart, selectionEnd);
-    undoStack.push(state);
-    redoStack.clear();
-
-    delete[] text;
+TextEditor::~TextEditor() {
+    if (watcher->getFd() >= 0) Fl::remove_fd(watcher->getFd());
+    Fl::remove_timeout(reloadCb, this);
+    Fl::remove_timeout(changesRestartCb, this);
+    delete watcher;
+    delete regex;
+    for (int i = 0; i < bufferCount; i++) delete buffers[i].doc;
+    delete[] buffers;
+    delete[] rowLines;
+    delete[] rowColumns;
+    delete[] drawnRowLines;
+    delete[] drawnRowColumns;
 }
 
-void TextEditor::deleteSelection() {
-    if (!hasSelection()) return;
+// Ensure the cursor is always inside the visible window. Only the rows
+// between the top of the view and the cursor are measured, and no more
+// than a screenful of them.
+void TextEditor::updateScroll() {
+    TextBuffer* buffer = doc->getBuffer();
+    WrapLayout* wrap = doc->getWrap();
+    int cursorPos = doc->getCursor();
+    int currentLine = buffer->lineOfOffset(cursorPos);
+    int currentRow = wrap->rowOfColumn(buffer, currentLine, doc->getColumns()->columnOf(buffer, currentLine, cursorPos));
 
-    int start = std::min(selectionStart, selectionEnd);
-    int end = std::max(selectionStart, selectionEnd);
+    int visibleLines = (h() - 30) / lineHeight;
 
-    gapBuffer.moveCursorTo(start);
-    for (int i = start; i < end; i++) {
-        gapBuffer.deleteRight();
+    if (currentLine < firstVisibleLine || (currentLine == firstVisibleLine && currentRow < firstVisibleRow)) {
+        firstVisibleLine = currentLine;
+        firstVisibleRow = currentRow;
+    } else if (wrap->rowsBetween(buffer, firstVisibleLine, firstVisibleRow, currentLine, currentRow, visibleLines) >=
+               visibleLines) {
+        // Cursor on the bottom row
+        firstVisibleLine = currentLine;
+        firstVisibleRow = currentRow;
+        wrap->advance(buffer, firstVisibleLine, firstVisibleRow, -(visibleLines - 1));
     }
+    if (firstVisibleLine != drawnFirstVisibleLine || firstVisibleRow != drawnFirstVisibleRow) damage(FL_DAMAGE_SCROLL);
+}
 
-    cursorPos = start;
-    clearSelection();
+// Rows are as wide as the text area; a new width only changes how the
+// cached column counts divide into rows
+void TextEditor::updateWrapWidth() {
+    WrapLayout* wrap = doc->getWrap();
+    int width = softWrap ? std::max((w() - gutterWidth - 8) / charWidth, 1) : 0;
+    if (width == wrap->getWidth()) return;
+    wrap->setWidth(width);
+    int rows = wrap->rowsIn(doc->getBuffer(), firstVisibleLine);
+    if (firstVisibleRow >= rows) firstVisibleRow = rows - 1;
+    updateScroll();
 }
 
-// Ensure the cursor is always inside the visible window
-void TextEditor::updateScroll() {
-    int currentLine = 0;
-    for(int i = 0; i < cursorPos; i++) {
-        if(gapBuffer.getCharAt(i) == '\n') currentLine++;
+// Which line and starting column each screen row shows, walking down from
+// the top of the view
+void TextEditor::layoutRows(int rows) {
+    if (rows > rowCapacity) {
+        int newCapacity = rows + 32;
+        int* grown[4] = { new int[newCapacity], new int[newCapacity], new int[newCapacity], new int[newCapacity] };
+        memcpy(grown[2], drawnRowLines, drawnRows * sizeof(int));
+        memcpy(grown[3], drawnRowColumns, drawnRows * sizeof(int));
+        delete[] rowLines;
+        delete[] rowColumns;
+        delete[] drawnRowLines;
+        delete[] drawnRowColumns;
+        rowLines = grown[0];
+        rowColumns = grown[1];
+        drawnRowLines = grown[2];
+        drawnRowColumns = grown[3];
+        rowCapacity = newCapacity;
     }
 
-    int visibleLines = (h() - 30) / lineHeight;
+    TextBuffer* buffer = doc->getBuffer();
+    WrapLayout* wrap = doc->getWrap();
+    int width = wrap->getWidth();
+    int line = firstVisibleLine, row = firstVisibleRow;
+    for (int r = 0; r < rows; r++) {
+        rowLines[r] = line;
+        rowColumns[r] = row * width;
+        if (row + 1 < wrap->rowsIn(buffer, line)) {
+            row++;
+        } else {
+            line++;
+            row = 0;
+        }
+    }
+}
 
-    if (currentLine >= firstVisibleLine + visibleLines) {
-        firstVisibleLine = currentLine - visibleLines + 1;
+// How many rows the view moved down since the last frame (negative when
+// it moved up), found by locating the old top row in the new layout or
+// the other way round; rows when nothing on screen can be kept
+int TextEditor::scrollDelta(int rows) const {
+    if (firstVisibleLine == drawnFirstVisibleLine && firstVisibleRow == drawnFirstVisibleRow) return 0;
+    for (int k = 1; k < drawnRows; k++) {
+        if (drawnRowLines[k] == rowLines[0] && drawnRowColumns[k] == rowColumns[0]) return k;
     }
-    if (currentLine < firstVisibleLine) {
-        firstVisibleLine = currentLine;
+    for (int k = 1; k < rows; k++) {
+        if (rowLines[k] == drawnRowLines[0] && rowColumns[k] == drawnRowColumns[0]) return -k;
     }
+    return rows;
 }
 
 // --- Drawing Logic ---
+// Full repaints happen on expose, resize and zoom. Otherwise draw() only
+// repaints rows whose content changed: lines marked by edits, the old and
+// new cursor lines, and lines whose selection state changed. Scrolling
+// moves the retained pixels with fl_scroll and paints the exposed rows.
 void TextEditor::draw() {
+    if (!Metrics::enabled) {
+        drawFrame();
+        return;
+    }
+    long long started = Metrics::nowUs();
+    drawFrame();
+    long long now = Metrics::nowUs();
+    Metrics::frameTime.add(now - started);
+    if (keyPending) {
+        Metrics::keyToPaint.add(now - keyStartUs);
+        Metrics::allocsPerKey.add(Metrics::allocations() - keyStartAllocs);
+        keyPending = false;
+    }
+}
+
+void TextEditor::drawFrame() {
     fl_font(FL_COURIER, fontSize);
     lineHeight = fontSize + 4;
     charWidth = (int)fl_width('M');
+    // Paged files number lines from the start of the file, which takes a
+    // wider gutter; the numbers appear as the background count reaches them
+    int gutter = doc->isPaged() ? 11 * charWidth : 50;
+    bool gutterChanged = gutter != gutterWidth;
+    gutterWidth = gutter;
+    lineBase = doc->getLineBase();
+    if (doc->isPaged() && doc->getIndexProgress() < 1 && !Fl::has_timeout(indexTimerCb, this))
+        Fl::add_timeout(0.5, indexTimerCb, this);
+    updateWrapWidth();
+
+    TextBuffer* buffer = doc->getBuffer();
+    int cursorLine = buffer->lineOfOffset(doc->getCursor());
+    int selLo = -1, selHi = -1;
+    if (doc->hasSelection()) doc->getSelection(selLo, selHi);
+
+    // Regex results describe an older snapshot once the text changes;
+    // stop the worker and search again when typing pauses
+    if (regex->isActive() && regexVersion != doc->getVersion()) {
+        regex->cancel();
+        Fl::remove_timeout(regexRestartCb, this);
+        Fl::add_timeout(0.3, regexRestartCb, this);
+    }
 
-    // Background
-    fl_color(30, 30, 30);
-    fl_rectf(x(), y(), w(), h());
-
-    // Gutter
-    fl_color(22, 22, 22);
-    fl_rectf(x(), y(), gutterWidth, h());
-    fl_color(50, 50, 50);
-    fl_line(x() + gutterWidth, y(), x() + gutterWidth, y() + h());
+    // Gutter marks show edited lines as modified at once; the diff that
+    // settles them runs when typing pauses
+    if (changesVersion != doc->getVersion()) {
+        changesVersion = doc->getVersion();
+        Fl::remove_timeout(changesRestartCb, this);
+        Fl::add_timeout(0.2, changesRestartCb, this);
+    }
 
-    int textAreaX = x() + gutterWidth + 8;
-    int cy = y() + lineHeight;
+    int changedFrom, changedTo;
+    doc->takeChangedLines(changedFrom, changedTo);
+    if (changedFrom >= 0) damageLines(changedFrom, changedTo);
+
+    // An edit can restyle lines below it (e.g. opening a block comment);
+    // re-lex through the visible window and repaint those lines too
+    int rows = visibleRows();
+    layoutRows(rows);
+    Highlighter* highlighter = doc->getHighlighter();
+    highlighter->ensureValid(buffer, firstVisibleLine + rows);
+    highlighter->takeRestyledLines(changedFrom, changedTo);
+    if (changedFrom >= 0) damageLines(changedFrom, changedTo);
+
+    bool full = (damage() & ~(FL_DAMAGE_USER1 | FL_DAMAGE_SCROLL)) != 0 ||
+                drawnFirstVisibleLine < 0 || drawnFontSize != fontSize || drawnRows != rows || gutterChanged ||
+                lineBase != drawnLineBase;
+
+    if (full) {
+        // Background
+        fl_color(30, 30, 30);
+        fl_rectf(x(), y(), w(), h());
+
+        // Gutter
+        fl_color(22, 22, 22);
+        fl_rectf(x(), y(), gutterWidth, h());
+        fl_color(50, 50, 50);
+        fl_line(x() + gutterWidth, y(), x() + gutterWidth, y() + h());
+
+        for (int r = 0; r < rows; r++) drawRow(r, cursorLine);
+    } else {
+        int delta = scrollDelta(rows);
+        if (delta != 0) {
+            if (delta > -rows && delta < rows) {
+                // Shift what is already on screen and paint only the new rows
+                fl_scroll(x(), y() + 4, w(), rows * lineHeight, 0, -delta * lineHeight,
+                          scrollExposeCb, this);
+            } else {
+                for (int r = 0; r < rows; r++) drawRow(r, cursorLine);
+            }
+        }
 
-    // Calculate cursor line index
-    int cursorLineIndex = 0;
-    for(int i=0; i<cursorPos; i++) if(gapBuffer.getCharAt(i) == '\n') cursorLineIndex++;
+        // Rows whose content changed since the last frame
+        int ranges[5][2] = {
+            { dirtyFrom, dirtyTo },
+            { drawnCursorLine, drawnCursorLine },
+            { cursorLine, cursorLine },
+            { -1, -1 },
+            { -1, -1 },
+        };
+        // Extra cursors move together; repaint every row while any are shown
+        if (doc->getCaretCount() > 0 || drawnCaretCount > 0) {
+            ranges[0][0] = 0;
+            ranges[0][1] = 0x7fffffff;
+        }
+        if (selLo != drawnSelLo || selHi != drawnSelHi) {
+            if (selLo < 0 || drawnSelLo < 0) {
+                int lo = selLo < 0 ? drawnSelLo : selLo;
+                int hi = selLo < 0 ? drawnSelHi : selHi;
+                ranges[3][0] = buffer->lineOfOffset(lo);
+                ranges[3][1] = buffer->lineOfOffset(hi);
+            } else {
+                // Only the ends that moved changed highlight
+                ranges[3][0] = buffer->lineOfOffset(std::min(selLo, drawnSelLo));
+                ranges[3][1] = buffer->lineOfOffset(std::max(selLo, drawnSelLo));
+                ranges[4][0] = buffer->lineOfOffset(std::min(selHi, drawnSelHi));
+                ranges[4][1] = buffer->lineOfOffset(std::max(selHi, drawnSelHi));
+            }
+        }
 
-    // Highlight Active Line
-    int activeLineY = y() + (cursorLineIndex - firstVisibleLine) * lineHeight;
-    if (activeLineY >= y() && activeLineY < y() + h() - 30) {
-        fl_color(45, 45, 45);
-        fl_rectf(x() + gutterWidth + 1, activeLineY, w() - gutterWidth, lineHeight);
-    }
-
-    // Text Drawing Loop
-    int textLen = gapBuffer.getLength();
-    int currentLine = 0;
-    int cx = textAreaX;
-
-    // Optimization: Skip lines before firstVisibleLine
-    int startIndex = 0;
-    if (firstVisibleLine > 0) {
-        int linesSkipped = 0;
-        for (int i = 0; i < textLen; i++) {
-            if (gapBuffer.getCharAt(i) == '\n') {
-                linesSkipped++;
-                if (linesSkipped == firstVisibleLine) {
-                    startIndex = i + 1;
-                    currentLine = linesSkipped;
+        // ...and rows now showing a different part of the text than the
+        // pixels they kept, as when an edit changes how many rows a
+        // wrapped line takes
+        for (int r = 0; r < rows; r++) {
+            int line = rowLines[r];
+            int kept = r + delta;
+            if (kept >= 0 && kept < drawnRows && (drawnRowLines[kept] != line || drawnRowColumns[kept] != rowColumns[r])) {
+                drawRow(r, cursorLine);
+                continue;
+            }
+            for (int k = 0; k < 5; k++) {
+                if (ranges[k][0] >= 0 && line >= ranges[k][0] && line <= ranges[k][1]) {
+                    drawRow(r, cursorLine);
                     break;
                 }
             }
         }
     }
 
-    // Draw first line number
-    fl_color(90, 90, 90);
-    char lineNumStr[16];
-    sprintf(lineNumStr, "%3d", currentLine + 1);
-    fl_draw(lineNumStr, x() + 5, cy);
-
-    for (int i = startIndex; i < textLen; i++) {
-        if (cy > y() + h() - 30) break;
+    drawStatusBar(cursorLine);
+
+    memcpy(drawnRowLines, rowLines, rows * sizeof(int));
+    memcpy(drawnRowColumns, rowColumns, rows * sizeof(int));
+    drawnRows = rows;
+    drawnFirstVisibleLine = firstVisibleLine;
+    drawnFirstVisibleRow = firstVisibleRow;
+    drawnCursorLine = cursorLine;
+    drawnSelLo = selLo;
+    drawnSelHi = selHi;
+    drawnCaretCount = doc->getCaretCount();
+    drawnFontSize = fontSize;
+    drawnLineBase = lineBase;
+    dirtyFrom = dirtyTo = -1;
+}
 
-        char c = gapBuffer.getCharAt(i);
+int TextEditor::visibleRows() const {
+    return (h() - 30) / lineHeight;
+}
 
-        bool isSelected = hasSelection() &&
-                        ((selectionStart <= i && i < selectionEnd) ||
-                         (selectionEnd <= i && i < selectionStart));
+// Repaints one screen row: background band, line number, change mark,
+// text and cursor. Rows continuing a wrapped line leave the gutter blank
+// but for the mark.
+void TextEditor::drawRow(int row, int cursorLine) {
+    TextBuffer* buffer = doc->getBuffer();
+    int line = rowLines[row];
+    int column = rowColumns[row];
+    int bandY = y() + row * lineHeight + 4;
+    int baselineY = y() + (row + 1) * lineHeight;
+    int textAreaX = x() + gutterWidth + 8;
 
-        if (isSelected) {
-            fl_color(60, 100, 160);
-            fl_rectf(cx, cy - lineHeight + 4, charWidth, lineHeight);
-        }
+    // Gutter
+    fl_color(22, 22, 22);
+    fl_rectf(x(), bandY, gutterWidth, lineHeight);
+    fl_color(50, 50, 50);
+    fl_line(x() + gutterWidth, bandY, x() + gutterWidth, bandY + lineHeight - 1);
 
-        if (c == '\n') {
-            cy += lineHeight;
-            cx = textAreaX;
-            currentLine++;
-
-            if (cy <= y() + h() - 30) {
-                fl_color(currentLine == cursorLineIndex ? 200 : 90,
-                         currentLine == cursorLineIndex ? 200 : 90,
-                         currentLine == cursorLineIndex ? 200 : 90);
-                sprintf(lineNumStr, "%3d", currentLine + 1);
-                fl_draw(lineNumStr, x() + 5, cy);
-            }
-        } else {
-            if (isSelected) fl_color(FL_WHITE);
-            else fl_color(220, 220, 220);
+    // Highlight Active Line
+    if (line == cursorLine) fl_color(45, 45, 45);
+    else fl_color(30, 30, 30);
+    fl_rectf(x() + gutterWidth + 1, bandY, w() - gutterWidth - 1, lineHeight);
+
+    if (line >= buffer->lineCount()) return;
+
+    if (column == 0 && lineBase >= 0) {
+        fl_color(line == cursorLine ? 200 : 90,
+                 line == cursorLine ? 200 : 90,
+                 line == cursorLine ? 200 : 90);
+        char lineNumStr[24];
+        sprintf(lineNumStr, "%3lld", lineBase + line + 1);
+        fl_draw(lineNumStr, x() + 5, baselineY);
+    }
 
-            char str[2] = {c, '\0'};
-            fl_draw(str, cx, cy);
-            cx += charWidth;
+    // Changes since the last save: a bar beside added or modified lines,
+    // a tick where lines were removed
+    int marks = doc->getChanges()->markOf(line);
+    if (marks != 0) {
+        int markX = x() + gutterWidth - 5;
+        if (marks & (ChangeTracker::MARK_ADDED | ChangeTracker::MARK_MODIFIED)) {
+            if (marks & ChangeTracker::MARK_ADDED) fl_color(90, 170, 90);
+            else fl_color(80, 130, 200);
+            fl_rectf(markX, bandY, 3, lineHeight);
         }
+        fl_color(210, 80, 80);
+        if ((marks & ChangeTracker::MARK_REMOVED_ABOVE) && column == 0) fl_rectf(markX - 3, bandY, 6, 2);
+        bool lastRow = row + 1 >= visibleRows() || rowLines[row + 1] != line;
+        if ((marks & ChangeTracker::MARK_REMOVED_BELOW) && lastRow) fl_rectf(markX - 3, bandY + lineHeight - 2, 6, 2);
     }
 
-    // Draw Cursor
-    int cursorCol = 0;
-    int scanPos = cursorPos;
-    while(scanPos > 0 && gapBuffer.getCharAt(scanPos-1) != '\n') {
-        scanPos--;
-        cursorCol++;
+    drawLineText(line, column, baselineY, textAreaX);
+
+    WrapLayout* wrap = doc->getWrap();
+    if (line == cursorLine) {
+        int cursorColumn = doc->getColumns()->columnOf(buffer, line, doc->getCursor());
+        if (wrap->rowOfColumn(buffer, line, cursorColumn) * wrap->getWidth() == column)
+            drawCursor(cursorColumn - column, doc->getCursor(), baselineY, textAreaX);
     }
 
-    int cursorScreenY = y() + (cursorLineIndex - firstVisibleLine + 1) * lineHeight;
-    int cursorScreenX = textAreaX + (cursorCol * charWidth);
+    // Extra cursors on this line, found by offset
+    int lineEnd = buffer->lineEnd(line);
+    for (int i = doc->caretFrom(buffer->offsetOfLine(line)); i < doc->getCaretCount(); i++) {
+        int caretPos, lo, hi;
+        doc->getCaret(i, caretPos, lo, hi);
+        if (caretPos > lineEnd) break;
+        int caretColumn = doc->getColumns()->columnOf(buffer, line, caretPos);
+        if (wrap->rowOfColumn(buffer, line, caretColumn) * wrap->getWidth() == column)
+            drawCursor(caretColumn - column, caretPos, baselineY, textAreaX);
+    }
+}
 
-    if (cursorLineIndex >= firstVisibleLine && cursorScreenY <= y() + h() - 25) {
-        if (mode == 'i') {
-            fl_color(FL_GREEN);
-            fl_rectf(cursorScreenX, cursorScreenY - lineHeight + 4, 2, lineHeight);
-        } else {
-            fl_color(FL_WHITE);
-            fl_rectf(cursorScreenX, cursorScreenY - lineHeight + 4, charWidth, lineHeight);
-            if (cursorPos < textLen && gapBuffer.getCharAt(cursorPos) != '\n') {
-                fl_color(FL_BLACK);
-                char str[2] = {gapBuffer.getCharAt(cursorPos), '\0'};
-                fl_draw(str, cursorScreenX, cursorScreenY);
-            }
+// column counts from the start of the cursor's screen row
+void TextEditor::drawCursor(int column, int cursorPos, int baselineY, int textAreaX) {
+    TextBuffer* buffer = doc->getBuffer();
+    ColumnIndex* columns = doc->getColumns();
+    int cursorScreenX = textAreaX + (column * charWidth);
+
+    if (mode == 'i') {
+        fl_color(FL_GREEN);
+        fl_rectf(cursorScreenX, baselineY - lineHeight + 4, 2, lineHeight);
+    } else {
+        fl_color(FL_WHITE);
+        fl_rectf(cursorScreenX, baselineY - lineHeight + 4, charWidth, lineHeight);
+        // The whole UTF-8 sequence under the cursor
+        if (cursorPos < buffer->getLength() && buffer->getCharAt(cursorPos) != '\n') {
+            char glyph[4];
+            int n = std::min(columns->nextChar(buffer, cursorPos) - cursorPos, 4);
+            buffer->read(cursorPos, n, glyph);
+            fl_color(FL_BLACK);
+            fl_draw(glyph, n, cursorScreenX, baselineY);
         }
     }
+}
 
-    // Status Bar
+void TextEditor::drawStatusBar(int cursorLine) {
+    int cursorCol = doc->getColumns()->columnOf(doc->getBuffer(), cursorLine, doc->getCursor());
     int barHeight = 30;
     int barY = y() + h() - barHeight;
     Fl_Color statusColor = (mode == 'i') ? fl_rgb_color(0, 122, 204) : fl_rgb_color(90, 50, 150);
@@ -184,52 +413,243 @@ void TextEditor::draw() {
 
     fl_color(FL_WHITE);
     fl_font(FL_COURIER_BOLD, 14);
+
+    // With stats on, their summary sits in the middle and the message is
+    // clipped before it
+    int messageRight = x() + w();
+    if (Metrics::enabled) {
+        char stats[128];
+        Metrics::summary(stats, sizeof(stats));
+        int statsX = x() + w() / 2 - (int)fl_width(stats) / 2;
+        fl_color(255, 220, 120);
+        fl_draw(stats, statsX, barY + 20);
+        fl_color(FL_WHITE);
+        messageRight = statsX - 10;
+    }
+    fl_push_clip(x(), barY, messageRight - x(), barHeight);
     fl_draw(statusMsg, x() + 10, barY + 20);
+    fl_pop_clip();
 
+    char lineText[24];
+    if (lineBase >= 0) sprintf(lineText, "%lld", lineBase + cursorLine + 1);
+    else strcpy(lineText, "?");
     char posInfo[100];
-    sprintf(posInfo, "Ln %d, Col %d | %d%%", cursorLineIndex + 1, cursorCol + 1, (int)(fontSize/1.6 * 10));
+    if (doc->getCaretCount() > 0)
+        sprintf(posInfo, "%d cursors | Ln %s, Col %d", doc->getCaretCount() + 1, lineText, cursorCol + 1);
+    else
+        sprintf(posInfo, "Ln %s, Col %d | %d%%", lineText, cursorCol + 1, (int)(fontSize/1.6 * 10));
     fl_draw(posInfo, x() + w() - 200, barY + 20);
+
+    // Buffer name, position in the buffer list and undo memory in use,
+    // left of the cursor info
+    char bufferInfo[160];
+    long long history = doc->getHistoryBytes();
+    snprintf(bufferInfo, sizeof(bufferInfo), "%s%s [%d/%d]  undo %lld%s/%lldM", bufferName(current),
+             doc->isModified() ? " +" : "", current + 1, bufferCount,
+             history < (1 << 20) ? history >> 10 : history >> 20, history < (1 << 20) ? "K" : "M",
+             doc->getHistoryBudget() >> 20);
+    if (doc->isPaged()) {
+        int used = strlen(bufferInfo);
+        snprintf(bufferInfo + used, sizeof(bufferInfo) - used, "  page %d/%d", doc->getPage() + 1, doc->getPageCount());
+        used = strlen(bufferInfo);
+        if (doc->getIndexProgress() < 1)
+            snprintf(bufferInfo + used, sizeof(bufferInfo) - used, " (lines %d%%)", (int)(doc->getIndexProgress() * 100));
+    }
+    fl_draw(bufferInfo, x() + w() - 220 - (int)fl_width(bufferInfo), barY + 20);
+    fl_font(FL_COURIER, fontSize);
+}
+
+// fl_scroll callback: paints the rows uncovered by a scroll
+void TextEditor::scrollExposeCb(void* data, int X, int Y, int W, int H) {
+    TextEditor* self = (TextEditor*)data;
+    int cursorLine = self->doc->getBuffer()->lineOfOffset(self->doc->getCursor());
+    int first = (Y - self->y() - 4) / self->lineHeight;
+    int last = (Y + H - 1 - self->y() - 4) / self->lineHeight;
+    if (first < 0) first = 0;
+    if (last >= self->visibleRows()) last = self->visibleRows() - 1;
+
+    fl_push_clip(X, Y, W, H);
+    for (int r = first; r <= last; r++) self->drawRow(r, cursorLine);
+    fl_pop_clip();
+}
+
+// Marks lines for repaint on the next partial redraw
+void TextEditor::damageLines(int from, int to) {
+    if (dirtyFrom < 0 || from < dirtyFrom) dirtyFrom = from;
+    if (to > dirtyTo) dirtyTo = to;
+    damage(FL_DAMAGE_USER1);
+}
+
+// Cursor, selection and status changes are worked out in draw()
+void TextEditor::redrawView() {
+    damage(FL_DAMAGE_USER1);
+}
+
+// Draws one screen row of a line, from firstColumn on, as runs of
+// same-styled text read straight from the buffer's contiguous chunks,
+// colored by syntax token, over search match highlights and at most one
+// selection rectangle. Byte offsets become screen columns through the
+// document's column index, which is a subtraction on ASCII lines.
+void TextEditor::drawLineText(int line, int firstColumn, int baselineY, int textAreaX) {
+    TextBuffer* buffer = doc->getBuffer();
+    ColumnIndex* columns = doc->getColumns();
+    int lineStart = buffer->offsetOfLine(line);
+    int lineEnd = buffer->lineEnd(line);
+
+    // A wrapped row holds exactly the wrap width; otherwise nothing past
+    // the right edge is visible
+    int width = doc->getWrap()->getWidth();
+    int maxCols = width > 0 ? width : (w() - gutterWidth) / charWidth + 1;
+    int rowStart = columns->offsetAt(buffer, line, firstColumn);
+    int drawEnd = columns->offsetAt(buffer, line, firstColumn + maxCols);
+    // Only the line's last row shows the cell for its '\n'
+    bool lastRow = drawEnd == lineEnd;
+    int cellsEnd = lastRow ? lineEnd + 1 : drawEnd;
+
+    // Search matches on the visible part of the row, including one that
+    // starts on the row before
+    const Searcher& searcher = doc->getSearcher();
+    if (!searcher.isEmpty()) {
+        fl_color(110, 90, 30);
+        int m = searcher.length();
+        int match = searcher.findForward(buffer, std::max(rowStart - m + 1, lineStart), drawEnd);
+        while (match >= 0) {
+            int lo = columns->columnOf(buffer, line, std::max(match, rowStart)) - firstColumn;
+            int hi = columns->columnOf(buffer, line, std::min(match + m, cellsEnd)) - firstColumn;
+            fl_rectf(textAreaX + lo * charWidth, baselineY - lineHeight + 4, (hi - lo) * charWidth, lineHeight);
+            match = searcher.findForward(buffer, match + m, drawEnd);
+        }
+    }
+    if (regexCurrent()) {
+        int starts[64], ends[64];
+        int n = regex->matchesIn(rowStart, drawEnd, starts, ends, 64);
+        fl_color(110, 90, 30);
+        for (int i = 0; i < n; i++) {
+            int lo = columns->columnOf(buffer, line, std::max(starts[i], rowStart)) - firstColumn;
+            int hi = columns->columnOf(buffer, line, std::min(ends[i], cellsEnd)) - firstColumn;
+            fl_rectf(textAreaX + lo * charWidth, baselineY - lineHeight + 4, (hi - lo) * charWidth, lineHeight);
+        }
+    }
+
+    int selLo = rowStart, selHi = rowStart;
+    if (doc->hasSelection()) {
+        int selMin, selMax;
+        doc->getSelection(selMin, selMax);
+        selLo = std::max(selMin, rowStart);
+        selHi = std::min(selMax, drawEnd);
+        bool newline = lastRow && selMin <= lineEnd && selMax > lineEnd;
+        if (selLo < selHi || newline) {
+            // A selected newline shows as one extra highlighted cell
+            int lo = columns->columnOf(buffer, line, selLo);
+            int cells = std::max(columns->columnOf(buffer, line, selHi) - lo, 0) + (newline ? 1 : 0);
+            fl_color(60, 100, 160);
+            fl_rectf(textAreaX + (lo - firstColumn) * charWidth, baselineY - lineHeight + 4, cells * charWidth,
+                     lineHeight);
+        }
+        if (selHi < selLo) selHi = selLo;
+    }
+
+    // Extra cursors' selections; the one before the line and the first one
+    // after it can reach into it
+    fl_color(60, 100, 160);
+    int caretEnd = std::min(doc->caretFrom(lineEnd + 1) + 1, doc->getCaretCount());
+    for (int i = std::max(doc->caretFrom(lineStart) - 1, 0); i < caretEnd; i++) {
+        int caretPos, lo, hi;
+        doc->getCaret(i, caretPos, lo, hi);
+        if (lo < 0 || hi <= rowStart || lo > drawEnd) continue;
+        bool newline = lastRow && lo <= lineEnd && hi > lineEnd;
+        int from = columns->columnOf(buffer, line, std::max(lo, rowStart));
+        int cells = std::max(columns->columnOf(buffer, line, std::min(hi, drawEnd)) - from, 0) + (newline ? 1 : 0);
+        fl_rectf(textAreaX + (from - firstColumn) * charWidth, baselineY - lineHeight + 4, cells * charWidth,
+                 lineHeight);
+    }
+
+    // Syntax tokens for the line, from the highlighter's cache
+    int tokenCount;
+    const Token* tokens = doc->getHighlighter()->tokensFor(buffer, line, tokenCount);
+    int t = 0;
+
+    int pos = rowStart;
+    int currentColor = -1;   // style index, or STYLE_COUNT for selected text
+    while (pos < drawEnd) {
+        const char* chunk;
+        int avail = std::min(buffer->chunkAt(pos, &chunk), drawEnd - pos);
+
+        // Split the chunk where a token starts or ends; tokens are in bytes
+        int offset = pos - lineStart;
+        while (t < tokenCount && tokens[t].start + tokens[t].length <= offset) t++;
+        int style = STYLE_PLAIN;
+        int runEnd = pos + avail;
+        if (t < tokenCount) {
+            if (tokens[t].start <= offset) {
+                style = tokens[t].style;
+                runEnd = std::min(runEnd, lineStart + tokens[t].start + tokens[t].length);
+            } else {
+                runEnd = std::min(runEnd, lineStart + tokens[t].start);
+            }
+        }
+
+        // ...and where the selection starts or ends
+        bool selected = pos >= selLo && pos < selHi;
+        if (pos < selLo && runEnd > selLo) runEnd = selLo;
+        if (selected && runEnd > selHi) runEnd = selHi;
+        int n = runEnd - pos;
+
+        int color = selected ? STYLE_COUNT : style;
+        if (color != currentColor) {
+            if (selected) fl_color(FL_WHITE);
+            else fl_color(styleColors[style][0], styleColors[style][1], styleColors[style][2]);
+            currentColor = color;
+        }
+
+        // A run can end inside a multibyte character (chunk ends, tokens cut
+        // by a lexer that only knows ASCII); stop before it, or draw it
+        // whole from a copy when it is the first thing in the run
+        int screenX = textAreaX + (columns->columnOf(buffer, line, pos) - firstColumn) * charWidth;
+        if (pos + n < drawEnd) {
+            int boundary = columns->offsetAt(buffer, line, columns->columnOf(buffer, line, pos + n));
+            if (boundary == pos) {
+                char glyph[4];
+                n = std::min(columns->nextChar(buffer, pos) - pos, 4);
+                buffer->read(pos, n, glyph);
+                fl_draw(glyph, n, screenX, baselineY);
+                pos += n;
+                continue;
+            }
+            n = boundary - pos;
+        }
+        fl_draw(chunk, n, screenX, baselineY);
+        pos += n;
+    }
 }
 
 // --- Helper: Mouse to Index ---
 int TextEditor::xyToIndex(int mouseX, int mouseY) {
+    // Screen rows are the bands drawRow paints
     int textAreaX = x() + gutterWidth + 8;
-    int clickVisualLine = (mouseY - y()) / lineHeight;
-    int targetLine = clickVisualLine + firstVisibleLine - 1;
-    if (targetLine < 0) targetLine = 0;
+    int clickRow = (mouseY - y() - 4) / lineHeight;
+    if (clickRow < 0) clickRow = 0;
 
     int targetCol = (mouseX - textAreaX + (charWidth/2)) / charWidth;
     if (targetCol < 0) targetCol = 0;
 
-    int currentLine = 0;
-    int len = gapBuffer.getLength();
-    int i = 0;
-
-    while (currentLine < targetLine && i < len) {
-        if (gapBuffer.getCharAt(i) == '\n') currentLine++;
-        i++;
-    }
+    TextBuffer* buffer = doc->getBuffer();
+    WrapLayout* wrap = doc->getWrap();
+    int line = firstVisibleLine, row = firstVisibleRow;
+    // Below the last row
+    if (wrap->advance(buffer, line, row, clickRow) < clickRow) return buffer->getLength();
 
-    int currentCol = 0;
-    while (currentCol < targetCol && i < len && gapBuffer.getCharAt(i) != '\n') {
-        i++;
-        currentCol++;
-    }
-
-    return i;
+    // Past the end of a row that continues below, the cursor stays on it
+    int width = wrap->getWidth();
+    if (width > 0 && targetCol >= width && row + 1 < wrap->rowsIn(buffer, line)) targetCol = width - 1;
+    return doc->getColumns()->offsetAt(buffer, line, row * width + targetCol);
 }
 
 // --- Clipboard & Zoom ---
 void TextEditor::copyToClipboard() {
-    if (!hasSelection()) return;
-    int start = std::min(selectionStart, selectionEnd);
-    int end = std::max(selectionStart, selectionEnd);
-    int len = end - start;
-
-    char* text = new char[len + 1];
-    gapBuffer.moveCursorTo(start);
-    for(int i=0; i<len; i++) text[i] = gapBuffer.getCharAt(start + i);
-    text[len] = '\0';
+    if (!doc->hasSelection()) return;
+    int len;
+    char* text = doc->copySelection(len);
 
     Fl::copy(text, len, 1);
     delete[] text;
@@ -238,9 +658,9 @@ void TextEditor::copyToClipboard() {
 
 void TextEditor::cutToClipboard() {
     copyToClipboard();
-    saveState();
-    deleteSelection();
-    redraw();
+    doc->deleteSelection();
+    updateScroll();
+    redrawView();
     strcpy(statusMsg, "Cut");
 }
 
@@ -251,19 +671,46 @@ void TextEditor::pasteFromClipboard() {
 void TextEditor::zoomIn() { if (fontSize < 32) { fontSize += 2; redraw(); } }
 void TextEditor::zoomOut() { if (fontSize > 8) { fontSize -= 2; redraw(); } }
 
+void TextEditor::toggleWrap() {
+    softWrap = !softWrap;
+    if (!softWrap) firstVisibleRow = 0;
+    updateWrapWidth();
+    updateScroll();
+    strcpy(statusMsg, softWrap ? "Soft wrap on" : "Soft wrap off");
+    redraw();
+}
+
 // --- Event Handling ---
 int TextEditor::handle(int event) {
+    if (!Metrics::enabled) return handleEvent(event);
+    long long started = Metrics::nowUs();
+    if ((event == FL_KEYDOWN || event == FL_PASTE) && !keyPending) {
+        keyPending = true;
+        keyStartUs = started;
+        keyStartAllocs = Metrics::allocations();
+    }
+    int result = handleEvent(event);
+    Metrics::handleTime.add(Metrics::nowUs() - started);
+    return result;
+}
+
+int TextEditor::handleEvent(int event) {
     switch(event) {
         case FL_FOCUS: return 1;
 
         case FL_PUSH: {
             if (Fl::event_button() == FL_LEFT_MOUSE) {
                 int newPos = xyToIndex(Fl::event_x(), Fl::event_y());
-                selectionStart = newPos;
-                selectionEnd = newPos;
-                selecting = true;
-                cursorPos = newPos;
-                redraw();
+                // Ctrl+click adds a cursor; a plain click leaves just one
+                if (Fl::event_state(FL_CTRL)) {
+                    doc->addCaret(newPos);
+                    redrawView();
+                    take_focus();
+                    return 1;
+                }
+                doc->clearCarets();
+                doc->setSelection(newPos, newPos);
+                redrawView();
                 take_focus();
                 return 1;
             }
@@ -271,38 +718,37 @@ int TextEditor::handle(int event) {
         }
 
         case FL_DRAG: {
-             if (selecting) {
-                cursorPos = xyToIndex(Fl::event_x(), Fl::event_y());
-                selectionEnd = cursorPos;
-                redraw();
+             if (doc->isSelecting()) {
+                doc->setSelection(doc->getSelectionAnchor(), xyToIndex(Fl::event_x(), Fl::event_y()));
+                redrawView();
                 return 1;
              }
              return 0;
         }
 
         case FL_RELEASE: {
-            selecting = false;
+            doc->endMouseSelection();
             return 1;
         }
 
         case FL_MOUSEWHEEL: {
-            firstVisibleLine += (Fl::event_dy() * 3);
-            if(firstVisibleLine < 0) firstVisibleLine = 0;
-            redraw();
+            // Three screen rows per notch, stopping at the first and last;
+            // a paged file goes on into the next or previous page
+            int delta = Fl::event_dy() * 3;
+            int moved = doc->getWrap()->advance(doc->getBuffer(), firstVisibleLine, firstVisibleRow, delta);
+            if (moved != delta && doc->turnPage(delta > 0 ? 1 : -1)) {
+                firstVisibleLine = firstVisibleRow = 0;
+                updateScroll();
+            }
+            damage(FL_DAMAGE_SCROLL);
             return 1;
         }
 
         case FL_PASTE: {
-            saveState();
-            if (hasSelection()) deleteSelection();
-            const char* text = Fl::event_text();
-            int len = Fl::event_length();
-            gapBuffer.moveCursorTo(cursorPos);
-            for(int i=0; i<len; i++) gapBuffer.insert(text[i]);
-            cursorPos += len;
+            doc->typeText(Fl::event_text(), Fl::event_length(), false);
             updateScroll();
             strcpy(statusMsg, "Pasted");
-            redraw();
+            redrawView();
             return 1;
         }
 
@@ -315,90 +761,102 @@ int TextEditor::handle(int event) {
                 if (key == 'v') { pasteFromClipboard(); return 1; }
                 if (key == 'x') { cutToClipboard(); return 1; }
                 if (key == 'a') {
-                    selectionStart = 0;
-                    selectionEnd = gapBuffer.getLength();
-                    cursorPos = selectionEnd;
-                    redraw();
+                    doc->selectAll();
+                    redrawView();
                     return 1;
                 }
                 if (key == '=' || key == '+') { zoomIn(); return 1; }
                 if (key == '-') { zoomOut(); return 1; }
                 if (key == 'z') { undo(); return 1; }
                 if (key == 'y') { redo(); return 1; }
+                if (key == 'd') {
+                    if (!doc->addCaretAtNextMatch()) strcpy(statusMsg, "No more matches");
+                    updateScroll(); redrawView();
+                    return 1;
+                }
+                // Ctrl+Alt+Up/Down: a cursor on the row above or below
+                if (Fl::event_state(FL_ALT) && (key == FL_Up || key == FL_Down)) {
+                    doc->addCaretRow(key == FL_Up ? -1 : 1);
+                    updateScroll(); redrawView();
+                    return 1;
+                }
             }
 
+            if (mode == '/' || mode == ':') return handlePromptKey(key);
+
             // Navigation Keys
             bool shift = Fl::event_state(FL_SHIFT);
-            if (key == FL_Left) {
-                if (shift) startSelection(); else clearSelection();
-                if (cursorPos > 0) cursorPos--;
-                if (shift) updateSelection();
-                updateScroll(); redraw(); return 1;
-            }
-            if (key == FL_Right) {
-                if (shift) startSelection(); else clearSelection();
-                if (cursorPos < gapBuffer.getLength()) cursorPos++;
-                if (shift) updateSelection();
-                updateScroll(); redraw(); return 1;
-            }
-            if (key == FL_Up) {
-                if (shift) startSelection(); else clearSelection();
-                moveCursorUp();
-                if (shift) updateSelection();
-                updateScroll(); redraw(); return 1;
-            }
-            if (key == FL_Down) {
-                if (shift) startSelection(); else clearSelection();
-                moveCursorDown();
-                if (shift) updateSelection();
-                updateScroll(); redraw(); return 1;
-            }
+            if (key == FL_Left) { doc->moveLeft(shift); updateScroll(); redrawView(); return 1; }
+            if (key == FL_Right) { doc->moveRight(shift); updateScroll(); redrawView(); return 1; }
+            if (key == FL_Up) { doc->moveUp(shift); updateScroll(); redrawView(); return 1; }
+            if (key == FL_Down) { doc->moveDown(shift); updateScroll(); redrawView(); return 1; }
 
             // Insert Mode Typing
             if (mode == 'i') {
                 if (key == FL_BackSpace) {
-                    if(cursorPos > 0 || hasSelection()) {
-                        saveState();
-                        if (hasSelection()) deleteSelection();
-                        else {
-                            gapBuffer.moveCursorTo(cursorPos);
-                            gapBuffer.deleteLeft();
-                            cursorPos--;
-                        }
-                        updateScroll(); redraw();
-                    }
+                    doc->backspace();
+                    updateScroll(); redrawView();
                     return 1;
                 }
                 if (key == FL_Enter) {
-                    saveState();
-                    if (hasSelection()) deleteSelection();
-                    gapBuffer.moveCursorTo(cursorPos);
-                    gapBuffer.insert('\n');
-                    cursorPos++;
-                    updateScroll(); redraw(); return 1;
+                    doc->typeText("\n", 1, true);
+                    updateScroll(); redrawView(); return 1;
                 }
+                // Printable ASCII or a UTF-8 character, as FLTK composed it
                 const char* text = Fl::event_text();
-                if (text && text[0] >= 32 && text[0] <= 126 && !Fl::event_state(FL_CTRL)) {
-                    saveState();
-                    if (hasSelection()) deleteSelection();
-                    gapBuffer.moveCursorTo(cursorPos);
-                    gapBuffer.insert(text[0]);
-                    cursorPos++;
-                    updateScroll(); redraw(); return 1;
+                int len = Fl::event_length();
+                if (text && len > 0 && (unsigned char)text[0] >= 32 && text[0] != 127 && !Fl::event_state(FL_CTRL)) {
+                    doc->typeText(text, len, true);
+                    updateScroll(); redrawView(); return 1;
                 }
             }
 
+            if (mode == 'n' && pendingLen > 0) return handlePendingKey(key);
+
             // Mode Switching
-            if (mode == 'n' && key == 'i') { mode = 'i'; strcpy(statusMsg, "-- INSERT --"); redraw(); return 1; }
-            if (mode == 'i' && key == FL_Escape) { mode = 'n'; strcpy(statusMsg, "-- NORMAL --"); redraw(); return 1; }
+            if (mode == 'n' && key == 'i') { doc->breakUndoGroup(); mode = 'i'; strcpy(statusMsg, "-- INSERT --"); redrawView(); return 1; }
+            if (mode == 'i' && key == FL_Escape) { doc->breakUndoGroup(); mode = 'n'; strcpy(statusMsg, "-- NORMAL --"); redrawView(); return 1; }
 
             // Normal Mode Commands
             if (mode == 'n') {
-                if (key == 'h' && cursorPos > 0) { cursorPos--; updateScroll(); redraw(); return 1; }
-                if (key == 'l' && cursorPos < gapBuffer.getLength()) { cursorPos++; updateScroll(); redraw(); return 1; }
-                if (key == 'j') { moveCursorDown(); updateScroll(); redraw(); return 1; }
-                if (key == 'k') { moveCursorUp(); updateScroll(); redraw(); return 1; }
-                if (key == 'x') { saveState(); gapBuffer.moveCursorTo(cursorPos); gapBuffer.deleteRight(); redraw(); return 1; }
+                if (key == FL_Escape && doc->getCaretCount() > 0) { doc->clearCarets(); redrawView(); return 1; }
+                if (key == 'h') { doc->moveLeft(false); updateScroll(); redrawView(); return 1; }
+                if (key == 'l') { doc->moveRight(false); updateScroll(); redrawView(); return 1; }
+                if (key == 'j') { doc->moveDown(false); updateScroll(); redrawView(); return 1; }
+                if (key == 'k') { doc->moveUp(false); updateScroll(); redrawView(); return 1; }
+                if (key == 'x') { doc->deleteForward(); redrawView(); return 1; }
+
+                // Search and command prompts
+                const char* text = Fl::event_text();
+                char c = text ? text[0] : 0;
+                if (c == '/' || c == ':') {
+                    mode = c;
+                    promptLen = 0;
+                    prompt[0] = '\0';
+                    sprintf(statusMsg, "%c", c);
+                    redrawView();
+                    return 1;
+                }
+                if (c == 'n') { searchNext(true); return 1; }
+                if (c == 'N') { searchNext(false); return 1; }
+
+                // Vim motions
+                if (c == 'w') { doc->moveWordStart(false); updateScroll(); redrawView(); return 1; }
+                if (c == 'b') { doc->moveWordBack(false); updateScroll(); redrawView(); return 1; }
+                if (c == 'e') { doc->moveWordEnd(false); updateScroll(); redrawView(); return 1; }
+                if (c == '0') { doc->moveLineStart(false); updateScroll(); redrawView(); return 1; }
+                if (c == '$') { doc->moveLineEnd(false); updateScroll(); redrawView(); return 1; }
+                if (c == 'G') { jumpToLine(true); return 1; }
+                if (c == '%') {
+                    if (!doc->matchBracket()) strcpy(statusMsg, "No matching bracket");
+                    updateScroll(); redrawView();
+                    return 1;
+                }
+                if (c == 'g' || c == 'd' || c == 'c') {
+                    pendingKeys[0] = c;
+                    pendingLen = 1;
+                    return 1;
+                }
             }
             break;
         }
@@ -406,107 +864,566 @@ int TextEditor::handle(int event) {
     return Fl_Widget::handle(event);
 }
 
-// --- Standard Helper Methods ---
-void TextEditor::moveCursorUp() {
-    if (cursorPos == 0) return;
-    int lineStart = cursorPos;
-    while (lineStart > 0 && gapBuffer.getCharAt(lineStart - 1) != '\n') lineStart--;
-    if (lineStart == 0) return;
-    int col = cursorPos - lineStart;
-    int prevLineEnd = lineStart - 1;
-    int prevLineStart = prevLineEnd;
-    while (prevLineStart > 0 && gapBuffer.getCharAt(prevLineStart - 1) != '\n') prevLineStart--;
-    int prevLineLen = prevLineEnd - prevLineStart;
-    cursorPos = (col > prevLineLen) ? prevLineEnd : prevLineStart + col;
-}
-
-void TextEditor::moveCursorDown() {
-    int textLen = gapBuffer.getLength();
-    if (cursorPos >= textLen) return;
-    int lineStart = cursorPos;
-    while (lineStart > 0 && gapBuffer.getCharAt(lineStart - 1) != '\n') lineStart--;
-    int col = cursorPos - lineStart;
-    int lineEnd = cursorPos;
-    while (lineEnd < textLen && gapBuffer.getCharAt(lineEnd) != '\n') lineEnd++;
-    if (lineEnd >= textLen) return;
-    int nextLineStart = lineEnd + 1;
-    int nextLineEnd = nextLineStart;
-    while (nextLineEnd < textLen && gapBuffer.getCharAt(nextLineEnd) != '\n') nextLineEnd++;
-    int nextLineLen = nextLineEnd - nextLineStart;
-    cursorPos = (col > nextLineLen) ? nextLineEnd : nextLineStart + col;
+// Keys after the first of gg, or of d or c with a text object (diw, ci(
+// and the other i objects); anything else cancels the command
+int TextEditor::handlePendingKey(int key) {
+    const char* text = Fl::event_text();
+    // Shift on its own, on the way to ( or $
+    if (key != FL_Escape && (!text || Fl::event_length() == 0)) return 0;
+    char c = key == FL_Escape ? 0 : text[0];
+    if (c && pendingLen < (int)sizeof(pendingKeys) - 1) pendingKeys[pendingLen++] = c;
+    pendingKeys[pendingLen] = '\0';
+
+    if (strcmp(pendingKeys, "g") == 0 || strcmp(pendingKeys, "d") == 0 || strcmp(pendingKeys, "c") == 0) return 1;
+    if (strcmp(pendingKeys, "di") == 0 || strcmp(pendingKeys, "ci") == 0) return 1;
+    pendingLen = 0;
+    if (c == 0) return 1;
+
+    if (strcmp(pendingKeys, "gg") == 0) {
+        jumpToLine(false);
+        return 1;
+    }
+    if (pendingKeys[1] == 'i' && pendingKeys[2]) {
+        char object = pendingKeys[2];
+        if (object == 'b') object = '(';
+        if (object == 'B') object = '{';
+        bool selected = object == 'w' ? doc->selectInnerWord() : doc->selectInnerBrackets(object);
+        if (!selected) {
+            sprintf(statusMsg, "Nothing for %s", pendingKeys);
+            redrawView();
+            return 1;
+        }
+        doc->breakUndoGroup();
+        doc->deleteSelection();
+        if (pendingKeys[0] == 'c') {
+            mode = 'i';
+            strcpy(statusMsg, "-- INSERT --");
+        }
+        updateScroll(); redrawView();
+        return 1;
+    }
+    return 1;
+}
+
+// gg and G; in a paged file they go to the first or last page
+void TextEditor::jumpToLine(bool last) {
+    int page = last ? doc->getPageCount() - 1 : 0;
+    if (doc->isPaged() && doc->getPage() != page && doc->gotoPage(page)) firstVisibleLine = firstVisibleRow = 0;
+    doc->gotoLine(last ? doc->getBuffer()->lineCount() - 1 : 0);
+    updateScroll();
+    redrawView();
 }
 
-void TextEditor::undo() {
-    if (undoStack.isEmpty()) return;
-    char* currentText = new char[gapBuffer.getLength() + 1];
-    gapBuffer.getText(currentText, gapBuffer.getLength() + 1);
-    EditorState currentState(currentText, cursorPos, selectionStart, selectionEnd);
-    redoStack.push(currentState);
-    delete[] currentText;
-    EditorState prevState = undoStack.pop();
-    gapBuffer.loadFromString(prevState.text);
-    cursorPos = prevState.cursorPos;
-    selectionStart = prevState.selStart;
-    selectionEnd = prevState.selEnd;
+// --- Search & Command Prompt ---
+// Keys typed while the status bar shows a '/' or ':' prompt
+int TextEditor::handlePromptKey(int key) {
+    if (key == FL_Escape) {
+        mode = 'n';
+        strcpy(statusMsg, "-- NORMAL --");
+    } else if (key == FL_Enter || key == FL_KP_Enter) {
+        runPrompt();
+    } else if (key == FL_BackSpace) {
+        if (promptLen == 0) {
+            mode = 'n';
+            strcpy(statusMsg, "-- NORMAL --");
+        } else {
+            // Remove a whole UTF-8 character
+            while (promptLen > 1 && (prompt[promptLen - 1] & 0xC0) == 0x80) promptLen--;
+            prompt[--promptLen] = '\0';
+            sprintf(statusMsg, "%c%s", mode, prompt);
+        }
+    } else {
+        const char* text = Fl::event_text();
+        int len = Fl::event_length();
+        if (text && len > 0 && (unsigned char)text[0] >= 32 && text[0] != 127 &&
+            promptLen + len < (int)sizeof(prompt)) {
+            memcpy(prompt + promptLen, text, len);
+            promptLen += len;
+            prompt[promptLen] = '\0';
+            sprintf(statusMsg, "%c%s", mode, prompt);
+        }
+    }
+    redrawView();
+    return 1;
+}
+
+void TextEditor::runPrompt() {
+    char kind = mode;
+    mode = 'n';
+    strcpy(statusMsg, "-- NORMAL --");
+    if (kind == ':') {
+        runCommand(prompt);
+        return;
+    }
+
+    // "\v" starts a regular expression search on the worker thread
+    if (strncmp(prompt, "\\v", 2) == 0) {
+        doc->setSearchPattern("", 0);
+        if (!regex->start(prompt + 2, doc->getBuffer(), doc->getTextLock())) {
+            sprintf(statusMsg, "Bad regex: %.100s", regex->error());
+        } else {
+            regexVersion = doc->getVersion();
+            sprintf(statusMsg, "/\\v%.100s  searching...", regex->getPattern());
+        }
+        redraw();
+        return;
+    }
+
+    // An empty search repeats the last pattern
+    if (promptLen > 0) {
+        regex->clear();
+        doc->setSearchPattern(prompt, promptLen);
+    }
     redraw();
+    searchNext(true);
 }
 
-void TextEditor::redo() {
-    if (redoStack.isEmpty()) return;
-    char* currentText = new char[gapBuffer.getLength() + 1];
-    gapBuffer.getText(currentText, gapBuffer.getLength() + 1);
-    EditorState currentState(currentText, cursorPos, selectionStart, selectionEnd);
-    undoStack.push(currentState);
-    delete[] currentText;
-    EditorState nextState = redoStack.pop();
-    gapBuffer.loadFromString(nextState.text);
-    cursorPos = nextState.cursorPos;
-    selectionStart = nextState.selStart;
-    selectionEnd = nextState.selEnd;
+bool TextEditor::regexCurrent() const {
+    return regex->isActive() && regexVersion == doc->getVersion();
+}
+
+// Called on the worker thread; hands over to the FLTK thread
+void TextEditor::regexNotifyCb(void* data) {
+    Fl::awake(regexAwakeCb, data);
+}
+
+void TextEditor::regexAwakeCb(void* data) {
+    ((TextEditor*)data)->regexResultsArrived();
+}
+
+void TextEditor::regexRestartCb(void* data) {
+    TextEditor* self = (TextEditor*)data;
+    if (!self->regex->isActive()) return;
+    self->regex->restart(self->doc->getBuffer(), self->doc->getTextLock());
+    self->regexVersion = self->doc->getVersion();
+}
+
+// Repaints the visible rows so newly streamed matches show up
+void TextEditor::regexResultsArrived() {
+    if (!regexCurrent()) return;
+    if (mode == 'n') {
+        sprintf(statusMsg, "/\\v%.100s  %d match%s%s", regex->getPattern(), regex->matchCount(),
+                regex->matchCount() == 1 ? "" : "es",
+                regex->isRunning() ? "  searching..." : (regex->isTruncated() ? " (stopped)" : ""));
+    }
+    damageLines(firstVisibleLine, firstVisibleLine + visibleRows());
+}
+
+// Supported commands: s/old/new/ (or %s/old/new/g) replaces every match in
+// the file; noh clears the search highlight; set wrap and set nowrap turn
+// soft wrap on and off. Buffers: e <file>, enew, bn,
+// bp, b <n>, bd (bd! drops unsaved changes) and ls. stats toggles the
+// instrumentation; stats reset and stats dump [file] act on its histograms.
+void TextEditor::runCommand(const char* cmd) {
+    if (strcmp(cmd, "noh") == 0) {
+        doc->setSearchPattern("", 0);
+        regex->clear();
+        redraw();
+        return;
+    }
+    if (strcmp(cmd, "set wrap") == 0 || strcmp(cmd, "set nowrap") == 0) {
+        if (softWrap != (cmd[4] == 'w')) toggleWrap();
+        return;
+    }
+    if (strncmp(cmd, "stats", 5) == 0 && (cmd[5] == '\0' || cmd[5] == ' ')) {
+        runStatsCommand(cmd[5] ? cmd + 6 : "");
+        return;
+    }
+    if (strncmp(cmd, "page ", 5) == 0) {
+        if (!doc->isPaged()) strcpy(statusMsg, "Not a paged file");
+        else if (!doc->gotoPage(atoi(cmd + 5) - 1)) sprintf(statusMsg, "No page %.20s", cmd + 5);
+        firstVisibleLine = firstVisibleRow = 0;
+        updateScroll();
+        redrawView();
+        return;
+    }
+    if (strcmp(cmd, "bn") == 0) { nextBuffer(); return; }
+    if (strcmp(cmd, "bp") == 0) { prevBuffer(); return; }
+    if (strcmp(cmd, "bd") == 0 || strcmp(cmd, "bd!") == 0) { closeBuffer(cmd[2] == '!'); return; }
+    if (strcmp(cmd, "ls") == 0) { listBuffers(); return; }
+    if (strcmp(cmd, "enew") == 0) { newFile(); return; }
+    if (cmd[0] == 'e' && cmd[1] == ' ' && cmd[2]) { loadFromFile(cmd + 2); return; }
+    if (cmd[0] == 'b' && cmd[1] == ' ') {
+        int n = atoi(cmd + 2);
+        if (n >= 1 && n <= bufferCount) switchToBuffer(n - 1);
+        else sprintf(statusMsg, "No buffer %.20s", cmd + 2);
+        redrawView();
+        return;
+    }
+
+    if (cmd[0] == '%') cmd++;
+    if (cmd[0] != 's' || cmd[1] == '\0') {
+        sprintf(statusMsg, "Unknown command: %.100s", cmd);
+        return;
+    }
+
+    // Split "s<d>old<d>new[<d>flags]" on the delimiter <d>
+    char delim = cmd[1];
+    const char* from = cmd + 2;
+    const char* fromEnd = strchr(from, delim);
+    if (!fromEnd || fromEnd == from) {
+        strcpy(statusMsg, "Usage: s/old/new/");
+        return;
+    }
+    const char* to = fromEnd + 1;
+    const char* toEnd = strchr(to, delim);
+    int toLen = toEnd ? toEnd - to : strlen(to);
+
+    regex->clear();
+    doc->setSearchPattern(from, fromEnd - from);
+    int count = doc->replaceAll(to, toLen);
+    if (count == 0) sprintf(statusMsg, "Pattern not found: %.*s", (int)(fromEnd - from), from);
+    else sprintf(statusMsg, "%d replacement%s", count, count == 1 ? "" : "s");
+    updateScroll();
     redraw();
 }
 
-void TextEditor::startSelection() { if (!selecting) { selectionStart = cursorPos; selecting = true; } }
-void TextEditor::updateSelection() { selectionEnd = cursorPos; }
-void TextEditor::clearSelection() { selectionStart = -1; selectionEnd = -1; selecting = false; }
-bool TextEditor::hasSelection() const { return selectionStart != -1 && selectionEnd != -1 && selectionStart != selectionEnd; }
+void TextEditor::runStatsCommand(const char* args) {
+    if (args[0] == '\0') {
+        toggleStats();
+    } else if (strcmp(args, "reset") == 0) {
+        Metrics::reset();
+        strcpy(statusMsg, "Stats reset");
+    } else if (strncmp(args, "dump", 4) == 0) {
+        const char* path = args[4] == ' ' && args[5] ? args + 5 : "texteditor-stats.txt";
+        char label[64];
+        snprintf(label, sizeof(label), "texteditor %s", backend);
+        if (Metrics::dump(path, label, true)) sprintf(statusMsg, "Stats appended to %.100s", path);
+        else sprintf(statusMsg, "Cannot write %.100s", path);
+    } else {
+        strcpy(statusMsg, "Usage: stats [reset | dump [file]]");
+    }
+    redrawView();
+}
+
+void TextEditor::toggleStats() {
+    Metrics::enabled = !Metrics::enabled;
+    keyPending = false;
+    strcpy(statusMsg, Metrics::enabled ? "Stats on" : "Stats off");
+    redrawView();
+}
+
+void TextEditor::searchNext(bool forward) {
+    const Searcher& searcher = doc->getSearcher();
+    if (regex->isActive()) {
+        // Jump among the matches streamed in so far
+        int match = -1;
+        bool wrapped = false;
+        if (regexCurrent()) {
+            match = regex->nextMatch(doc->getCursor(), forward);
+            if (match < 0 && !regex->isRunning()) {
+                match = regex->nextMatch(forward ? -1 : 0x7fffffff, forward);
+                wrapped = true;
+            }
+        }
+        if (match >= 0) {
+            doc->clearSelection();
+            doc->setCursor(match);
+            updateScroll();
+            if (wrapped) strcpy(statusMsg, forward ? "Search hit BOTTOM, continuing at TOP"
+                                                   : "Search hit TOP, continuing at BOTTOM");
+        } else if (regex->isRunning() || !regexCurrent()) {
+            strcpy(statusMsg, "Still searching...");
+        } else {
+            sprintf(statusMsg, "Pattern not found: %.100s", regex->getPattern());
+        }
+    } else if (searcher.isEmpty()) {
+        strcpy(statusMsg, "No previous search");
+    } else {
+        bool wrapped;
+        if (!doc->findNext(forward, wrapped)) {
+            sprintf(statusMsg, "Pattern not found: %.100s", searcher.pattern());
+        } else if (wrapped) {
+            strcpy(statusMsg, forward ? "Search hit BOTTOM, continuing at TOP"
+                                      : "Search hit TOP, continuing at BOTTOM");
+        } else {
+            sprintf(statusMsg, "/%.100s", searcher.pattern());
+        }
+        updateScroll();
+    }
+    redrawView();
+}
+
+void TextEditor::undo() {
+    if (!doc->undo()) return;
+    updateScroll();
+    redrawView();
+}
+
+void TextEditor::redo() {
+    if (!doc->redo()) return;
+    updateScroll();
+    redrawView();
+}
 
 void TextEditor::saveToFile(const char* filename) {
-    std::ofstream file(filename);
-    if (file.is_open()) {
-        int len = gapBuffer.getLength();
-        for (int i = 0; i < len; i++) file << gapBuffer.getCharAt(i);
-        file.close();
-        sprintf(statusMsg, "Saved %s", filename);
-        redraw();
+    if (doc->saveToFile(filename)) {
+        // A buffer that was untitled without a journal gets one now
+        doc->setJournaling(true);
+        watchFiles();
+        snprintf(statusMsg, sizeof(statusMsg), "Saved %s", filename);
+    } else {
+        snprintf(statusMsg, sizeof(statusMsg), "Cannot save %s", filename);
     }
+    redrawView();
 }
 
+// Opens filename in a new buffer, or switches to it if it is already open.
+// An untouched empty untitled buffer is reused rather than left behind.
 void TextEditor::loadFromFile(const char* filename) {
-    std::ifstream file(filename);
-    if (file.is_open()) {
-        file.seekg(0, std::ios::end);
-        int size = file.tellg();
-        file.seekg(0, std::ios::beg);
-        char* content = new char[size + 1];
-        file.read(content, size);
-        content[size] = '\0';
-        gapBuffer.loadFromString(content);
-        cursorPos = 0;
-        clearSelection();
-        delete[] content;
-        file.close();
-        sprintf(statusMsg, "Loaded %s", filename);
+    int open = findBuffer(filename);
+    if (open >= 0) {
+        switchToBuffer(open);
+        return;
+    }
+
+    bool reuse = !doc->getFilePath() && !doc->isModified() && doc->getBuffer()->getLength() == 0;
+    Document* target = reuse ? doc : new Document(backend);
+    target->setHistoryBudget(historyBudget);
+    target->setPagedThreshold(pagedThreshold);
+    if (!target->loadFromFile(filename)) {
+        if (!reuse) delete target;
+        snprintf(statusMsg, sizeof(statusMsg), "Cannot open %s", filename);
         redraw();
+        return;
     }
+    // Journaling starts after the load so it replays the file's own journal
+    target->setJournaling(true);
+    if (reuse) {
+        regex->clear();
+        firstVisibleLine = 0;
+        firstVisibleRow = 0;
+    } else {
+        addBuffer(target);
+    }
+    watchFiles();
+    if (doc->getRecoveredEdits() > 0)
+        snprintf(statusMsg, sizeof(statusMsg), "Loaded %s, recovered %d unsaved edits", filename, doc->getRecoveredEdits());
+    else if (doc->isPaged())
+        snprintf(statusMsg, sizeof(statusMsg), "Loaded %s in %d pages", filename, doc->getPageCount());
+    else
+        snprintf(statusMsg, sizeof(statusMsg), "Loaded %s", filename);
+    updateScroll();
+    redraw();
 }
 
 void TextEditor::newFile() {
-    gapBuffer.clear();
-    cursorPos = 0;
-    clearSelection();
-    undoStack.clear();
-    redoStack.clear();
+    Document* created = new Document(backend);
+    created->setHistoryBudget(historyBudget);
+    // Untitled buffers share one journal path, so only one of them journals
+    // until it is saved
+    if (!hasUntitledBuffer()) created->setJournaling(true);
+    addBuffer(created);
     strcpy(statusMsg, "New file");
+}
+
+void TextEditor::setPagedThreshold(long long bytes) {
+    pagedThreshold = bytes;
+}
+
+// Repaints while the background line count runs, so line numbers and its
+// progress show up
+void TextEditor::indexTimerCb(void* data) {
+    ((TextEditor*)data)->redrawView();
+}
+
+// --- File Watching ---
+void TextEditor::watchFiles() {
+    watcher->clear();
+    for (int i = 0; i < bufferCount; i++) watcher->add(buffers[i].doc->getFilePath());
+}
+
+// A writer usually changes a file in several steps; reloading waits for a
+// short pause so a burst of them is picked up at once
+void TextEditor::watchCb(int, void* data) {
+    TextEditor* self = (TextEditor*)data;
+    if (!self->watcher->readEvents()) return;
+    Fl::remove_timeout(reloadCb, data);
+    Fl::add_timeout(0.05, reloadCb, data);
+}
+
+void TextEditor::reloadCb(void* data) {
+    ((TextEditor*)data)->reloadChangedFiles();
+}
+
+// The current buffer keeps the cursor on the same screen row; a cursor at
+// the end of an appended-to file follows the new text down
+void TextEditor::reloadChangedFiles() {
+    for (int i = 0; i < bufferCount; i++) {
+        Document* target = buffers[i].doc;
+        const char* path = target->getFilePath();
+        if (!path || !watcher->takeChanged(path)) continue;
+        if (target != doc) {
+            if (target->reloadFromDisk() == Document::RELOAD_FAILED)
+                sprintf(statusMsg, "Cannot reload %.200s", bufferName(i));
+            int lastLine = target->getBuffer()->lineCount() - 1;
+            if (buffers[i].firstVisibleLine > lastLine) {
+                buffers[i].firstVisibleLine = lastLine;
+                buffers[i].firstVisibleRow = 0;
+            }
+            continue;
+        }
+
+        TextBuffer* buffer = doc->getBuffer();
+        int cursorRow = buffer->lineOfOffset(doc->getCursor()) - firstVisibleLine;
+        bool modified = doc->isModified();
+        Document::Reload result = doc->reloadFromDisk();
+        if (result == Document::RELOAD_NONE) continue;
+        if (result == Document::RELOAD_FAILED) {
+            sprintf(statusMsg, "Cannot reload %.200s", bufferName(i));
+        } else if (result == Document::RELOAD_REWRITTEN) {
+            firstVisibleLine = std::max(buffer->lineOfOffset(doc->getCursor()) - cursorRow, 0);
+            firstVisibleRow = 0;
+            sprintf(statusMsg, "%.200s changed on disk%s", bufferName(i), modified ? "; u brings back your edits" : "");
+        } else if (result == Document::RELOAD_REPLACED) {
+            firstVisibleLine = std::max(std::min(firstVisibleLine, buffer->lineCount() - 1), 0);
+            firstVisibleRow = 0;
+            sprintf(statusMsg, "%.200s rewritten on disk; reloaded%s", bufferName(i),
+                    modified ? ", unsaved edits lost" : "");
+        }
+        updateScroll();
+        redrawView();
+    }
+}
+
+// --- Change Marks ---
+// Called on a document's diff worker; hands over to the FLTK thread
+void TextEditor::changesNotifyCb(void* data) {
+    Fl::awake(changesAwakeCb, data);
+}
+
+void TextEditor::changesAwakeCb(void* data) {
+    ((TextEditor*)data)->changesArrived();
+}
+
+void TextEditor::changesRestartCb(void* data) {
+    TextEditor* self = (TextEditor*)data;
+    self->doc->getChanges()->update(self->doc->getBuffer());
+}
+
+// Any buffer's worker may have finished; only the shown one is repainted
+void TextEditor::changesArrived() {
+    for (int i = 0; i < bufferCount; i++) {
+        int from, to;
+        if (buffers[i].doc->getChanges()->collect(buffers[i].doc->getBuffer(), from, to) && buffers[i].doc == doc)
+            damageLines(from, to);
+    }
+}
+
+void TextEditor::setHistoryBudget(long long bytes) {
+    historyBudget = bytes;
+    for (int i = 0; i < bufferCount; i++) buffers[i].doc->setHistoryBudget(bytes);
+    redrawView();
+}
+
+// --- Buffer List ---
+bool TextEditor::hasUntitledBuffer() const {
+    for (int i = 0; i < bufferCount; i++) {
+        if (!buffers[i].doc->getFilePath()) return true;
+    }
+    return false;
+}
+
+void TextEditor::addBuffer(Document* newDoc) {
+    if (bufferCount == bufferCapacity) {
+        Buffer* grown = new Buffer[bufferCapacity * 2];
+        memcpy(grown, buffers, bufferCount * sizeof(Buffer));
+        delete[] buffers;
+        buffers = grown;
+        bufferCapacity *= 2;
+    }
+    buffers[bufferCount].doc = newDoc;
+    newDoc->getChanges()->setNotify(changesNotifyCb, this);
+    buffers[bufferCount].firstVisibleLine = 0;
+    buffers[bufferCount].firstVisibleRow = 0;
+    bufferCount++;
+    switchToBuffer(bufferCount - 1);
+}
+
+// Switching only swaps which document the view draws; each buffer keeps
+// its text, undo history, highlighting state and scroll position
+void TextEditor::switchToBuffer(int index) {
+    if (doc) {
+        buffers[current].firstVisibleLine = firstVisibleLine;
+        buffers[current].firstVisibleRow = firstVisibleRow;
+    }
+    current = index;
+    doc = buffers[index].doc;
+    firstVisibleLine = buffers[index].firstVisibleLine;
+    firstVisibleRow = buffers[index].firstVisibleRow;
+    // Wrap width is set per document; this one may not have been shown at
+    // the current width yet
+    updateWrapWidth();
+
+    // Regex results belong to the buffer they were run on
+    regex->clear();
+    Fl::remove_timeout(regexRestartCb, this);
+
+    mode = 'n';
+    sprintf(statusMsg, "[%d/%d] %.200s", index + 1, bufferCount, bufferName(index));
     redraw();
-}
\ No newline at end of file
+}
+
+void TextEditor::nextBuffer() {
+    if (bufferCount > 1) switchToBuffer((current + 1) % bufferCount);
+}
+
+void TextEditor::prevBuffer() {
+    if (bufferCount > 1) switchToBuffer((current + bufferCount - 1) % bufferCount);
+}
+
+// Closing a buffer frees its document, and everything it holds, straight
+// away; closing the last one leaves an empty untitled buffer
+void TextEditor::closeBuffer(bool force) {
+    if (doc->isModified() && !force) {
+        sprintf(statusMsg, "%.100s has unsaved changes (:bd! discards them)", bufferName(current));
+        redrawView();
+        return;
+    }
+    // The regex worker may still be copying this document's text
+    regex->clear();
+    Fl::remove_timeout(regexRestartCb, this);
+    Document* closing = doc;
+    if (force) closing->discardRecovery();
+    bufferCount--;
+    memmove(buffers + current, buffers + current + 1, (bufferCount - current) * sizeof(Buffer));
+    doc = nullptr;
+    delete closing;
+
+    watchFiles();
+    if (bufferCount == 0) {
+        current = 0;
+        newFile();
+        return;
+    }
+    switchToBuffer(current < bufferCount ? current : bufferCount - 1);
+}
+
+int TextEditor::findBuffer(const char* filename) const {
+    char wanted[PATH_MAX], opened[PATH_MAX];
+    if (!realpath(filename, wanted)) return -1;
+    for (int i = 0; i < bufferCount; i++) {
+        const char* path = buffers[i].doc->getFilePath();
+        if (path && realpath(path, opened) && strcmp(opened, wanted) == 0) return i;
+    }
+    return -1;
+}
+
+const char* TextEditor::bufferName(int index) const {
+    const char* path = buffers[index].doc->getFilePath();
+    if (!path) return "[No Name]";
+    const char* slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+// ":ls" in the status bar: number, name, % for the current buffer and +
+// for unsaved changes
+void TextEditor::listBuffers() {
+    int len = 0;
+    statusMsg[0] = '\0';
+    for (int i = 0; i < bufferCount && len < (int)sizeof(statusMsg) - 1; i++) {
+        len += snprintf(statusMsg + len, sizeof(statusMsg) - len, "%s%d%s %s%s", i ? "  " : "", i + 1,
+                        i == current ? "%" : "", bufferName(i), buffers[i].doc->isModified() ? " +" : "");
+    }
+    redrawView();
+}
@@ -2,49 +2,144 @@
 #define TEXTEDITOR_H
 
 #include <FL/Fl_Widget.H>
-#include "GapBuffer.h"
-#include "Stack.h"
-#include "EditorState.h"
+#include "Document.h"
+#include "RegexSearch.h"
+#include "FileWatch.h"
 
 class TextEditor : public Fl_Widget {
 private:
-    GapBuffer gapBuffer;
-    int cursorPos;
-    int selectionStart;
-    int selectionEnd;
-    bool selecting;
+    // Open buffers, each with its own text, undo history and scroll
+    // position; doc is buffers[current].doc
+    struct Buffer {
+        Document* doc;
+        int firstVisibleLine;
+        int firstVisibleRow;
+    };
+    Buffer* buffers;
+    int bufferCount;
+    int bufferCapacity;
+    int current;
+    char backend[16];
+    long long historyBudget;   // undo memory allowed per buffer
+    long long pagedThreshold;  // files larger than this open paged
 
-    // Layout & Styling
+    Document* doc;
+    RegexSearch* regex;
+    int regexVersion;       // document version the regex results belong to
+    FileWatch* watcher;     // other processes' changes to open files
+    int changesVersion;     // document version the gutter marks were last asked for
+
+    // Layout & Styling. The view starts at row firstVisibleRow of
+    // firstVisibleLine; rows other than 0 only exist with soft wrap on.
     int firstVisibleLine;
+    int firstVisibleRow;
+    bool softWrap;
     int lineHeight;
     int charWidth;
     int gutterWidth;
     int fontSize;
 
-    char mode;
+    char mode;              // 'n'ormal, 'i'nsert, or '/' and ':' while typing a prompt
     char statusMsg[256];
+    char prompt[200];
+    int promptLen;
+    char pendingKeys[4];    // start of a normal mode command: g, d, c, di or ci
+    int pendingLen;
+
+    // Screen rows of the current frame: the line each shows and the column
+    // it starts at, and the same for the last frame
+    int* rowLines;
+    int* rowColumns;
+    int* drawnRowLines;
+    int* drawnRowColumns;
+    int rowCapacity;
+    int drawnRows;
 
-    Stack<EditorState> undoStack;
-    Stack<EditorState> redoStack;
+    // Partial redraw bookkeeping: what the last frame showed
+    int dirtyFrom;
+    int dirtyTo;
+    int drawnFirstVisibleLine;
+    int drawnFirstVisibleRow;
+    int drawnCursorLine;
+    int drawnSelLo;
+    int drawnSelHi;
+    int drawnCaretCount;
+    int drawnFontSize;
+    long long lineBase;        // file line of the buffer's first line; -1 unknown
+    long long drawnLineBase;
+
+    // Instrumentation: a keystroke is timed until the frame that shows it
+    bool keyPending;
+    long long keyStartUs;
+    long long keyStartAllocs;
 
     // Internal helpers (Private)
-    void moveCursorUp();
-    void moveCursorDown();
-    void saveState();
     void updateScroll();
     int xyToIndex(int x, int y); // Helper for mouse clicks
+    void drawLineText(int line, int firstColumn, int baselineY, int textAreaX);
+    void drawRow(int row, int cursorLine);
+    void drawCursor(int column, int cursorPos, int baselineY, int textAreaX);
+    void drawStatusBar(int cursorLine);
+    int visibleRows() const;
+    void updateWrapWidth();
+    void layoutRows(int rows);
+    int scrollDelta(int rows) const;
+    static void scrollExposeCb(void* data, int X, int Y, int W, int H);
+    void damageLines(int from, int to);
+    void redrawView();
+    int handleEvent(int event);
+    void drawFrame();
+    void runStatsCommand(const char* args);
+    int handlePromptKey(int key);
+    int handlePendingKey(int key);
+    void jumpToLine(bool last);
+    void runPrompt();
+    void runCommand(const char* cmd);
+    void searchNext(bool forward);
+    bool regexCurrent() const;
+    void regexResultsArrived();
+    static void regexNotifyCb(void* data);
+    static void regexAwakeCb(void* data);
+    static void regexRestartCb(void* data);
+    static void indexTimerCb(void* data);
+    static void watchCb(int fd, void* data);
+    static void reloadCb(void* data);
+    void watchFiles();
+    void reloadChangedFiles();
+    static void changesNotifyCb(void* data);
+    static void changesAwakeCb(void* data);
+    static void changesRestartCb(void* data);
+    void changesArrived();
+    bool hasUntitledBuffer() const;
+    void addBuffer(Document* newDoc);
+    void switchToBuffer(int index);
+    void closeBuffer(bool force);
+    int findBuffer(const char* filename) const;
+    const char* bufferName(int index) const;
+    void listBuffers();
 
 public:
-    TextEditor(int X, int Y, int W, int H);
+    TextEditor(int X, int Y, int W, int H, const char* backend = "gap");
+    ~TextEditor();
 
     void draw() override;
     int handle(int event) override;
 
-    // File Operations
+    // File Operations; new and opened files get their own buffer
     void newFile();
     void loadFromFile(const char* filename);
     void saveToFile(const char* filename);
 
+    // Buffer list
+    void nextBuffer();
+    void prevBuffer();
+    void closeBuffer() { closeBuffer(false); }
+
+    // Undo memory budget for every open and future buffer
+    void setHistoryBudget(long long bytes);
+    // Files over this size open in paged mode
+    void setPagedThreshold(long long bytes);
+
     // Edit Operations
     void undo();
     void redo();
@@ -54,16 +149,14 @@ public:
     void cutToClipboard();
     void pasteFromClipboard();
 
-    // Selection Helpers
-    void startSelection();
-    void updateSelection();
-    void clearSelection();
-    void deleteSelection();
-    bool hasSelection() const;
-
     // View Operations
     void zoomIn();
     void zoomOut();
+    // Soft wrap: long lines continue on the next screen rows
+    void toggleWrap();
+
+    // Latency/frame-time histograms, summarized in the status bar
+    void toggleStats();
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,315 @@
+#include "UndoFile.h"
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char MAGIC[4] = { 'T', 'E', 'U', '1' };
+static const int HEADER_SIZE = 4 + 4 + 8 + 3 * 8 + 4 + 8;
+static const unsigned long long MIX = 0x9E3779B97F4A7C15ULL;
+
+// --- ContentHash ---
+ContentHash::ContentHash() : hash(0x243F6A8885A308D3ULL), word(0), pending(0), length(0) {}
+
+void ContentHash::mix(unsigned long long w) {
+    hash = (hash ^ w) * MIX;
+    hash ^= hash >> 29;
+}
+
+void ContentHash::update(const char* data, int len) {
+    length += len;
+    // Finish a word the previous chunk left partial, then take whole words
+    while (len > 0 && pending > 0) {
+        word |= (unsigned long long)(unsigned char)*data++ << (8 * pending);
+        len--;
+        if (++pending == 8) {
+            mix(word);
+            word = 0;
+            pending = 0;
+        }
+    }
+    while (len >= 8) {
+        unsigned long long w;
+        memcpy(&w, data, 8);
+        mix(w);
+        data += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        word |= (unsigned long long)(unsigned char)*data++ << (8 * pending);
+        pending++;
+        len--;
+    }
+}
+
+unsigned long long ContentHash::value() const {
+    unsigned long long h = hash;
+    if (pending > 0) {
+        h = (h ^ word) * MIX;
+        h ^= h >> 29;
+    }
+    h = (h ^ length) * MIX;
+    return h ^ (h >> 32);
+}
+
+// --- Encoding ---
+// Buffered writer that tracks how many bytes it has produced
+struct OutFile {
+    int fd;
+    char data[64 * 1024];
+    int used;
+    long long offset;
+    bool ok;
+
+    OutFile(int f) : fd(f), used(0), offset(0), ok(true) {}
+
+    void flush() {
+        const char* p = data;
+        while (ok && used > 0) {
+            ssize_t n = ::write(fd, p, used);
+            if (n < 0) {
+                if (errno != EINTR) ok = false;
+                continue;
+            }
+            p += n;
+            used -= n;
+        }
+        used = 0;
+    }
+
+    void put(const void* bytes, int len) {
+        const char* p = (const char*)bytes;
+        offset += len;
+        while (len > 0) {
+            if (used == (int)sizeof(data)) flush();
+            int n = (int)sizeof(data) - used;
+            if (n > len) n = len;
+            memcpy(data + used, p, n);
+            used += n;
+            p += n;
+            len -= n;
+        }
+    }
+
+    void putVarint(unsigned long long v) {
+        char bytes[10];
+        int n = 0;
+        while (v >= 0x80) {
+            bytes[n++] = (char)(v | 0x80);
+            v >>= 7;
+        }
+        bytes[n++] = (char)v;
+        put(bytes, n);
+    }
+};
+
+// Decodes one varint from [p, end); returns false if it runs off the end
+static bool getVarint(const unsigned char*& p, const unsigned char* end, unsigned long long& v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (p == end) return false;
+        unsigned char b = *p++;
+        v |= (unsigned long long)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+static bool readAt(int fd, void* out, long long len, long long offset) {
+    char* p = (char*)out;
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// Size and mtime of a file, as stored in the header
+static void stampOf(const char* filename, long long stamp[3]) {
+    struct stat st;
+    stamp[0] = stamp[1] = stamp[2] = -1;
+    if (stat(filename, &st) == 0) {
+        stamp[0] = st.st_size;
+        stamp[1] = st.st_mtim.tv_sec;
+        stamp[2] = st.st_mtim.tv_nsec;
+    }
+}
+
+// --- UndoFile ---
+UndoFile::UndoFile() : fd(-1), count(0), offsets(nullptr), hash(0), stampMatches(false) {}
+
+UndoFile::~UndoFile() {
+    close();
+}
+
+void UndoFile::pathFor(const char* filename, char* out, int outSize) {
+    // dir/name -> dir/.name.undo
+    const char* slash = strrchr(filename, '/');
+    if (slash) {
+        snprintf(out, outSize, "%.*s/.%s.undo", (int)(slash - filename), filename, slash + 1);
+    } else {
+        snprintf(out, outSize, ".%s.undo", filename);
+    }
+}
+
+bool UndoFile::open(const char* path, const char* textFile) {
+    close();
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    // Header, then the index at the end of the file
+    unsigned char header[HEADER_SIZE];
+    struct stat st;
+    unsigned version, records;
+    long long stamp[3], current[3], indexOffset;
+    if (fstat(fd, &st) != 0 || !readAt(fd, header, HEADER_SIZE, 0) || memcmp(header, MAGIC, 4) != 0) {
+        close();
+        return false;
+    }
+    memcpy(&version, header + 4, 4);
+    memcpy(&hash, header + 8, 8);
+    memcpy(stamp, header + 16, sizeof(stamp));
+    memcpy(&records, header + 40, 4);
+    memcpy(&indexOffset, header + 44, 8);
+    if (version != FORMAT_VERSION || records > INT_MAX / 2 || indexOffset < HEADER_SIZE ||
+        indexOffset > st.st_size) {
+        close();
+        return false;
+    }
+
+    long long indexLen = st.st_size - indexOffset;
+    unsigned char* index = new unsigned char[indexLen > 0 ? indexLen : 1];
+    offsets = new long long[records + 1];
+    bool ok = readAt(fd, index, indexLen, indexOffset);
+    const unsigned char* p = index;
+    offsets[0] = HEADER_SIZE;
+    for (unsigned i = 0; ok && i < records; i++) {
+        unsigned long long len;
+        ok = getVarint(p, index + indexLen, len) && len <= (unsigned long long)(indexOffset - offsets[i]);
+        if (ok) offsets[i + 1] = offsets[i] + len;
+    }
+    delete[] index;
+    if (!ok) {
+        close();
+        return false;
+    }
+    count = records;
+    stampOf(textFile, current);
+    stampMatches = memcmp(stamp, current, sizeof(stamp)) == 0;
+    return true;
+}
+
+void UndoFile::close() {
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    count = 0;
+    stampMatches = false;
+    delete[] offsets;
+    offsets = nullptr;
+}
+
+long long UndoFile::recordBytes(int first, int n) const {
+    if (n <= 0) return 0;
+    return offsets[first + n] - offsets[first];
+}
+
+bool UndoFile::read(int i, EditorState& state) const {
+    if (i < 0 || i >= count) return false;
+    long long len = offsets[i + 1] - offsets[i];
+    unsigned char* body = new unsigned char[len > 0 ? len : 1];
+    bool ok = readAt(fd, body, len, offsets[i]);
+
+    const unsigned char* p = body;
+    const unsigned char* end = body + len;
+    unsigned long long fields[8];
+    for (int k = 0; ok && k < 8; k++) ok = getVarint(p, end, fields[k]) && fields[k] <= INT_MAX;
+    ok = ok && (unsigned long long)(end - p) == fields[1] + fields[2];
+    if (ok) {
+        const char* deleted = (const char*)p;
+        const char* inserted = deleted + fields[1];
+        state = EditorState((int)fields[0], deleted, (int)fields[1], inserted, (int)fields[2],
+                            (int)fields[3], (int)fields[5] - 1, (int)fields[6] - 1);
+        state.cursorAfter = (int)fields[4];
+        state.joined = fields[7] != 0;
+    }
+    delete[] body;
+    return ok;
+}
+
+bool UndoFile::write(const char* path, const char* textFile, unsigned long long contentHash, const UndoFile* old,
+                     int oldFirst, int oldCount, Stack<EditorState>& recent) {
+    char tempPath[PATH_MAX + 16];
+    snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", path);
+    int out = mkstemp(tempPath);
+    if (out < 0) return false;
+
+    int total = oldCount + recent.size();
+    long long* lengths = new long long[total > 0 ? total : 1];
+    OutFile file(out);
+    char header[HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    file.put(header, HEADER_SIZE);   // filled in once the index offset is known
+
+    // Older records are copied through as they are
+    bool ok = true;
+    char* copy = nullptr;
+    long long copyCapacity = 0;
+    for (int i = 0; ok && i < oldCount; i++) {
+        long long len = old->recordBytes(oldFirst + i, 1);
+        if (len > copyCapacity) {
+            delete[] copy;
+            copyCapacity = len;
+            copy = new char[copyCapacity];
+        }
+        ok = readAt(old->fd, copy, len, old->offsets[oldFirst + i]);
+        file.put(copy, len);
+        lengths[i] = len;
+    }
+    delete[] copy;
+
+    for (int i = 0; i < recent.size(); i++) {
+        const EditorState& s = recent.at(i);
+        long long start = file.offset;
+        file.putVarint(s.pos);
+        file.putVarint(s.deletedLen);
+        file.putVarint(s.insertedLen);
+        file.putVarint(s.cursorBefore);
+        file.putVarint(s.cursorAfter);
+        file.putVarint(s.selStart + 1);
+        file.putVarint(s.selEnd + 1);
+        file.putVarint(s.joined ? 1 : 0);
+        file.put(s.deleted, s.deletedLen);
+        file.put(s.inserted, s.insertedLen);
+        lengths[oldCount + i] = file.offset - start;
+    }
+
+    long long indexOffset = file.offset;
+    for (int i = 0; i < total; i++) file.putVarint(lengths[i]);
+    file.flush();
+    delete[] lengths;
+
+    unsigned version = FORMAT_VERSION;
+    long long stamp[3];
+    stampOf(textFile, stamp);
+    memcpy(header, MAGIC, 4);
+    memcpy(header + 4, &version, 4);
+    memcpy(header + 8, &contentHash, 8);
+    memcpy(header + 16, stamp, sizeof(stamp));
+    memcpy(header + 40, &total, 4);
+    memcpy(header + 44, &indexOffset, 8);
+    ok = ok && file.ok && pwrite(out, header, HEADER_SIZE, 0) == HEADER_SIZE && fsync(out) == 0;
+    ok = ::close(out) == 0 && ok;
+    if (!ok || rename(tempPath, path) != 0) {
+        unlink(tempPath);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,75 @@
+#ifndef UNDOFILE_H
+#define UNDOFILE_H
+
+#include "Stack.h"
+#include "EditorState.h"
+
+// 64-bit hash of a byte stream fed in chunks of any size; the result
+// doesn't depend on where the chunks split
+class ContentHash {
+private:
+    unsigned long long hash;
+    unsigned long long word;   // bytes of a word not yet mixed in
+    int pending;
+    unsigned long long length;
+
+    void mix(unsigned long long w);
+
+public:
+    ContentHash();
+    void update(const char* data, int len);
+    unsigned long long value() const;
+};
+
+// Undo history kept next to a file ("dir/.name.undo") so it survives
+// closing and reopening the file. Layout, integers little-endian:
+//   "TEU1", u32 format version, u64 content hash of the file the history
+//   ends at, the file's size and mtime (s, ns) as i64s, u32 record count,
+//   u64 offset of the index
+//   record bodies, oldest first: varints pos, deletedLen, insertedLen,
+//   cursorBefore, cursorAfter, selStart + 1, selEnd + 1, joined, then the
+//   deleted and inserted bytes
+//   index: the varint length of each body
+// Opening reads only the header and the index; a record's body is read
+// when undo reaches it. If the file's size and mtime still match, it is
+// taken as unchanged; otherwise its text has to hash to the saved value.
+class UndoFile {
+private:
+    int fd;
+    int count;
+    long long* offsets;   // body i is [offsets[i], offsets[i + 1])
+    unsigned long long hash;
+    bool stampMatches;
+
+    UndoFile(const UndoFile&);
+    UndoFile& operator=(const UndoFile&);
+
+public:
+    static const unsigned FORMAT_VERSION = 2;
+
+    UndoFile();
+    ~UndoFile();
+
+    static void pathFor(const char* filename, char* out, int outSize);
+
+    // Opens the history kept at path for textFile
+    bool open(const char* path, const char* textFile);
+    void close();
+    int recordCount() const { return count; }
+    unsigned long long contentHash() const { return hash; }
+    // textFile's size and mtime were the ones saved with the history
+    bool fileUnchanged() const { return stampMatches; }
+    // Encoded size of records [first, first + n)
+    long long recordBytes(int first, int n) const;
+    // Reads record i into state; false if the file is damaged
+    bool read(int i, EditorState& state) const;
+
+    // Writes the history ending at textFile, whose text has the given
+    // hash: records [oldFirst, oldFirst + oldCount) of old, then recent
+    // from bottom to top. Goes through a temp file and a rename like
+    // saving does.
+    static bool write(const char* path, const char* textFile, unsigned long long contentHash, const UndoFile* old,
+                      int oldFirst, int oldCount, Stack<EditorState>& recent);
+};
+
+#endif
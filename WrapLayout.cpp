@@ -0,0 +1,153 @@
+#include "WrapLayout.h"
+#include "ColumnIndex.h"
+#include "TextBuffer.h"
+#include <cstring>
+
+WrapLayout::WrapLayout(ColumnIndex* columnIndex)
+    : columns(columnIndex), width(0), counts(nullptr), capacity(0), gapStart(0), gapEnd(0), lineTotal(1) {}
+
+WrapLayout::~WrapLayout() {
+    delete[] counts;
+}
+
+// Every line gets an entry, none of them known yet
+void WrapLayout::allocate() {
+    if (capacity < lineTotal + 64) {
+        delete[] counts;
+        capacity = lineTotal + lineTotal / 8 + 64;
+        counts = new int[capacity];
+    }
+    memset(counts, 0xff, capacity * sizeof(int));
+    gapStart = lineTotal;
+    gapEnd = capacity;
+}
+
+// Turning wrapping off frees the counts; they are rebuilt lazily when it
+// comes back on
+void WrapLayout::setWidth(int columnsPerRow) {
+    if (columnsPerRow < 0) columnsPerRow = 0;
+    if (columnsPerRow > 0 && width == 0) allocate();
+    if (columnsPerRow == 0) {
+        delete[] counts;
+        counts = nullptr;
+        capacity = 0;
+    }
+    width = columnsPerRow;
+}
+
+void WrapLayout::reset(int lines) {
+    lineTotal = lines;
+    if (width > 0) allocate();
+}
+
+void WrapLayout::moveGapTo(int line) {
+    if (line < gapStart) {
+        int n = gapStart - line;
+        memmove(counts + gapEnd - n, counts + line, n * sizeof(int));
+        gapStart -= n;
+        gapEnd -= n;
+    } else if (line > gapStart) {
+        int n = line - gapStart;
+        memmove(counts + gapStart, counts + gapEnd, n * sizeof(int));
+        gapStart += n;
+        gapEnd += n;
+    }
+}
+
+void WrapLayout::onEdit(int firstLine, int lastLine, int lineDelta) {
+    lineTotal += lineDelta;
+    if (width == 0) return;
+
+    if (lineDelta > 0) {
+        if (gapEnd - gapStart < lineDelta) {
+            int count = capacity - (gapEnd - gapStart);
+            int newCapacity = capacity * 2;
+            if (newCapacity < count + lineDelta + 64) newCapacity = count + lineDelta + 64;
+            int* grown = new int[newCapacity];
+            int tail = capacity - gapEnd;
+            memcpy(grown, counts, gapStart * sizeof(int));
+            memcpy(grown + newCapacity - tail, counts + gapEnd, tail * sizeof(int));
+            delete[] counts;
+            counts = grown;
+            gapEnd = newCapacity - tail;
+            capacity = newCapacity;
+        }
+        moveGapTo(firstLine + 1);
+        gapStart += lineDelta;
+    } else if (lineDelta < 0) {
+        moveGapTo(firstLine + 1);
+        gapEnd -= lineDelta;
+    }
+
+    // Edited lines, including any just inserted, are counted again
+    for (int line = firstLine; line <= lastLine && line < lineTotal; line++) {
+        counts[line < gapStart ? line : line + (gapEnd - gapStart)] = -1;
+    }
+}
+
+int WrapLayout::rowsIn(const TextBuffer* buffer, int line) {
+    if (width == 0 || line < 0 || line >= lineTotal) return 1;
+    int& count = counts[line < gapStart ? line : line + (gapEnd - gapStart)];
+    if (count < 0) count = columns->columnCount(buffer, line);
+    return count <= width ? 1 : (count + width - 1) / width;
+}
+
+int WrapLayout::rowOfColumn(const TextBuffer* buffer, int line, int column) {
+    if (width == 0) return 0;
+    int row = column / width;
+    int rows = rowsIn(buffer, line);
+    return row < rows ? row : rows - 1;
+}
+
+int WrapLayout::advance(const TextBuffer* buffer, int& line, int& row, int delta) {
+    int lines = buffer->lineCount();
+    int moved = 0;
+    while (delta > 0) {
+        int below = rowsIn(buffer, line) - 1 - row;   // rows left in this line
+        if (below >= delta) {
+            row += delta;
+            moved += delta;
+            break;
+        }
+        if (line + 1 >= lines) {
+            row += below;
+            moved += below;
+            break;
+        }
+        moved += below + 1;
+        delta -= below + 1;
+        line++;
+        row = 0;
+    }
+    while (delta < 0) {
+        if (row >= -delta) {
+            row += delta;
+            moved += delta;
+            break;
+        }
+        if (line == 0) {
+            moved -= row;
+            row = 0;
+            break;
+        }
+        moved -= row + 1;
+        delta += row + 1;
+        line--;
+        row = rowsIn(buffer, line) - 1;
+    }
+    return moved;
+}
+
+int WrapLayout::rowsBetween(const TextBuffer* buffer, int fromLine, int fromRow, int toLine, int toRow, int limit) {
+    int rows;
+    if (width == 0) {
+        rows = toLine - fromLine;
+    } else if (fromLine == toLine) {
+        rows = toRow - fromRow;
+    } else {
+        rows = rowsIn(buffer, fromLine) - fromRow;
+        for (int line = fromLine + 1; line < toLine && rows < limit; line++) rows += rowsIn(buffer, line);
+        rows += toRow;
+    }
+    return rows < limit ? rows : limit;
+}
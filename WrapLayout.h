@@ -0,0 +1,54 @@
+#ifndef WRAPLAYOUT_H
+#define WRAPLAYOUT_H
+
+class TextBuffer;
+class ColumnIndex;
+
+// Soft-wrap layout for one document: which screen rows each line takes
+// when rows are width columns wide. A line wraps at column boundaries, so
+// its row count depends only on how many columns it has. That count is
+// cached per line in a gap array, filled in as lines are looked at; edits
+// clear the entries of the edited lines, and a new width (resize, zoom)
+// reuses every entry. With wrapping off each line is one row.
+class WrapLayout {
+private:
+    ColumnIndex* columns;
+    int width;         // columns per row; 0 when wrapping is off
+
+    // Column count of each line, -1 until known; only kept while wrapping
+    int* counts;
+    int capacity;
+    int gapStart;
+    int gapEnd;
+    int lineTotal;
+
+    void moveGapTo(int line);
+    void allocate();
+
+public:
+    WrapLayout(ColumnIndex* columnIndex);
+    ~WrapLayout();
+
+    void setWidth(int columnsPerRow);
+    int getWidth() const { return width; }
+    bool isWrapping() const { return width > 0; }
+
+    void reset(int lines);
+    // The text of lines [firstLine, lastLine] changed and the document
+    // gained lineDelta lines (negative when lines were removed)
+    void onEdit(int firstLine, int lastLine, int lineDelta);
+
+    int rowsIn(const TextBuffer* buffer, int line);
+    // Row of line that shows column; the end of a line that exactly fills
+    // its last row stays on that row
+    int rowOfColumn(const TextBuffer* buffer, int line, int column);
+
+    // Moves (line, row) by delta screen rows, stopping at the first and
+    // last rows; returns how many rows it moved (negative going up)
+    int advance(const TextBuffer* buffer, int& line, int& row, int delta);
+    // Screen rows from (fromLine, fromRow) down to (toLine, toRow),
+    // counting no further than limit
+    int rowsBetween(const TextBuffer* buffer, int fromLine, int fromRow, int toLine, int toRow, int limit);
+};
+
+#endif
@@ -4,8 +4,13 @@
 #include <FL/Fl_Native_File_Chooser.H>
 #include <FL/fl_draw.H>
 #include <cstdlib>
+#include <cstring>
 #include "TextEditor.h"
 
+#ifndef DEFAULT_BACKEND
+#define DEFAULT_BACKEND "gap"
+#endif
+
 TextEditor* editor = nullptr;
 
 // Callbacks
@@ -22,7 +27,8 @@ void save_cb(Fl_Widget* w, void* data) {
     chooser.type(Fl_Native_File_Chooser::BROWSE_SAVE_FILE);
     if (chooser.show() == 0) editor->saveToFile(chooser.filename());
 }
-void exit_cb(Fl_Widget* w, void* data) { exit(0); }
+// Closing the window ends Fl::run, so the editor is destroyed normally
+void exit_cb(Fl_Widget* w, void* data) { editor->window()->hide(); }
 void undo_cb(Fl_Widget* w, void* data) { editor->undo(); }
 void redo_cb(Fl_Widget* w, void* data) { editor->redo(); }
 void copy_cb(Fl_Widget* w, void* data) { editor->copyToClipboard(); }
@@ -30,8 +36,33 @@ void cut_cb(Fl_Widget* w, void* data) { editor->cutToClipboard(); }
 void paste_cb(Fl_Widget* w, void* data) { editor->pasteFromClipboard(); }
 void zoom_in_cb(Fl_Widget* w, void* data) { editor->zoomIn(); }
 void zoom_out_cb(Fl_Widget* w, void* data) { editor->zoomOut(); }
+void close_cb(Fl_Widget* w, void* data) { editor->closeBuffer(); }
+void stats_cb(Fl_Widget* w, void* data) { editor->toggleStats(); }
+void wrap_cb(Fl_Widget* w, void* data) { editor->toggleWrap(); }
+void next_buffer_cb(Fl_Widget* w, void* data) { editor->nextBuffer(); }
+void prev_buffer_cb(Fl_Widget* w, void* data) { editor->prevBuffer(); }
 
 int main(int argc, char** argv) {
+    // Pull out our own options and the files to open; FLTK rejects
+    // arguments it doesn't know
+    const char* backend = DEFAULT_BACKEND;
+    long long undoMb = 0;
+    long long pagedMb = 0;
+    int flArgc = 0, fileCount = 0;
+    char** flArgv = new char*[argc + 1];
+    char** files = new char*[argc];
+    for (int i = 0; i < argc; i++) {
+        if (i > 0 && strncmp(argv[i], "--backend=", 10) == 0) backend = argv[i] + 10;
+        else if (i > 0 && strncmp(argv[i], "--undo-mb=", 10) == 0) undoMb = atoll(argv[i] + 10);
+        else if (i > 0 && strncmp(argv[i], "--paged-mb=", 11) == 0) pagedMb = atoll(argv[i] + 11);
+        else if (i > 0 && argv[i][0] != '-') files[fileCount++] = argv[i];
+        else flArgv[flArgc++] = argv[i];
+    }
+    flArgv[flArgc] = nullptr;
+
+    // Lets worker threads (regex search) wake the event loop
+    Fl::lock();
+
     Fl::scheme("gleam");
     Fl::background(35, 35, 35);
     Fl::background2(45, 45, 45);
@@ -54,6 +85,7 @@ int main(int argc, char** argv) {
     menubar->add("File/New File",     FL_CTRL + 'n', new_cb);
     menubar->add("File/Open...",      FL_CTRL + 'o', open_cb);
     menubar->add("File/Save",         FL_CTRL + 's', save_cb);
+    menubar->add("File/Close Buffer", FL_CTRL + 'w', close_cb);
     menubar->add("File/Exit",         FL_CTRL + 'q', exit_cb);
     menubar->add("Edit/Undo",         FL_CTRL + 'z', undo_cb);
     menubar->add("Edit/Redo",         FL_CTRL + 'y', redo_cb);
@@ -62,12 +94,23 @@ int main(int argc, char** argv) {
     menubar->add("Edit/Paste",        FL_CTRL + 'v', paste_cb);
     menubar->add("View/Zoom In",      FL_CTRL + '=', zoom_in_cb);
     menubar->add("View/Zoom Out",     FL_CTRL + '-', zoom_out_cb);
+    menubar->add("View/Soft Wrap",    FL_ALT + 'z',  wrap_cb);
+    menubar->add("View/Next Buffer",     FL_CTRL + FL_Page_Down, next_buffer_cb);
+    menubar->add("View/Previous Buffer", FL_CTRL + FL_Page_Up,   prev_buffer_cb);
+    menubar->add("View/Instrumentation", FL_F + 12,              stats_cb);
 
-    editor = new TextEditor(0, 30, 1024, 738);
+    editor = new TextEditor(0, 30, 1024, 738, backend);
+    if (undoMb > 0) editor->setHistoryBudget(undoMb << 20);
+    if (pagedMb > 0) editor->setPagedThreshold(pagedMb << 20);
+    for (int i = 0; i < fileCount; i++) editor->loadFromFile(files[i]);
+    delete[] files;
 
     window->end();
     window->resizable(editor);
-    window->show(argc, argv);
+    window->show(flArgc, flArgv);
 
-    return Fl::run();
+    int result = Fl::run();
+    delete window;   // flushes the crash-recovery journal
+    delete[] flArgv;
+    return result;
 }
\ No newline at end of file